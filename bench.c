@@ -0,0 +1,367 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "mapreduce.h"
+#include "tokenizer.h"
+
+// Longest list of worker or partition counts to sweep
+#define MAX_SWEEP 16
+
+// Settings of one benchmark session, filled in from the command line
+typedef struct {
+    const char *shape;       // "huge", "tiny" or "mixed"
+    long bytes;              // Total corpus size
+    unsigned int files;      // Number of files for the tiny and mixed shapes
+    unsigned int vocab;      // Distinct words in the vocabulary
+    double zipf;             // Zipf exponent of word frequencies
+    uint64_t seed;           // Generator seed; equal seeds give equal corpora
+    const char *dir;         // Directory the corpus is written to
+    unsigned int workers[MAX_SWEEP];
+    unsigned int worker_count;
+    unsigned int parts[MAX_SWEEP];
+    unsigned int part_count;
+    unsigned int repeat;     // Runs per configuration
+    bool options;            // MR_RunWithOptions as distwc calls it, instead of MR_Run
+    bool json;               // JSON instead of CSV
+} BenchConfig;
+
+// What a child process reports about its run through a pipe
+typedef struct {
+    double seconds;
+    MR_PhaseTimes phases;
+} RunResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64* generator, so corpora do not depend on the C library's rand
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// Spells word number rank in bijective base 26 ("a".."z", "aa", ...), so
+// every rank gets a distinct lowercase word and frequent words are short
+static size_t spell_word(unsigned int rank, char *word) {
+    char reversed[16];
+    size_t len = 0;
+    rank++;
+    while (rank > 0) {
+        rank--;
+        reversed[len++] = (char)('a' + rank % 26);
+        rank /= 26;
+    }
+    for (size_t i = 0; i < len; i++) {
+        word[i] = reversed[len - 1 - i];
+    }
+    return len;
+}
+
+// Builds the cumulative Zipf distribution over vocab ranks
+static double *zipf_table(unsigned int vocab, double exponent) {
+    double *cdf = malloc(vocab * sizeof(double));
+    double total = 0;
+    for (unsigned int r = 0; r < vocab; r++) {
+        total += 1.0 / pow(r + 1, exponent);
+        cdf[r] = total;
+    }
+    for (unsigned int r = 0; r < vocab; r++) {
+        cdf[r] /= total;
+    }
+    return cdf;
+}
+
+// Draws a rank from the Zipf table by binary search
+static unsigned int draw_rank(const double *cdf, unsigned int vocab, uint64_t *state) {
+    double u = (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+    unsigned int low = 0, high = vocab - 1;
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        if (cdf[mid] < u) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Writes one file of about bytes bytes of Zipf-distributed words in lines
+// of about 70 characters, adding its token count to *tokens
+static void write_corpus_file(const char *name, long bytes, const double *cdf, unsigned int vocab,
+                              uint64_t *state, unsigned long *tokens) {
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        perror(name);
+        exit(1);
+    }
+    char word[16];
+    long written = 0, line = 0;
+    while (written < bytes) {
+        size_t len = spell_word(draw_rank(cdf, vocab, state), word);
+        fwrite(word, 1, len, file);
+        line += (long)len + 1;
+        fputc(line > 70 ? '\n' : ' ', file);
+        if (line > 70) {
+            line = 0;
+        }
+        written += (long)len + 1;
+        (*tokens)++;
+    }
+    fclose(file);
+}
+
+// Generates the corpus and returns its file names. The huge shape is one
+// file; tiny splits the bytes evenly over config->files files; mixed puts
+// half the bytes in one file and spreads the rest over the others
+static char **generate_corpus(const BenchConfig *config, unsigned int *count, unsigned long *tokens) {
+    mkdir(config->dir, 0755);
+    bool huge = strcmp(config->shape, "huge") == 0;
+    bool mixed = strcmp(config->shape, "mixed") == 0;
+    *count = huge ? 1 : config->files;
+    if (mixed && *count < 2) {
+        *count = 2;
+    }
+
+    double *cdf = zipf_table(config->vocab, config->zipf);
+    uint64_t state = config->seed ? config->seed : 1;
+    char **names = malloc(*count * sizeof(char *));
+    *tokens = 0;
+    for (unsigned int i = 0; i < *count; i++) {
+        long bytes = config->bytes / *count;
+        if (mixed) {
+            bytes = i == 0 ? config->bytes / 2 : config->bytes / 2 / (*count - 1);
+        }
+        names[i] = malloc(strlen(config->dir) + 32);
+        sprintf(names[i], "%s/corpus-%u.txt", config->dir, i);
+        write_corpus_file(names[i], bytes, cdf, config->vocab, &state, tokens);
+    }
+    free(cdf);
+    return names;
+}
+
+static void EmitToken(const char *token, size_t len, void *arg) {
+    (void)arg;
+    MR_EmitIntSlice(token, len, 1);
+}
+
+// Split mapper, as in distwc
+static void MapSplit(MR_Split *split) {
+    MR_Input input;
+    if (MR_OpenInput(split, &input)) {
+        Tokenizer_scan(input.data, input.length, EmitToken, NULL);
+        MR_CloseInput(&input);
+    }
+}
+
+// Whole-file mapper for MR_Run
+static void MapFile(char *file_name) {
+    struct stat st;
+    if (stat(file_name, &st) != 0) {
+        return;
+    }
+    MR_Split split = {file_name, 0, (long)st.st_size};
+    MapSplit(&split);
+}
+
+// Sums the counts without writing output files, so the timings measure
+// the framework rather than the disk
+static volatile int64_t reduce_sink;
+
+static void Reduce(char *key, unsigned int partition_idx) {
+    int64_t count = 0, value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        count += value;
+    }
+    reduce_sink += count;
+}
+
+static int64_t Combine(int64_t accumulated, int64_t value) {
+    return accumulated + value;
+}
+
+// Runs one configuration in a child process, so its peak RSS is its own.
+// The library's progress messages go to /dev/null
+static bool run_child(const BenchConfig *config, char **files, unsigned int file_count,
+                      unsigned int workers, unsigned int parts, RunResult *result, long *peak_rss_kb) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return false;
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        if (!freopen("/dev/null", "w", stdout)) {
+            _exit(1);
+        }
+        RunResult child;
+        MR_Options options = {0};
+        options.results = MR_CreateResults();
+        double start = now_seconds();
+        if (config->options) {
+            options.combiner = Combine;
+            options.schedule = TP_POLICY_LJF;
+            options.split_mapper = MapSplit;
+            options.balance_reduce = true;
+            MR_RunWithOptions(file_count, files, NULL, Reduce, workers, parts, &options);
+        } else {
+            MR_RunWithOptions(file_count, files, MapFile, Reduce, workers, parts, &options);
+        }
+        child.seconds = now_seconds() - start;
+        MR_GetPhaseTimes(options.results, &child.phases);
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        return false;
+    }
+    *peak_rss_kb = usage.ru_maxrss;
+    return got == sizeof(*result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Parses a comma-separated list of counts
+static unsigned int parse_list(const char *text, unsigned int *values) {
+    unsigned int count = 0;
+    char *copy = strdup(text), *rest = copy, *item;
+    while ((item = strsep(&rest, ",")) != NULL && count < MAX_SWEEP) {
+        if (atoi(item) > 0) {
+            values[count++] = (unsigned int)atoi(item);
+        }
+    }
+    free(copy);
+    return count;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [--shape huge|tiny|mixed] [--bytes N] [--files N] [--vocab N] [--zipf S]\n"
+            "          [--seed N] [--dir DIR] [--workers LIST] [--parts LIST] [--repeat N]\n"
+            "          [--options] [--json]\n",
+            name);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig config = {"huge", 64L << 20, 256, 50000, 1.1, 42, "bench_corpus", {1, 2, 4, 8}, 4,
+                          {10}, 1, 1, false, false};
+    for (int arg = 1; arg < argc; arg++) {
+        bool has_value = arg + 1 < argc;
+        if (strcmp(argv[arg], "--shape") == 0 && has_value) {
+            config.shape = argv[++arg];
+        } else if (strcmp(argv[arg], "--bytes") == 0 && has_value) {
+            config.bytes = atol(argv[++arg]);
+        } else if (strcmp(argv[arg], "--files") == 0 && has_value) {
+            config.files = (unsigned int)atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--vocab") == 0 && has_value) {
+            config.vocab = (unsigned int)atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--zipf") == 0 && has_value) {
+            config.zipf = atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--seed") == 0 && has_value) {
+            config.seed = strtoull(argv[++arg], NULL, 10);
+        } else if (strcmp(argv[arg], "--dir") == 0 && has_value) {
+            config.dir = argv[++arg];
+        } else if (strcmp(argv[arg], "--workers") == 0 && has_value) {
+            config.worker_count = parse_list(argv[++arg], config.workers);
+        } else if (strcmp(argv[arg], "--parts") == 0 && has_value) {
+            config.part_count = parse_list(argv[++arg], config.parts);
+        } else if (strcmp(argv[arg], "--repeat") == 0 && has_value) {
+            config.repeat = (unsigned int)atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--options") == 0) {
+            config.options = true;
+        } else if (strcmp(argv[arg], "--json") == 0) {
+            config.json = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    bool known_shape = strcmp(config.shape, "huge") == 0 || strcmp(config.shape, "tiny") == 0 ||
+                       strcmp(config.shape, "mixed") == 0;
+    if (!known_shape || config.bytes <= 0 || config.files == 0 || config.vocab == 0 ||
+        config.worker_count == 0 || config.part_count == 0 || config.repeat == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    unsigned int file_count;
+    unsigned long tokens;
+    double start = now_seconds();
+    char **files = generate_corpus(&config, &file_count, &tokens);
+    fprintf(stderr, "Generated %s corpus: %u files, %ld bytes, %lu tokens in %.2f s\n", config.shape,
+            file_count, config.bytes, tokens, now_seconds() - start);
+
+    const char *api = config.options ? "options" : "run";
+    if (config.json) {
+        printf("[\n");
+    } else {
+        printf("api,shape,files,bytes,tokens,workers,parts,run,seconds,map_seconds,reduce_seconds,"
+               "output_seconds,mb_per_s,mtokens_per_s,peak_rss_kb\n");
+    }
+    bool first = true;
+    int failures = 0;
+    for (unsigned int w = 0; w < config.worker_count; w++) {
+        for (unsigned int p = 0; p < config.part_count; p++) {
+            for (unsigned int r = 0; r < config.repeat; r++) {
+                RunResult result;
+                long rss = 0;
+                if (!run_child(&config, files, file_count, config.workers[w], config.parts[p], &result,
+                               &rss)) {
+                    fprintf(stderr, "Run with %u workers and %u partitions failed\n",
+                            config.workers[w], config.parts[p]);
+                    failures++;
+                    continue;
+                }
+                double mb_per_s = config.bytes / result.seconds / 1e6;
+                double mtokens_per_s = tokens / result.seconds / 1e6;
+                if (config.json) {
+                    printf("%s  {\"api\": \"%s\", \"shape\": \"%s\", \"files\": %u, \"bytes\": %ld, "
+                           "\"tokens\": %lu, \"workers\": %u, \"parts\": %u, \"run\": %u, "
+                           "\"seconds\": %.4f, \"map_seconds\": %.4f, \"reduce_seconds\": %.4f, "
+                           "\"output_seconds\": %.4f, \"mb_per_s\": %.1f, \"mtokens_per_s\": %.2f, "
+                           "\"peak_rss_kb\": %ld}",
+                           first ? "" : ",\n", api, config.shape, file_count, config.bytes, tokens,
+                           config.workers[w], config.parts[p], r, result.seconds,
+                           result.phases.map_seconds, result.phases.reduce_seconds,
+                           result.phases.output_seconds, mb_per_s, mtokens_per_s, rss);
+                } else {
+                    printf("%s,%s,%u,%ld,%lu,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.1f,%.2f,%ld\n", api,
+                           config.shape, file_count, config.bytes, tokens, config.workers[w],
+                           config.parts[p], r, result.seconds, result.phases.map_seconds,
+                           result.phases.reduce_seconds, result.phases.output_seconds, mb_per_s,
+                           mtokens_per_s, rss);
+                }
+                first = false;
+                fflush(stdout);
+            }
+        }
+    }
+    if (config.json) {
+        printf("\n]\n");
+    }
+
+    for (unsigned int i = 0; i < file_count; i++) {
+        free(files[i]);
+    }
+    free(files);
+    return failures > 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tokenizer.h"
+
+// Size of the synthetic text and number of timed passes over it
+#define BENCH_BYTES (64 * 1024 * 1024)
+#define BENCH_PASSES 3
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counts tokens and their bytes so the work cannot be optimized away
+static void count_token(const char *token, size_t len, void *arg) {
+    (void)token;
+    size_t *totals = arg;
+    totals[0]++;
+    totals[1] += len;
+}
+
+// Fills buffer with lines of short words, like natural-language text
+static void make_text(char *buffer, size_t length) {
+    static const char *words[] = {"the", "of", "and", "a", "to", "in", "is", "you", "that", "it",
+                                  "he", "was", "for", "on", "are", "as", "with", "his", "they",
+                                  "mapreduce", "partition", "tokenizer", "benchmark"};
+    size_t used = 0, line = 0;
+    srand(42);
+    while (used < length) {
+        const char *word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        if (used + len + 1 > length) {
+            break;
+        }
+        memcpy(buffer + used, word, len);
+        used += len;
+        line += len + 1;
+        buffer[used++] = line > 70 ? '\n' : ' ';
+        if (line > 70) {
+            line = 0;
+        }
+    }
+    memset(buffer + used, ' ', length - used);
+}
+
+// The mapper's original path: copy each line to a heap buffer, then strsep
+static void scan_strsep(const char *data, size_t length, size_t *totals) {
+    char *line = NULL;
+    size_t capacity = 0, pos = 0;
+    while (pos < length) {
+        const char *end = memchr(data + pos, '\n', length - pos);
+        size_t len = end ? (size_t)(end - (data + pos)) + 1 : length - pos;
+        if (len + 1 > capacity) {
+            capacity = len + 1;
+            line = realloc(line, capacity);
+        }
+        memcpy(line, data + pos, len);
+        line[len] = '\0';
+        pos += len;
+
+        char *token, *dummy = line;
+        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
+            size_t token_len = strlen(token);
+            if (token_len > 0) {
+                count_token(token, token_len, totals);
+            }
+        }
+    }
+    free(line);
+}
+
+// Runs one scanner over the text and prints its best throughput
+static void report(const char *name, const char *text, Tokenizer_impl_t impl) {
+    double best = 0;
+    size_t totals[2] = {0, 0};
+    for (int pass = 0; pass < BENCH_PASSES; pass++) {
+        totals[0] = totals[1] = 0;
+        double start = now_seconds();
+        if (impl == TOKENIZER_AUTO) {
+            scan_strsep(text, BENCH_BYTES, totals);
+        } else {
+            Tokenizer_scan(text, BENCH_BYTES, count_token, totals);
+        }
+        double elapsed = now_seconds() - start;
+        if (best == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    printf("%-8s %10zu tokens %8.1f MB/s %8.1f Mtokens/s\n", name, totals[0],
+           BENCH_BYTES / best / 1e6, totals[0] / best / 1e6);
+}
+
+int main() {
+    char *text = malloc(BENCH_BYTES);
+    make_text(text, BENCH_BYTES);
+
+    printf("Tokenizing %d MB of synthetic text, best of %d passes\n", BENCH_BYTES >> 20, BENCH_PASSES);
+    report("strsep", text, TOKENIZER_AUTO);
+
+    Tokenizer_impl_t impls[] = {TOKENIZER_SCALAR, TOKENIZER_SSE2, TOKENIZER_AVX2};
+    for (int i = 0; i < 3; i++) {
+        Tokenizer_impl_t used = Tokenizer_select(impls[i]);
+        if (used != impls[i]) {
+            printf("%-8s not supported on this CPU\n", Tokenizer_name(impls[i]));
+            continue;
+        }
+        report(Tokenizer_name(used), text, used);
+    }
+
+    free(text);
+    return 0;
+}
@@ -0,0 +1,278 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+// First bytes of a cache file; the digit is bumped when the layout changes
+static const char CACHE_MAGIC[8] = {'M', 'R', 'C', 'A', 'C', 'H', 'E', '1'};
+
+// Makes room for extra more bytes in a record buffer
+static void reserve(Cache_records_t *records, size_t extra) {
+    if (records->len + extra <= records->capacity) {
+        return;
+    }
+    size_t capacity = records->capacity ? records->capacity : 4096;
+    while (capacity < records->len + extra) {
+        capacity *= 2;
+    }
+    records->bytes = realloc(records->bytes, capacity);
+    records->capacity = capacity;
+}
+
+// Appends an unsigned varint to a buffer with room for ten bytes
+static size_t put_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+// Decodes a varint from [*pos, end), advancing *pos; false when truncated
+static bool get_varint(const unsigned char **pos, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (unsigned int shift = 0; shift < 64 && *pos < end; shift += 7) {
+        unsigned char byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Create an empty cache
+Cache_t *Cache_create(void) {
+    Cache_t *cache = calloc(1, sizeof(Cache_t));
+    cache->sorted = true;
+    return cache;
+}
+
+// Destroy a cache and its entries
+void Cache_destroy(Cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+    for (unsigned int i = 0; i < cache->count; i++) {
+        free(cache->entries[i].path);
+        free(cache->entries[i].records.bytes);
+    }
+    free(cache->entries);
+    free(cache);
+}
+
+// Add an entry, taking over its records
+void Cache_add(Cache_t *cache, const char *path, uint64_t size, int64_t mtime_ns, uint64_t hash,
+               Cache_records_t *records) {
+    if (cache->count == cache->capacity) {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 16;
+        cache->entries = realloc(cache->entries, cache->capacity * sizeof(Cache_entry_t));
+    }
+    Cache_entry_t *entry = &cache->entries[cache->count++];
+    entry->path = strdup(path);
+    entry->size = size;
+    entry->mtime_ns = mtime_ns;
+    entry->hash = hash;
+    entry->records = *records;
+    memset(records, 0, sizeof(*records));
+    cache->sorted = false;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const Cache_entry_t *)a)->path, ((const Cache_entry_t *)b)->path);
+}
+
+// Find an input's entry by binary search, sorting the entries first if needed
+Cache_entry_t *Cache_find(Cache_t *cache, const char *path) {
+    if (cache->count == 0) {
+        return NULL;
+    }
+    if (!cache->sorted) {
+        qsort(cache->entries, cache->count, sizeof(Cache_entry_t), compare_entries);
+        cache->sorted = true;
+    }
+    Cache_entry_t key = {.path = (char *)path};
+    return bsearch(&key, cache->entries, cache->count, sizeof(Cache_entry_t), compare_entries);
+}
+
+// Append one record
+void Cache_put_record(Cache_records_t *records, const char *key, size_t key_len, int64_t value) {
+    reserve(records, key_len + 20);
+    records->len += put_varint(records->bytes + records->len, key_len);
+    memcpy(records->bytes + records->len, key, key_len);
+    records->len += key_len;
+    records->len += put_varint(records->bytes + records->len, zigzag(value));
+    records->count++;
+}
+
+// Decode the next record
+bool Cache_next_record(const Cache_records_t *records, size_t *offset, const char **key,
+                       size_t *key_len, int64_t *value) {
+    const unsigned char *pos = records->bytes + *offset;
+    const unsigned char *end = records->bytes + records->len;
+    uint64_t len, encoded;
+    if (*offset >= records->len || !get_varint(&pos, end, &len) || len > (uint64_t)(end - pos)) {
+        return false;
+    }
+    *key = (const char *)pos;
+    *key_len = (size_t)len;
+    pos += len;
+    if (!get_varint(&pos, end, &encoded)) {
+        return false;
+    }
+    *value = unzigzag(encoded);
+    *offset = (size_t)(pos - records->bytes);
+    return true;
+}
+
+// Hash a file's contents eight bytes at a time with a multiply-xorshift
+// mix; the tail is folded in byte by byte
+bool Cache_hash_file(const char *path, uint64_t *hash) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (uint64_t)st.st_size;
+    if (st.st_size > 0) {
+        const unsigned char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        size_t size = (size_t)st.st_size, i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, data + i, 8);
+            h = (h ^ word) * 0xff51afd7ed558ccdULL;
+            h ^= h >> 32;
+        }
+        for (; i < size; i++) {
+            h = (h ^ data[i]) * 0x100000001b3ULL;
+        }
+        munmap((void *)data, size);
+    }
+    close(fd);
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    *hash = h ? h : 1;
+    return true;
+}
+
+// Writes a varint to a file
+static void write_varint(FILE *file, uint64_t value) {
+    unsigned char buffer[10];
+    fwrite(buffer, 1, put_varint(buffer, value), file);
+}
+
+// Write the cache to a temporary file next to path, then rename it over path
+bool Cache_save(const Cache_t *cache, const char *path) {
+    size_t len = strlen(path);
+    char *temp = malloc(len + 8);
+    snprintf(temp, len + 8, "%s.tmp", path);
+    FILE *file = fopen(temp, "wb");
+    if (!file) {
+        free(temp);
+        return false;
+    }
+
+    fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC), file);
+    write_varint(file, cache->count);
+    for (unsigned int i = 0; i < cache->count; i++) {
+        const Cache_entry_t *entry = &cache->entries[i];
+        size_t path_len = strlen(entry->path);
+        write_varint(file, path_len);
+        fwrite(entry->path, 1, path_len, file);
+        write_varint(file, entry->size);
+        write_varint(file, zigzag(entry->mtime_ns));
+        write_varint(file, entry->hash);
+        write_varint(file, entry->records.count);
+        write_varint(file, entry->records.len);
+        fwrite(entry->records.bytes, 1, entry->records.len, file);
+    }
+
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+    if (!ok) {
+        unlink(temp);
+    }
+    free(temp);
+    return ok;
+}
+
+// Parses the entries of a cache file held in memory
+static bool parse_cache(const unsigned char *data, size_t size, Cache_t *cache) {
+    const unsigned char *pos = data + sizeof(CACHE_MAGIC), *end = data + size;
+    uint64_t count;
+    if (size < sizeof(CACHE_MAGIC) || memcmp(data, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        !get_varint(&pos, end, &count)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t path_len, file_size, mtime, hash, record_count, records_len;
+        if (!get_varint(&pos, end, &path_len) || path_len > (uint64_t)(end - pos)) {
+            return false;
+        }
+        char *path = strndup((const char *)pos, (size_t)path_len);
+        pos += path_len;
+        if (!get_varint(&pos, end, &file_size) || !get_varint(&pos, end, &mtime) ||
+            !get_varint(&pos, end, &hash) || !get_varint(&pos, end, &record_count) ||
+            !get_varint(&pos, end, &records_len) || records_len > (uint64_t)(end - pos)) {
+            free(path);
+            return false;
+        }
+        Cache_records_t records = {malloc(records_len + 1), (size_t)records_len, (size_t)records_len + 1,
+                                   record_count};
+        memcpy(records.bytes, pos, records_len);
+        pos += records_len;
+        Cache_add(cache, path, file_size, unzigzag(mtime), hash, &records);
+        free(path);
+    }
+    return pos == end;
+}
+
+// Read a cache file
+bool Cache_load(const char *path, Cache_t **cache) {
+    *cache = Cache_create();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+    struct stat st;
+    bool ok = false;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            ok = parse_cache(data, (size_t)st.st_size, *cache);
+            munmap(data, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+    if (!ok) {
+        Cache_destroy(*cache);
+        *cache = Cache_create();
+    }
+    return ok;
+}
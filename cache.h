@@ -0,0 +1,132 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Growable buffer of <key, integer value> records, each a varint key
+// length, the key bytes and a zigzag varint value
+typedef struct {
+    unsigned char *bytes;
+    size_t len;
+    size_t capacity;
+    uint64_t count;
+} Cache_records_t;
+
+// Partial results of one input file, with the identity of the file they
+// were computed from: its size, modification time and content hash (0
+// when the file was never hashed)
+typedef struct {
+    char *path;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    Cache_records_t records;
+} Cache_entry_t;
+
+// Set of cached inputs, sorted by path once loaded
+typedef struct {
+    Cache_entry_t *entries;
+    unsigned int count;
+    unsigned int capacity;
+    bool sorted;
+} Cache_t;
+
+/**
+ * C style constructor for an empty cache
+ * Return:
+ *     Cache_t* - The new cache
+ */
+Cache_t *Cache_create(void);
+
+/**
+ * C style destructor for a cache and the records of its entries
+ * Parameters:
+ *     cache - Cache to destroy
+ */
+void Cache_destroy(Cache_t *cache);
+
+/**
+ * Read a cache file. A missing file gives an empty cache
+ * Parameters:
+ *     path  - Cache file to read
+ *     cache - Receives the loaded cache, or an empty one on failure
+ * Return:
+ *     true  - When the file was read or does not exist
+ *     false - When it exists but cannot be read or is not a valid cache
+ */
+bool Cache_load(const char *path, Cache_t **cache);
+
+/**
+ * Write a cache file, replacing the old one only once the new one is
+ * complete
+ * Parameters:
+ *     cache - Cache to write
+ *     path  - Cache file to write
+ * Return:
+ *     true  - On success
+ *     false - Otherwise (the old file is left in place)
+ */
+bool Cache_save(const Cache_t *cache, const char *path);
+
+/**
+ * Look up the entry of an input file
+ * Parameters:
+ *     cache - Cache to search
+ *     path  - Path of the input, as it was given to the run
+ * Return:
+ *     Cache_entry_t* - The entry, or NULL if the path is not cached
+ */
+Cache_entry_t *Cache_find(Cache_t *cache, const char *path);
+
+/**
+ * Add an entry, taking ownership of its records (records is emptied)
+ * Parameters:
+ *     cache    - Cache to extend
+ *     path     - Path of the input (copied)
+ *     size     - File size in bytes
+ *     mtime_ns - Modification time in nanoseconds
+ *     hash     - Content hash from Cache_hash_file, or 0 when not hashed
+ *     records  - Records of the input's partial results
+ */
+void Cache_add(Cache_t *cache, const char *path, uint64_t size, int64_t mtime_ns, uint64_t hash,
+               Cache_records_t *records);
+
+/**
+ * Append a record to a buffer
+ * Parameters:
+ *     records - Buffer to append to
+ *     key     - Key bytes
+ *     key_len - Length of the key
+ *     value   - Integer value
+ */
+void Cache_put_record(Cache_records_t *records, const char *key, size_t key_len, int64_t value);
+
+/**
+ * Decode the record at *offset and advance past it
+ * Parameters:
+ *     records - Buffer to read
+ *     offset  - Position of the record, updated to the next one
+ *     key     - Receives a pointer to the key bytes inside the buffer
+ *     key_len - Receives the length of the key
+ *     value   - Receives the value
+ * Return:
+ *     true    - When a record was decoded
+ *     false   - At the end of the buffer
+ */
+bool Cache_next_record(const Cache_records_t *records, size_t *offset, const char **key,
+                       size_t *key_len, int64_t *value);
+
+/**
+ * Hash the contents of a file
+ * Parameters:
+ *     path - File to hash
+ *     hash - Receives the 64-bit hash, never 0
+ * Return:
+ *     true  - On success
+ *     false - When the file cannot be read
+ */
+bool Cache_hash_file(const char *path, uint64_t *hash);
+
+#endif
@@ -3,36 +3,129 @@
 #include <stdlib.h>
 #include <string.h>
 #include "mapreduce.h"
+#include "tokenizer.h"
 
-void Map(char *file_name) {
-    FILE *fp = fopen(file_name, "r");
-    assert(fp != NULL);
+// Emits every token of the mapped split as a count of one
+static void EmitToken(const char *token, size_t len, void *arg) {
+    (void)arg;
+    MR_EmitIntSlice(token, len, 1);
+}
 
-    char *line = NULL;
-    size_t size = 0;
-    while (getline(&line, &size, fp) != -1) {
-        char *token, *dummy = line;
-        while ((token = strsep(&dummy, " \t\n\r")) != NULL) {
-            MR_Emit(token, "1");
-        }
-    }
-    free(line);
-    fclose(fp);
+void Map(MR_Split *split) {
+    MR_Input input;
+    bool opened = MR_OpenInput(split, &input);
+    assert(opened);
+
+    // Tokens are found a vector at a time and emitted as slices of the
+    // mapped file; nothing is copied here
+    Tokenizer_scan(input.data, input.length, EmitToken, NULL);
+    MR_CloseInput(&input);
 }
 
 void Reduce(char *key, unsigned int partition_idx) {
-    int count = 0;
-    char *value, name[100];
-    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
-        count++;
-        free(value);
+    int64_t count = 0, value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        count += value;
     }
-    sprintf(name, "result-%d.txt", partition_idx);
-    FILE *fp = fopen(name, "a");
-    fprintf(fp, "%s: %d\n", key, count);
-    fclose(fp);
+    MR_EmitOutput(partition_idx, key, count);
+}
+
+int64_t Combine(int64_t accumulated, int64_t value) {
+    return accumulated + value;
 }
 
 int main(int argc, char *argv[]) {
-    MR_Run(argc - 1, &(argv[1]), Map, Reduce, 5, 10);
+    MR_Options options = {0};
+    options.combiner = Combine;
+    options.schedule = TP_POLICY_LJF;
+    options.split_mapper = Map;
+    options.balance_reduce = true;
+
+    // Leading --flags configure the run; everything after them is an input
+    bool stats = false;
+    int arg = 1;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strcmp(argv[arg], "--split-size") == 0 && arg + 1 < argc) {
+            options.split_size = atol(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--work-stealing") == 0) {
+            options.pool_mode = TP_MODE_WORK_STEALING;
+            arg++;
+        } else if (strcmp(argv[arg], "--pipeline") == 0) {
+            options.pipeline = true;
+            arg++;
+        } else if (strcmp(argv[arg], "--output-dir") == 0 && arg + 1 < argc) {
+            options.output_dir = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--memory-budget") == 0 && arg + 1 < argc) {
+            options.memory_budget = strtoull(argv[arg + 1], NULL, 10);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--merge") == 0) {
+            options.merge_output = true;
+            arg++;
+        } else if (strcmp(argv[arg], "--top") == 0 && arg + 1 < argc) {
+            options.top_k = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--approximate") == 0 && arg + 1 < argc) {
+            options.heavy_hitters = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--sketch-error") == 0 && arg + 1 < argc) {
+            options.sketch_error = atof(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--emit-batch") == 0 && arg + 1 < argc) {
+            options.emit_batch = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--no-combine") == 0) {
+            options.combiner = NULL;
+            arg++;
+        } else if (strcmp(argv[arg], "--no-balance") == 0) {
+            options.balance_reduce = false;
+            arg++;
+        } else if (strcmp(argv[arg], "--cache") == 0 && arg + 1 < argc) {
+            options.cache_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--processes") == 0 && arg + 1 < argc) {
+            options.processes = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--io-threads") == 0 && arg + 1 < argc) {
+            options.io_threads = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--io-buffers") == 0 && arg + 1 < argc) {
+            options.io_buffers = (unsigned int)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--intern") == 0) {
+            options.intern_keys = true;
+            arg++;
+        } else if (strcmp(argv[arg], "--stats-json") == 0 && arg + 1 < argc) {
+            options.stats_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--stats") == 0) {
+            stats = true;
+            arg++;
+        } else {
+            fprintf(stderr,
+                    "Usage: %s [--split-size BYTES] [--work-stealing] [--pipeline] [--output-dir DIR] "
+                    "[--memory-budget BYTES] [--merge] [--top K] [--approximate K] [--sketch-error E] "
+                    "[--emit-batch N] [--no-combine] [--no-balance] [--stats] [--stats-json FILE] [--cache FILE] "
+                    "[--processes N] [--io-threads N] [--io-buffers N] [--intern] FILE...\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    options.results = MR_CreateResults();
+    MR_RunWithOptions(argc - arg, &(argv[arg]), NULL, Reduce, 5, 10, &options);
+    MR_WorkerStats worker_stats;
+    MR_GetWorkerStats(options.results, &worker_stats);
+    if (stats) {
+        MR_EmitStats emit_stats;
+        MR_GetEmitStats(options.results, &emit_stats);
+        fprintf(stderr, "emit flushes: %lu, lock acquisitions: %lu, lock waits: %lu\n",
+                emit_stats.flushes, emit_stats.lock_acquisitions, emit_stats.lock_waits);
+    }
+    MR_DestroyResults(options.results);
+    if (worker_stats.failed) {
+        fprintf(stderr, "%u map tasks were abandoned; the counts are incomplete\n", worker_stats.abandoned);
+        return 1;
+    }
 }
\ No newline at end of file
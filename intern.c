@@ -0,0 +1,308 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+
+// Keys are spread over 2^SHARD_BITS shards by the top bits of their hash
+#define SHARD_BITS 6
+#define SHARD_COUNT (1u << SHARD_BITS)
+
+// Slots of a shard's table before it first grows
+#define INITIAL_CAPACITY 16
+
+// Records are found by ID through chunks that double in size: chunk c
+// holds 2^(FIRST_CHUNK_BITS + c) IDs, so a small dictionary allocates one
+// small chunk and CHUNK_COUNT chunks cover the whole 32-bit ID space
+#define FIRST_CHUNK_BITS 10
+#define CHUNK_COUNT (32 - FIRST_CHUNK_BITS + 1)
+
+// Sizes of the blocks of key bytes: a shard's first block is small, and
+// each next one is twice the last up to the largest
+#define FIRST_KEY_BLOCK_SIZE 1024
+#define KEY_BLOCK_SIZE (64 * 1024)
+
+// Defines a key as the dictionary stores it: its hash, ID, length and tag
+// sit right before the bytes, so a lookup that reaches a record compares it
+// without touching another cache line
+typedef struct {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t len;
+    uint32_t tag;
+    char key[];
+} Record;
+
+// Defines an open-addressing table of a shard, whose slots point at
+// records (NULL when empty). A grown table keeps the one it replaced, since
+// readers that loaded the old pointer may still be probing it
+typedef struct Table {
+    unsigned int capacity;
+    struct Table *retired;
+    _Atomic(Record *) slots[];
+} Table;
+
+// Defines a block of records; keys are never freed individually
+typedef struct KeyBlock {
+    struct KeyBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} KeyBlock;
+
+// Defines a shard. Only threads adding a key take its lock; readers load
+// table and probe it without one
+typedef struct {
+    pthread_mutex_t lock;
+    _Atomic(Table *) table;
+    unsigned int count;
+    KeyBlock *keys;
+    size_t bytes;
+} Shard;
+
+struct Intern {
+    Shard shards[SHARD_COUNT];
+    _Atomic(Record **) chunks[CHUNK_COUNT];
+    atomic_ulong next_id;
+};
+
+// Spreads the caller's hash over all 64 bits; the top bits pick the shard
+// and the low bits the slot
+static uint64_t mix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static Table *new_table(unsigned int capacity) {
+    Table *table = calloc(1, sizeof(Table) + capacity * sizeof(Record *));
+    table->capacity = capacity;
+    return table;
+}
+
+// Finds the chunk of an ID and the ID's position in it
+static unsigned int chunk_of(uint32_t id, size_t *offset) {
+    uint64_t scaled = ((uint64_t)id >> FIRST_CHUNK_BITS) + 1;
+    unsigned int chunk = 63 - (unsigned int)__builtin_clzll(scaled);
+    *offset = id - (((1ULL << chunk) - 1) << FIRST_CHUNK_BITS);
+    return chunk;
+}
+
+// Returns the record of an ID that has been published
+static Record *record_of(const Intern_t *intern, uint32_t id) {
+    size_t offset;
+    unsigned int chunk = chunk_of(id, &offset);
+    Record **records = atomic_load_explicit(&intern->chunks[chunk], memory_order_acquire);
+    return records[offset];
+}
+
+// Returns where the record of a new ID goes, allocating its chunk on first
+// use. Shards add keys concurrently, so the chunk is installed with a CAS
+static Record **claim_entry(Intern_t *intern, uint32_t id) {
+    size_t offset;
+    unsigned int chunk = chunk_of(id, &offset);
+    _Atomic(Record **) *slot = &intern->chunks[chunk];
+    Record **records = atomic_load_explicit(slot, memory_order_acquire);
+    if (!records) {
+        Record **fresh = calloc((size_t)1 << (FIRST_CHUNK_BITS + chunk), sizeof(Record *));
+        if (atomic_compare_exchange_strong_explicit(slot, &records, fresh, memory_order_acq_rel,
+                                                    memory_order_acquire)) {
+            records = fresh;
+        } else {
+            free(fresh);
+        }
+    }
+    return &records[offset];
+}
+
+// Looks a key up in a table. Returns its record, or NULL with the empty
+// slot where it would go in *slot_out
+static const Record *probe(Table *table, uint64_t mixed, const char *key, size_t len, uint64_t hash,
+                           unsigned int *slot_out) {
+    unsigned int mask = table->capacity - 1;
+    unsigned int slot = (unsigned int)(mixed & mask);
+    const Record *record;
+    while ((record = atomic_load_explicit(&table->slots[slot], memory_order_acquire)) != NULL) {
+        if (record->hash == hash && record->len == len && memcmp(record->key, key, len) == 0) {
+            return record;
+        }
+        slot = (slot + 1) & mask;
+    }
+    *slot_out = slot;
+    return NULL;
+}
+
+// Copies a key into its shard's blocks as a record whose key is
+// NUL-terminated. Records are kept 8-byte aligned
+static Record *new_record(Shard *shard, const char *key, size_t len, uint64_t hash, uint32_t id) {
+    size_t need = (sizeof(Record) + len + 1 + 7) & ~(size_t)7;
+    KeyBlock *block = shard->keys;
+    if (!block || block->size - block->used < need) {
+        size_t size = block ? block->size * 2 : FIRST_KEY_BLOCK_SIZE;
+        if (size > KEY_BLOCK_SIZE) {
+            size = KEY_BLOCK_SIZE;
+        }
+        if (size < need) {
+            size = need;
+        }
+        block = malloc(sizeof(KeyBlock) + size);
+        block->size = size;
+        block->used = 0;
+        block->next = shard->keys;
+        shard->keys = block;
+        shard->bytes += size;
+    }
+    Record *record = (Record *)(block->data + block->used);
+    record->hash = hash;
+    record->id = id;
+    record->len = (uint32_t)len;
+    record->tag = 0;
+    memcpy(record->key, key, len);
+    record->key[len] = '\0';
+    block->used += need;
+    return record;
+}
+
+// Doubles a shard's table and publishes the new one. Called with the
+// shard's lock held
+static void grow(Shard *shard) {
+    Table *old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    Table *table = new_table(old->capacity * 2);
+    unsigned int mask = table->capacity - 1;
+    for (unsigned int i = 0; i < old->capacity; i++) {
+        Record *record = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+        if (!record) {
+            continue;
+        }
+        unsigned int slot = (unsigned int)(mix(record->hash) & mask);
+        while (atomic_load_explicit(&table->slots[slot], memory_order_relaxed) != NULL) {
+            slot = (slot + 1) & mask;
+        }
+        atomic_store_explicit(&table->slots[slot], record, memory_order_relaxed);
+    }
+    table->retired = old;
+    shard->bytes += table->capacity * sizeof(Record *);
+    atomic_store_explicit(&shard->table, table, memory_order_release);
+}
+
+// Create an empty dictionary
+Intern_t *Intern_create(void) {
+    Intern_t *intern = calloc(1, sizeof(Intern_t));
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        pthread_mutex_init(&intern->shards[i].lock, NULL);
+        atomic_init(&intern->shards[i].table, new_table(INITIAL_CAPACITY));
+        intern->shards[i].bytes = INITIAL_CAPACITY * sizeof(Record *);
+    }
+    atomic_init(&intern->next_id, 0);
+    return intern;
+}
+
+// Destroy a dictionary and its keys
+void Intern_destroy(Intern_t *intern) {
+    if (!intern) {
+        return;
+    }
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        Shard *shard = &intern->shards[i];
+        Table *table = atomic_load(&shard->table);
+        while (table) {
+            Table *retired = table->retired;
+            free(table);
+            table = retired;
+        }
+        while (shard->keys) {
+            KeyBlock *next = shard->keys->next;
+            free(shard->keys);
+            shard->keys = next;
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    for (unsigned int i = 0; i < CHUNK_COUNT; i++) {
+        free(atomic_load(&intern->chunks[i]));
+    }
+    free(intern);
+}
+
+// Get a key's ID, adding the key if needed
+uint32_t Intern_id(Intern_t *intern, const char *key, size_t len, uint64_t hash, const char **interned) {
+    uint64_t mixed = mix(hash);
+    Shard *shard = &intern->shards[mixed >> (64 - SHARD_BITS)];
+    unsigned int slot;
+    const Record *found = probe(atomic_load_explicit(&shard->table, memory_order_acquire), mixed, key, len, hash, &slot);
+    if (found) {
+        if (interned) {
+            *interned = found->key;
+        }
+        return found->id;
+    }
+
+    // Another thread may have added the key, or grown the table, before the
+    // lock was taken, so probe again under it
+    pthread_mutex_lock(&shard->lock);
+    Table *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    Record *record = (Record *)probe(table, mixed, key, len, hash, &slot);
+    if (!record) {
+        uint64_t next = atomic_fetch_add_explicit(&intern->next_id, 1, memory_order_relaxed);
+        if (next >= INTERN_NONE) {
+            fprintf(stderr, "[Intern_id] More than %u distinct keys\n", INTERN_NONE - 1);
+            abort();
+        }
+        record = new_record(shard, key, len, hash, (uint32_t)next);
+        *claim_entry(intern, record->id) = record;
+
+        // Publishing the slot makes the record visible to readers
+        atomic_store_explicit(&table->slots[slot], record, memory_order_release);
+        if (++shard->count * 2 > table->capacity) {
+            grow(shard);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (interned) {
+        *interned = record->key;
+    }
+    return record->id;
+}
+
+// Get a key's ID without adding it
+uint32_t Intern_find(const Intern_t *intern, const char *key, size_t len, uint64_t hash) {
+    uint64_t mixed = mix(hash);
+    const Shard *shard = &intern->shards[mixed >> (64 - SHARD_BITS)];
+    unsigned int slot;
+    const Record *record = probe(atomic_load_explicit(&shard->table, memory_order_acquire), mixed, key, len, hash, &slot);
+    return record ? record->id : INTERN_NONE;
+}
+
+// Resolve an ID to its key
+const char *Intern_key(const Intern_t *intern, uint32_t id, size_t *len) {
+    const Record *record = record_of(intern, id);
+    *len = record->len;
+    return record->key;
+}
+
+// Get the caller's tag of an interned key, which sits in its record
+uint32_t *Intern_tag(const char *key) {
+    return &((Record *)(key - offsetof(Record, key)))->tag;
+}
+
+// Get the number of keys
+uint32_t Intern_count(const Intern_t *intern) {
+    return (uint32_t)atomic_load_explicit(&intern->next_id, memory_order_relaxed);
+}
+
+// Get the memory held by the dictionary, counting whole ID chunks
+size_t Intern_bytes(const Intern_t *intern) {
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < SHARD_COUNT; i++) {
+        bytes += intern->shards[i].bytes;
+    }
+    for (unsigned int i = 0; i < CHUNK_COUNT; i++) {
+        if (atomic_load_explicit(&intern->chunks[i], memory_order_relaxed)) {
+            bytes += ((size_t)1 << (FIRST_CHUNK_BITS + i)) * sizeof(Record *);
+        }
+    }
+    return bytes;
+}
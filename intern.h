@@ -0,0 +1,103 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returned by Intern_find for a key that was never added
+#define INTERN_NONE UINT32_MAX
+
+// Concurrent dictionary giving every distinct key a dense 32-bit ID, in the
+// order keys were first seen. Keys are split over shards by hash; looking
+// up a known key takes no lock, and adding one locks only its shard. Each
+// ID also carries a tag the caller may use to find its own data for the key
+typedef struct Intern Intern_t;
+
+/**
+ * C style constructor for an empty dictionary
+ * Return:
+ *     Intern_t* - The new dictionary
+ */
+Intern_t *Intern_create(void);
+
+/**
+ * C style destructor for a dictionary. Keys returned by Intern_key are
+ * freed with it
+ * Parameters:
+ *     intern - Dictionary to destroy
+ */
+void Intern_destroy(Intern_t *intern);
+
+/**
+ * Get the ID of a key, adding the key if it is new. Safe to call from any
+ * number of threads at once. A dictionary holds at most UINT32_MAX - 1
+ * keys; adding one more aborts
+ * Parameters:
+ *     intern   - Dictionary
+ *     key      - Key bytes (need not be NUL-terminated; copied if new)
+ *     len      - Length of the key
+ *     hash     - Hash of the key. Equal keys must always be given the
+ *                same hash
+ *     interned - Receives the dictionary's copy of the key, as Intern_key
+ *                would return it (may be NULL)
+ * Return:
+ *     uint32_t - The key's ID
+ */
+uint32_t Intern_id(Intern_t *intern, const char *key, size_t len, uint64_t hash, const char **interned);
+
+/**
+ * Get the ID of a key without adding it
+ * Parameters:
+ *     intern - Dictionary
+ *     key    - Key bytes (need not be NUL-terminated)
+ *     len    - Length of the key
+ *     hash   - Hash the key was added with
+ * Return:
+ *     uint32_t - The key's ID, or INTERN_NONE if it was never added
+ */
+uint32_t Intern_find(const Intern_t *intern, const char *key, size_t len, uint64_t hash);
+
+/**
+ * Resolve an ID to its key
+ * Parameters:
+ *     intern - Dictionary
+ *     id     - ID returned by Intern_id
+ *     len    - Receives the length of the key
+ * Return:
+ *     const char* - The NUL-terminated key, valid until the dictionary is
+ *                   destroyed. Equal keys resolve to the same pointer
+ */
+const char *Intern_key(const Intern_t *intern, uint32_t id, size_t *len);
+
+/**
+ * Get the caller's tag of a key, zero until the caller sets it. The tag
+ * sits next to the key, so this takes no lookup. The dictionary never
+ * reads or writes it; the caller must make sure only one thread at a time
+ * uses the tag of a given key
+ * Parameters:
+ *     key - The dictionary's copy of a key, from Intern_key or Intern_id
+ * Return:
+ *     uint32_t* - The tag
+ */
+uint32_t *Intern_tag(const char *key);
+
+/**
+ * Get the number of distinct keys added so far
+ * Parameters:
+ *     intern - Dictionary
+ * Return:
+ *     uint32_t - Number of keys
+ */
+uint32_t Intern_count(const Intern_t *intern);
+
+/**
+ * Get the memory held by the keys, the ID index and the shard tables.
+ * Only exact when no key is being added
+ * Parameters:
+ *     intern - Dictionary
+ * Return:
+ *     size_t - Bytes
+ */
+size_t Intern_bytes(const Intern_t *intern);
+
+#endif
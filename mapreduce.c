@@ -1,192 +1,4310 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include "mapreduce.h"
 #include "threadpool.h"
+#include "cache.h"
+#include "intern.h"
+#include "remote.h"
+#include "sketch.h"
+#include "stats.h"
 
-// Defines a structure for a key-value pair in each partition
+// Size of a regular arena block; larger requests get a block of their own
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+// Defines a block of bump-allocated memory
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+// Defines an arena: allocations are carved out of blocks and only released
+// all at once, so nothing in it is freed individually
+typedef struct {
+    ArenaBlock *head;
+    size_t bytes_used;
+} Arena;
+
+// Allocates size bytes (8-byte aligned) from an arena
+static void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaBlock *block = arena->head;
+    if (!block || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->bytes_used += size;
+    return ptr;
+}
+
+// Copies len bytes of a string into an arena as a NUL-terminated string
+static char *arena_strndup(Arena *arena, const char *str, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+// Copies a string into an arena
+static char *arena_strdup(Arena *arena, const char *str) {
+    return arena_strndup(arena, str, strlen(str));
+}
+
+// Releases every block of an arena except one regular block, which is kept
+// for the next round of allocations
+static void arena_reset(Arena *arena) {
+    ArenaBlock *keep = NULL;
+    ArenaBlock *block = arena->head;
+    while (block) {
+        ArenaBlock *next = block->next;
+        if (!keep && block->size == ARENA_BLOCK_SIZE) {
+            keep = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+    if (keep) {
+        keep->used = 0;
+        keep->next = NULL;
+    }
+    arena->head = keep;
+    arena->bytes_used = 0;
+}
+
+// Releases all memory of an arena
+static void arena_release(Arena *arena) {
+    while (arena->head) {
+        ArenaBlock *next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->bytes_used = 0;
+}
+
+// Defines a structure for a key-value pair in each partition. id is the
+// key's ID when the job interns keys, and key then points at the
+// dictionary's copy
 typedef struct {
     char *key;
+    unsigned int key_len;
+    uint32_t id;
+    unsigned long hash;
     char **values;
     unsigned int value_count;
     unsigned int value_capacity;
+    int64_t *int_values;
+    unsigned int int_count;
+    unsigned int int_capacity;
 } KeyValuePair;
 
-// Defines a structure for a partition, which holds multiple key-value pairs
+// Defines a sorted run of key-value pairs produced by one map task, by a
+// spill, or by merging earlier runs. An in-memory run owns the arena holding
+// its keys and values; a spilled run keeps them in an unlinked file instead
+typedef struct {
+    KeyValuePair *pairs;
+    unsigned int count;
+    unsigned int capacity;
+    unsigned long size;
+    Arena arena;
+    FILE *file;
+} Run;
+
+// Defines a structure for a partition, which holds multiple key-value pairs.
+// The pairs live in a dense array; index is an open-addressing hash table of
+// (position + 1) into that array, with 0 marking an empty slot. Keys and
+// value arrays are allocated from the partition's arena. When the job
+// interns keys, pairs are found by ID instead: each key's tag in the
+// dictionary holds its pair's position + 1, and the index stays empty
 typedef struct {
     KeyValuePair *pairs;
     unsigned int pair_count;
     unsigned int capacity;
+    unsigned int *index;
+    unsigned int index_capacity;
+    Intern_t *dictionary;
+    KeyValuePair *current;
+    unsigned long value_total;
+    Arena arena;
+    Run **runs;
+    unsigned int run_count;
+    unsigned int run_capacity;
+    size_t run_bytes;
+    bool merging;
     pthread_mutex_t lock;
 } Partition;
 
-// Global variables for the MapReduce framework
-static Partition *partitions;
-static unsigned int num_partitions;
-static Mapper user_mapper;
-static Reducer user_reducer;
-static ThreadPool_t *thread_pool;
+// Defines the buffered writer for one partition's output file. Only the
+// partition's reduce task writes to it, so it needs no lock
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t used;
+} OutputWriter;
+
+// Defines an entry of a partition's top-K heap
+typedef struct {
+    char *key;
+    int64_t value;
+} TopEntry;
 
-// Inserts a key-value pair into a specified partition
-void insert_into_partition(unsigned int partition_idx, char *key, char *value) {
-    Partition *partition = &partitions[partition_idx];
-    pthread_mutex_lock(&partition->lock);
+// Defines a partition's bounded heap for top-K output
+typedef struct {
+    TopEntry *entries;
+    unsigned int count;
+} TopHeap;
 
-    // Check if the key already exists in the partition
+// Defines the map output captured from one input for the result cache.
+// Split tasks of the same file append to it concurrently, hence the lock.
+// Only integer values are cached, so a string emit makes it uncacheable
+typedef struct {
+    Cache_records_t records;
+    bool uncacheable;
+    pthread_mutex_t lock;
+} InputCapture;
+
+// Defines what the result cache knows about one input of a run: its
+// identity when the run started and, if unchanged, its cache entry. stale
+// marks an input whose entry no longer matches it
+typedef struct {
+    bool found;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint64_t hash;
+    Cache_entry_t *entry;
+    bool stale;
+} CachedInput;
+
+#ifdef MR_ENABLE_STATS
+// Defines the instrumentation of one job. Lock times are only updated
+// while holding the partition's lock. Emits are counted per worker slot and
+// partition (emits[slot * num_partitions + p], the last slot for threads
+// outside the pool) so workers do not share counters. task_ns and tasks
+// charge each pool worker for the tasks of this job it ran
+typedef struct {
+    uint64_t *lock_hold_ns;
+    uint64_t *lock_wait_ns;
+    atomic_ulong *emits;
+    unsigned int slots;
+    atomic_ullong *task_ns;
+    atomic_ulong *tasks;
+    atomic_ulong *keys;
+    atomic_ulong *input_bytes;
+    char **input_names;
+    unsigned int input_count;
+    uint64_t started_ns;
+    ThreadPool_stats_t pool_before;
+} JobStats;
+#endif
+
+// Defines one run of MapReduce: its partitions, user functions and
+// settings. Several jobs can share a context's pool at the same time, so
+// nothing about a run lives in file-scope state. pending counts the tasks
+// of this job that the pool has not finished yet
+typedef struct {
+    MR_Context *context;
+    Partition *partitions;
+    unsigned int num_partitions;
+    Mapper mapper;
+    SplitMapper split_mapper;
+    Reducer reducer;
+    Combiner combiner;
+    unsigned int combine_limit;
+    bool pipeline;
+    unsigned int parallel_sort_threshold;
+    size_t memory_budget;
+    const char *spill_dir;
+    OutputWriter *writers;
+    const char *output_dir;
+    bool merge_output;
+    unsigned int top_k;
+    TopHeap *tops;
+    unsigned int heavy_hitters;
+    double sketch_error;
+    Sketch_t **sketches;
+    pthread_mutex_t sketch_lock;
+    unsigned int emit_batch;
+    bool balance_reduce;
+    Intern_t *dictionary;
+    unsigned int *range_counts;
+    InputCapture *captures;
+    atomic_ulong flushes;
+    atomic_ulong lock_acquisitions;
+    atomic_ulong lock_waits;
+    size_t *arena_usage;
+#ifdef MR_ENABLE_STATS
+    JobStats stats;
+#endif
+    unsigned long pending;
+    pthread_mutex_t pending_lock;
+    pthread_cond_t pending_done;
+} MR_Job;
+
+// Defines a unit of work submitted to the pool on behalf of a job.
+// input_idx is the file a map task reads from
+typedef struct {
+    MR_Job *job;
+    void *input;
+    unsigned int partition_idx;
+    unsigned int input_idx;
+} Task;
+
+// Defines a reusable buffer of the I/O stage. A reader thread fills it with
+// the bytes of one split and submits task to map them; the map task hands
+// the buffer back when it ends
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t length;
+    Task task;
+    struct Prefetch *prefetch;
+} PrefetchBuffer;
+
+// Defines the I/O stage of a map phase. Reader threads take the split tasks
+// in schedule order, each first waiting for a free buffer, so at most
+// buffer_count splits are read ahead of the mappers
+typedef struct Prefetch {
+    MR_Job *job;
+    Task *tasks;
+    unsigned int *order;
+    unsigned int count;
+    unsigned int next;
+    PrefetchBuffer *buffers;
+    unsigned int buffer_count;
+    unsigned int *free_buffers;
+    unsigned int free_count;
+    pthread_mutex_t lock;
+    pthread_cond_t buffer_free;
+    atomic_ulong bytes_read;
+    atomic_ulong read_ns;
+    atomic_ulong wait_ns;
+} Prefetch;
+
+// Defines one key range of a partition whose reduce work was split across
+// several tasks: pairs [begin, end) of the sorted partition. Each range
+// writes its own output file and top-K heap, which the last range to
+// finish appends to the partition's
+typedef struct {
+    MR_Job *job;
+    unsigned int partition_idx;
+    unsigned int range_idx;
+    unsigned int begin;
+    unsigned int end;
+    KeyValuePair *pair;
+    OutputWriter writer;
+    bool opened;
+    TopHeap top;
+    struct SplitReduce *split;
+} ReduceRange;
+
+// Defines the ranges of a split partition; remaining counts the ranges
+// still being reduced
+typedef struct SplitReduce {
+    unsigned int range_count;
+    atomic_uint remaining;
+    ReduceRange ranges[];
+} SplitReduce;
+
+// Defines a set of partitions kept by a context for reuse by later runs
+typedef struct PartitionSet {
+    Partition *parts;
+    unsigned int count;
+    struct PartitionSet *next;
+} PartitionSet;
+
+// Defines a context: a long-lived pool plus the partition sets recycled
+// between the jobs run on it, and the worker processes forked before the
+// pool started (NULL without them). One job at a time holds workers_lock
+// while it maps on the workers
+struct MR_Context {
+    ThreadPool_t *pool;
+    PartitionSet *spares;
+    unsigned int spare_count;
+    pthread_mutex_t lock;
+    Remote_group_t *workers;
+    pthread_mutex_t workers_lock;
+};
+
+// Defines the statistics of one finished run: arena usage and key ranges of
+// each partition and the run's counters. The instrumentation (MR_ENABLE_STATS
+// builds only) adds per-partition counters, bytes read per input, and the
+// pool's worker times and queue depth over the run, relative to its start;
+// partition_stats is NULL without it
+struct MR_Results {
+    unsigned int num_partitions;
+    size_t *arena_usage;
+    unsigned int *range_counts;
+    MR_EmitStats emit_stats;
+    MR_PhaseTimes phase_times;
+    MR_CacheStats cache_stats;
+    MR_WorkerStats worker_stats;
+    MR_IOStats io_stats;
+    MR_InternStats intern_stats;
+    MR_PartitionStats *partition_stats;
+    unsigned long *input_bytes;
+    char **input_names;
+    unsigned int input_count;
+    ThreadPool_stats_t pool_stats;
+    uint64_t started_ns;
+};
+
+// Partition sets a context keeps for reuse
+#define MAX_SPARE_SETS 4
+
+// The job whose task the calling worker is running, for MR_Emit and friends
+static __thread MR_Job *current_job = NULL;
+
+// The key range the calling worker is reducing, when its partition was split
+static __thread ReduceRange *current_range = NULL;
+
+// The input file of the map task the calling worker is running
+static __thread unsigned int current_input = 0;
+
+// Where the calling worker's map output is captured for the result cache
+static __thread InputCapture *current_capture = NULL;
+
+// The bytes the I/O stage read for the split the calling worker is mapping
+static __thread PrefetchBuffer *current_prefetch = NULL;
+
+// Bytes an output writer buffers before writing them to its file
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// Distinct keys a worker buffers before flushing when no limit is given
+#define DEFAULT_COMBINE_LIMIT 65536
+
+// Bytes per input split when no split size is given
+#define DEFAULT_SPLIT_SIZE (64L * 1024 * 1024)
+
+// Keys a partition needs before idle workers help sort it, when no
+// threshold is given
+#define DEFAULT_PARALLEL_SORT_THRESHOLD 65536
+
+// Ranges this small are finished with insertion sort
+#define SORT_INSERTION_THRESHOLD 16
+
+// Number of similarly sized runs merged together while the map phase runs
+#define MERGE_FANIN 4
+
+// stdio buffer size of a spill file
+#define SPILL_BUFFER_SIZE (64 * 1024)
+
+// Keys each worker's Space-Saving table tracks per requested heavy hitter,
+// so keys near the cut-off survive in some table until the merge
+#define SKETCH_SLACK 4
+
+// Emits a worker stages per partition before flushing, when no batch size
+// is given
+#define DEFAULT_EMIT_BATCH 1024
+
+// A partition is split for reduce once it holds this many times the mean
+// work (keys plus values) of a partition
+#define SKEW_FACTOR 2
+
+// Smallest Space-Saving table per worker. Keys in the table skip the
+// Count-Min rows, so a larger table is faster on skewed input
+#define SKETCH_MIN_CAPACITY 1024
+
+// Worker processes a map task may take down before it is given up on
+#define MAX_TASK_ATTEMPTS 3
+
+// Defines the set of worker-local partitions used in pipelined mode, where
+// map tasks emit into them and publish them as sorted runs when they end
+typedef struct {
+    Partition *parts;
+    unsigned int count;
+} LocalStore;
+
+static pthread_key_t local_store_key;
+static pthread_once_t local_store_once = PTHREAD_ONCE_INIT;
+
+// Defines an entry of a worker's map-side combine table. When the job
+// interns keys, key is the dictionary's copy and id its ID
+typedef struct {
+    char *key;
+    unsigned int key_len;
+    uint32_t id;
+    unsigned long hash;
+    int64_t value;
+} CombineEntry;
+
+// Defines a worker-local open-addressing table of partially combined
+// <key, value> pairs; a NULL key marks an empty slot
+typedef struct {
+    CombineEntry *entries;
+    unsigned int count;
+    unsigned int capacity;
+    Arena keys;
+} CombineTable;
+
+// Each worker thread pre-aggregates its own emits without any locking; the
+// key's destructor frees a worker's table when the thread exits
+static pthread_key_t combine_key;
+static pthread_once_t combine_key_once = PTHREAD_ONCE_INIT;
+
+// Defines a value a worker has staged but not flushed yet. value_offset
+// locates a string value in the buffer's bytes, or is -1 for an integer;
+// next is the index + 1 of the key's next staged value, 0 at the end
+typedef struct {
+    long value_offset;
+    int64_t int_value;
+    unsigned int next;
+} StagedValue;
+
+// Defines a distinct key of a staging buffer and the chain of its values,
+// oldest first, as indexes + 1 into the buffer's values
+typedef struct {
+    size_t key_offset;
+    unsigned int key_len;
+    unsigned long hash;
+    unsigned int first;
+    unsigned int last;
+} StagedKey;
+
+// Defines a worker's staging buffer for one partition. Emits of the same
+// key are merged into one StagedKey as they arrive, through an
+// open-addressing table of key indexes + 1 (slots). Keys and values are
+// copied into bytes, since mappers may emit slices of input they unmap
+// before the map task ends
+typedef struct {
+    StagedValue *values;
+    unsigned int count;
+    StagedKey *keys;
+    unsigned int key_count;
+    unsigned int *slots;
+    unsigned int slot_capacity;
+    char *bytes;
+    size_t used;
+    size_t size;
+} StageBuffer;
+
+// Defines a worker's staging buffers, one per partition, each holding up to
+// batch emits
+typedef struct {
+    StageBuffer *buffers;
+    unsigned int count;
+    unsigned int batch;
+} EmitStage;
+
+static pthread_key_t stage_key;
+static pthread_once_t stage_once = PTHREAD_ONCE_INIT;
+
+// djb2 hash shared by the partitioner and the partition index
+static unsigned long hash_key(const char *key, size_t len) {
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < len; i++) {
+        hash = hash * 33 + key[i];
+    }
+    return hash;
+}
+
+// Mixes the key hash so that the index does not reuse the bits that already
+// chose the partition
+static unsigned int index_slot(unsigned long hash, unsigned int index_capacity) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdUL;
+    hash ^= hash >> 33;
+    return (unsigned int)(hash & (index_capacity - 1));
+}
+
+// (Re)builds the hash index of a partition over its current pairs array
+static void rebuild_index(Partition *partition, unsigned int index_capacity) {
+    free(partition->index);
+    partition->index = calloc(index_capacity, sizeof(unsigned int));
+    partition->index_capacity = index_capacity;
     for (unsigned int i = 0; i < partition->pair_count; i++) {
-        if (strcmp(partition->pairs[i].key, key) == 0) {
-            // If key exists and value array is full, increase capacity
-            if (partition->pairs[i].value_count == partition->pairs[i].value_capacity) {
-                partition->pairs[i].value_capacity *= 2;
-                partition->pairs[i].values = realloc(partition->pairs[i].values, partition->pairs[i].value_capacity * sizeof(char *));
-            }
-            // Add the new value to the key's value list
-            partition->pairs[i].values[partition->pairs[i].value_count++] = strdup(value);
-            pthread_mutex_unlock(&partition->lock);
-            return;
+        unsigned int slot = index_slot(partition->pairs[i].hash, index_capacity);
+        while (partition->index[slot] != 0) {
+            slot = (slot + 1) & (index_capacity - 1);
         }
+        partition->index[slot] = i + 1;
     }
+}
 
-    // Key does not exist; create a new key-value pair
+// Finds the index slot holding key, or the empty slot where it would go
+static unsigned int find_slot(Partition *partition, const char *key, size_t len, unsigned long hash) {
+    unsigned int mask = partition->index_capacity - 1;
+    unsigned int slot = index_slot(hash, partition->index_capacity);
+    while (partition->index[slot] != 0) {
+        KeyValuePair *pair = &partition->pairs[partition->index[slot] - 1];
+        if (pair->hash == hash && pair->key_len == len && memcmp(pair->key, key, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Appends a pair without values to a locked partition; the caller sets
+// its key
+static KeyValuePair *new_pair(Partition *partition) {
     if (partition->pair_count == partition->capacity) {
         // If the partition is full, increase capacity
         partition->capacity *= 2;
         partition->pairs = realloc(partition->pairs, partition->capacity * sizeof(KeyValuePair));
     }
 
-    // Initialize the new key-value pair
-    partition->pairs[partition->pair_count].key = strdup(key);
-    partition->pairs[partition->pair_count].values = malloc(10 * sizeof(char *));
-    partition->pairs[partition->pair_count].values[0] = strdup(value);
-    partition->pairs[partition->pair_count].value_count = 1;
-    partition->pairs[partition->pair_count].value_capacity = 10;
-    partition->pair_count++;
+    // Value arrays are allocated on first use
+    KeyValuePair *pair = &partition->pairs[partition->pair_count++];
+    pair->values = NULL;
+    pair->value_count = 0;
+    pair->value_capacity = 0;
+    pair->int_values = NULL;
+    pair->int_count = 0;
+    pair->int_capacity = 0;
+    return pair;
+}
 
-    pthread_mutex_unlock(&partition->lock);
+// Returns the pair of an interned key in a locked partition, creating it
+// if needed. key is the dictionary's copy, whose tag is only used under
+// the lock of the partition the key belongs to
+static KeyValuePair *find_or_insert_id(Partition *partition, const char *key, size_t len,
+                                       unsigned long hash, uint32_t id) {
+    uint32_t *tag = Intern_tag(key);
+    if (*tag != 0) {
+        return &partition->pairs[*tag - 1];
+    }
+    KeyValuePair *pair = new_pair(partition);
+    pair->key = (char *)key;
+    pair->key_len = (unsigned int)len;
+    pair->id = id;
+    pair->hash = hash;
+    *tag = partition->pair_count;
+    return pair;
 }
 
-// Hash function to determine which partition a key should be placed in
-unsigned int MR_Partitioner(char *key, unsigned int num_partitions) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *key++)) {
-        hash = hash * 33 + c;
+// Returns the pair for key in a locked partition, creating it if needed.
+// The key need not be NUL-terminated; the partition keeps its own copy
+// unless the dictionary has one
+static KeyValuePair *find_or_insert_pair(Partition *partition, const char *key, size_t len,
+                                         unsigned long hash) {
+    if (partition->dictionary) {
+        const char *interned;
+        uint32_t id = Intern_id(partition->dictionary, key, len, hash, &interned);
+        return find_or_insert_id(partition, interned, len, hash, id);
+    }
+
+    // Check if the key already exists in the partition
+    unsigned int slot = find_slot(partition, key, len, hash);
+    if (partition->index[slot] != 0) {
+        return &partition->pairs[partition->index[slot] - 1];
+    }
+
+    // Key does not exist; create a new key-value pair
+    KeyValuePair *pair = new_pair(partition);
+    pair->key = arena_strndup(&partition->arena, key, len);
+    pair->key_len = (unsigned int)len;
+    pair->hash = hash;
+    pair->id = INTERN_NONE;
+    partition->index[slot] = partition->pair_count;
+
+    // Keep the index at most half full so probe sequences stay short
+    if (partition->pair_count * 2 > partition->index_capacity) {
+        rebuild_index(partition, partition->index_capacity * 2);
     }
-    return hash % num_partitions;
+    return &partition->pairs[partition->pair_count - 1];
 }
 
-// Emit function called by the Mapper to add a key-value pair to a partition
-void MR_Emit(char *key, char *value) {
-    if (key == NULL || strlen(key) == 0) {
-        // printf("[MR_Emit] Skipping empty key.\n");
+// Grows a value array inside an arena. The old array stays in the arena
+// until the partition is released, which at most doubles the space used
+static void *arena_grow(Arena *arena, void *array, unsigned int count,
+                        unsigned int *capacity, unsigned int initial, size_t elem_size) {
+    unsigned int new_capacity = *capacity ? *capacity * 2 : initial;
+    void *grown = arena_alloc(arena, new_capacity * elem_size);
+    if (count > 0) {
+        memcpy(grown, array, count * elem_size);
+    }
+    *capacity = new_capacity;
+    return grown;
+}
+
+// Spilling, defined with the run code below
+static Run *detach_if_over_budget(MR_Job *job, Partition *partition);
+static void spill_detached(MR_Job *job, unsigned int p, Run *run);
+
+// Appends a string value to a pair of a locked partition
+static void append_string_value(Partition *partition, KeyValuePair *pair, const char *value) {
+    // If the value array is full, increase capacity
+    if (pair->value_count == pair->value_capacity) {
+        pair->values = arena_grow(&partition->arena, pair->values, pair->value_count,
+                                  &pair->value_capacity, 10, sizeof(char *));
+    }
+    // Add the new value to the key's value list
+    pair->values[pair->value_count++] = arena_strdup(&partition->arena, value);
+    partition->value_total++;
+}
+
+// Appends a string value to the pair for key in a locked partition
+static void insert_string_locked(Partition *partition, const char *key, size_t len,
+                                 unsigned long hash, char *value) {
+    append_string_value(partition, find_or_insert_pair(partition, key, len, hash), value);
+}
+
+// Takes a partition's lock during the map phase, counting how often
+// another thread already held it. Returns when the lock was taken, which
+// unlock_partition needs (always 0 without MR_ENABLE_STATS)
+static uint64_t lock_partition(MR_Job *job, Partition *partition) {
+    if (pthread_mutex_trylock(&partition->lock) != 0) {
+        atomic_fetch_add_explicit(&job->lock_waits, 1, memory_order_relaxed);
+#ifdef MR_ENABLE_STATS
+        uint64_t start = stats_now_ns();
+        pthread_mutex_lock(&partition->lock);
+        job->stats.lock_wait_ns[partition - job->partitions] += stats_now_ns() - start;
+#else
+        pthread_mutex_lock(&partition->lock);
+#endif
+    }
+    atomic_fetch_add_explicit(&job->lock_acquisitions, 1, memory_order_relaxed);
+#ifdef MR_ENABLE_STATS
+    return stats_now_ns();
+#else
+    return 0;
+#endif
+}
+
+// Releases a partition lock taken with lock_partition at locked_at
+static void unlock_partition(MR_Job *job, Partition *partition, uint64_t locked_at) {
+#ifdef MR_ENABLE_STATS
+    job->stats.lock_hold_ns[partition - job->partitions] += stats_now_ns() - locked_at;
+#else
+    (void)job;
+    (void)locked_at;
+#endif
+    pthread_mutex_unlock(&partition->lock);
+}
+
+// Inserts a key-value pair into a specified partition
+void insert_into_partition(MR_Job *job, unsigned int partition_idx, char *key, char *value) {
+    Partition *partition = &job->partitions[partition_idx];
+    size_t len = strlen(key);
+    unsigned long hash = hash_key(key, len);
+    uint64_t locked_at = lock_partition(job, partition);
+    insert_string_locked(partition, key, len, hash, value);
+    Run *spilled = detach_if_over_budget(job, partition);
+    unlock_partition(job, partition, locked_at);
+    spill_detached(job, partition_idx, spilled);
+}
+
+// Appends an integer value to a pair of a locked partition. With a
+// combiner the pair keeps a single running value instead of a list
+static void append_int_value(Partition *partition, KeyValuePair *pair, int64_t value,
+                             Combiner combiner) {
+    if (combiner && pair->int_count > 0) {
+        pair->int_values[0] = combiner(pair->int_values[0], value);
         return;
     }
-    // Determine the partition index for the key
-    unsigned int partition_idx = MR_Partitioner(key, num_partitions);
-    // printf("[MR_Emit] Key: %s, Value: %s, Partition: %u\n", key, value, partition_idx);
-    insert_into_partition(partition_idx, key, value);
+    if (pair->int_count == pair->int_capacity) {
+        pair->int_values = arena_grow(&partition->arena, pair->int_values, pair->int_count,
+                                      &pair->int_capacity, 4, sizeof(int64_t));
+    }
+    pair->int_values[pair->int_count++] = value;
+    partition->value_total++;
 }
 
-// Retrieves the next value associated with a key from a partition
-char *MR_GetNext(char *key, unsigned int partition_idx) {
-    if (partition_idx >= num_partitions || !key) {
-        // fprintf(stderr, "[MR_GetNext] Invalid partition index or null key.\n");
-        return NULL;
+// Appends an integer value to the pair for key in a locked partition
+static void insert_int_locked(Partition *partition, const char *key, size_t len,
+                              unsigned long hash, int64_t value, Combiner combiner) {
+    append_int_value(partition, find_or_insert_pair(partition, key, len, hash), value, combiner);
+}
+
+// Inserts a key and an integer value into a specified partition; the value
+// is stored inline in the pair's integer array
+void insert_int_into_partition(MR_Job *job, unsigned int partition_idx, char *key, int64_t value) {
+    Partition *partition = &job->partitions[partition_idx];
+    size_t len = strlen(key);
+    unsigned long hash = hash_key(key, len);
+    uint64_t locked_at = lock_partition(job, partition);
+    insert_int_locked(partition, key, len, hash, value, job->combiner);
+    Run *spilled = detach_if_over_budget(job, partition);
+    unlock_partition(job, partition, locked_at);
+    spill_detached(job, partition_idx, spilled);
+}
+
+// Frees a worker's combine table at thread exit
+static void free_combine_table(void *arg) {
+    CombineTable *table = arg;
+    arena_release(&table->keys);
+    free(table->entries);
+    free(table);
+}
+
+static void create_combine_key(void) {
+    pthread_key_create(&combine_key, free_combine_table);
+}
+
+// Returns the calling worker's combine table, creating it on first use
+static CombineTable *get_combine_table(void) {
+    pthread_once(&combine_key_once, create_combine_key);
+    CombineTable *table = pthread_getspecific(combine_key);
+    if (!table) {
+        table = calloc(1, sizeof(CombineTable));
+        pthread_setspecific(combine_key, table);
     }
+    return table;
+}
 
-    Partition *partition = &partitions[partition_idx];
-    pthread_mutex_lock(&partition->lock);
+// Moves every entry of this worker's combine table into the partitions,
+// taking each partition lock once per flush rather than once per key
+static void flush_combine_table(MR_Job *job) {
+    CombineTable *table = get_combine_table();
+    if (table->count == 0) {
+        return;
+    }
 
-    char *value = NULL;
-    for (unsigned int i = 0; i < partition->pair_count; i++) {
-        if (partition->pairs[i].key && strcmp(partition->pairs[i].key, key) == 0) {
-            if (partition->pairs[i].value_count > 0) {
-                value = strdup(partition->pairs[i].values[--partition->pairs[i].value_count]);
+    // Group the live entries by destination partition
+    unsigned int *offsets = calloc(job->num_partitions + 1, sizeof(unsigned int));
+    CombineEntry **grouped = malloc(table->count * sizeof(CombineEntry *));
+    for (unsigned int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key) {
+            offsets[table->entries[i].hash % job->num_partitions + 1]++;
+        }
+    }
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        offsets[p + 1] += offsets[p];
+    }
+    unsigned int *fill = malloc(job->num_partitions * sizeof(unsigned int));
+    memcpy(fill, offsets, job->num_partitions * sizeof(unsigned int));
+    for (unsigned int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key) {
+            grouped[fill[table->entries[i].hash % job->num_partitions]++] = &table->entries[i];
+        }
+    }
+
+    // Keep a copy of a mapped input's partial results for the result cache
+    InputCapture *capture = current_capture;
+    if (capture) {
+        pthread_mutex_lock(&capture->lock);
+        for (unsigned int i = 0; i < table->count; i++) {
+            Cache_put_record(&capture->records, grouped[i]->key, grouped[i]->key_len, grouped[i]->value);
+        }
+        pthread_mutex_unlock(&capture->lock);
+    }
+
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        if (offsets[p] == offsets[p + 1]) {
+            continue;
+        }
+        Partition *partition = &job->partitions[p];
+        uint64_t locked_at = lock_partition(job, partition);
+        for (unsigned int i = offsets[p]; i < offsets[p + 1]; i++) {
+            if (job->dictionary) {
+                KeyValuePair *pair = find_or_insert_id(partition, grouped[i]->key, grouped[i]->key_len,
+                                                       grouped[i]->hash, grouped[i]->id);
+                append_int_value(partition, pair, grouped[i]->value, job->combiner);
+            } else {
+                insert_int_locked(partition, grouped[i]->key, grouped[i]->key_len,
+                                  grouped[i]->hash, grouped[i]->value, job->combiner);
             }
-            break;
         }
+        Run *spilled = detach_if_over_budget(job, partition);
+        unlock_partition(job, partition, locked_at);
+        spill_detached(job, p, spilled);
     }
 
-    pthread_mutex_unlock(&partition->lock);
-    return value;
+    // Reset the table, keeping its slots and a key block for the next map task
+    memset(table->entries, 0, table->capacity * sizeof(CombineEntry));
+    arena_reset(&table->keys);
+    table->count = 0;
+    free(fill);
+    free(grouped);
+    free(offsets);
 }
 
-// Comparison function for sorting key-value pairs lexicographically
-int compare_key_value_pairs(const void *a, const void *b) {
-    KeyValuePair *pairA = (KeyValuePair *)a;
-    KeyValuePair *pairB = (KeyValuePair *)b;
-    return strcmp(pairA->key, pairB->key);
+// Grows the combine table, re-placing its entries
+static void grow_combine_table(CombineTable *table) {
+    unsigned int old_capacity = table->capacity;
+    CombineEntry *old_entries = table->entries;
+    table->capacity = old_capacity ? old_capacity * 2 : 256;
+    table->entries = calloc(table->capacity, sizeof(CombineEntry));
+    for (unsigned int i = 0; i < old_capacity; i++) {
+        if (old_entries[i].key) {
+            unsigned int slot = index_slot(old_entries[i].hash, table->capacity);
+            while (table->entries[slot].key) {
+                slot = (slot + 1) & (table->capacity - 1);
+            }
+            table->entries[slot] = old_entries[i];
+        }
+    }
+    free(old_entries);
 }
 
-// Reducer task for each partition
-void reduce_task(void *arg) {
-    unsigned int partition_idx = *(unsigned int *)arg;
-    free(arg);
-    Partition *partition = &partitions[partition_idx];
+// Combines an emitted integer into this worker's local table
+static void combine_locally(MR_Job *job, const char *key, size_t len, unsigned long hash, int64_t value) {
+    CombineTable *table = get_combine_table();
+    if (table->count * 2 >= table->capacity) {
+        grow_combine_table(table);
+    }
 
-    // Sort key-value pairs in lexicographic order
-    qsort(partition->pairs, partition->pair_count, sizeof(KeyValuePair), compare_key_value_pairs);
+    unsigned int slot = index_slot(hash, table->capacity);
+    while (table->entries[slot].key) {
+        CombineEntry *entry = &table->entries[slot];
+        if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, key, len) == 0) {
+            entry->value = job->combiner(entry->value, value);
+            return;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    // An interned key is looked up in the dictionary when it enters the
+    // table, so the flush finds its pair by ID
+    if (job->dictionary) {
+        const char *interned;
+        table->entries[slot].id = Intern_id(job->dictionary, key, len, hash, &interned);
+        table->entries[slot].key = (char *)interned;
+    } else {
+        table->entries[slot].key = arena_strndup(&table->keys, key, len);
+    }
+    table->entries[slot].key_len = (unsigned int)len;
+    table->entries[slot].hash = hash;
+    table->entries[slot].value = value;
+    table->count++;
 
-    // For each key in the partition, call the user-defined reducer
-    for (unsigned int i = 0; i < partition->pair_count; i++) {
-        user_reducer(partition->pairs[i].key, partition_idx);
-        
-        // Free memory for the key and all associated values
-        free(partition->pairs[i].key);
-        for (unsigned int j = 0; j < partition->pairs[i].value_count; j++) {
-            free(partition->pairs[i].values[j]);
+    // Bound the memory a single map task can hold back
+    if (table->count >= job->combine_limit) {
+        flush_combine_table(job);
+    }
+}
+
+// Initializes an empty partition
+static void init_partition(Partition *partition) {
+    partition->pairs = malloc(10 * sizeof(KeyValuePair));
+    partition->pair_count = 0;
+    partition->capacity = 10;
+    partition->index = NULL;
+    partition->dictionary = NULL;
+    partition->current = NULL;
+    partition->value_total = 0;
+    partition->arena.head = NULL;
+    partition->arena.bytes_used = 0;
+    partition->runs = NULL;
+    partition->run_count = 0;
+    partition->run_capacity = 0;
+    partition->run_bytes = 0;
+    partition->merging = false;
+    rebuild_index(partition, 16);
+    pthread_mutex_init(&partition->lock, NULL);
+}
+
+// Empties a partition for reuse by a later run, keeping its arrays and one
+// arena block
+static void reset_partition(Partition *partition) {
+    partition->pair_count = 0;
+    partition->value_total = 0;
+    partition->current = NULL;
+    memset(partition->index, 0, partition->index_capacity * sizeof(unsigned int));
+    partition->dictionary = NULL;
+    arena_reset(&partition->arena);
+    partition->run_count = 0;
+    partition->run_bytes = 0;
+    partition->merging = false;
+}
+
+// Frees a partition's storage
+static void destroy_partition(Partition *partition) {
+    pthread_mutex_destroy(&partition->lock);
+    arena_release(&partition->arena);
+    free(partition->pairs);
+    free(partition->index);
+    free(partition->runs);
+}
+
+// Frees a worker's local partitions at thread exit
+static void free_local_store(void *arg) {
+    LocalStore *store = arg;
+    for (unsigned int i = 0; i < store->count; i++) {
+        destroy_partition(&store->parts[i]);
+    }
+    free(store->parts);
+    free(store);
+}
+
+static void create_local_store_key(void) {
+    pthread_key_create(&local_store_key, free_local_store);
+}
+
+// Returns the calling worker's local partitions, (re)creating them when the
+// number of partitions changed since the worker last used them
+static LocalStore *get_local_store(MR_Job *job) {
+    pthread_once(&local_store_once, create_local_store_key);
+    LocalStore *store = pthread_getspecific(local_store_key);
+    if (!store) {
+        store = calloc(1, sizeof(LocalStore));
+        pthread_setspecific(local_store_key, store);
+    }
+    if (store->count != job->num_partitions) {
+        for (unsigned int i = 0; i < store->count; i++) {
+            destroy_partition(&store->parts[i]);
+        }
+        free(store->parts);
+        store->parts = malloc(job->num_partitions * sizeof(Partition));
+        store->count = job->num_partitions;
+        for (unsigned int i = 0; i < job->num_partitions; i++) {
+            init_partition(&store->parts[i]);
         }
-        free(partition->pairs[i].values);
     }
+    return store;
 }
 
-// Executes the MapReduce process, handling map and reduce phases
-void MR_Run(unsigned int file_count, char *file_names[], Mapper mapper, Reducer reducer, unsigned int num_workers, unsigned int num_parts) {
-    // Initialize partitions and mutexes
-    num_partitions = num_parts;
-    partitions = malloc(num_parts * sizeof(Partition));
-    for (unsigned int i = 0; i < num_parts; i++) {
-        partitions[i].pairs = malloc(10 * sizeof(KeyValuePair));
-        partitions[i].pair_count = 0;
-        partitions[i].capacity = 10;
-        pthread_mutex_init(&partitions[i].lock, NULL);
+// Submits tasks of a job to its context's pool, counting them as pending
+static void submit_tasks(MR_Job *job, thread_func_t func, void **args, long *sizes, unsigned int count) {
+    pthread_mutex_lock(&job->pending_lock);
+    job->pending += count;
+    pthread_mutex_unlock(&job->pending_lock);
+    ThreadPool_add_jobs(job->context->pool, func, args, sizes, count);
+}
+
+// Marks one task of a job as done. This must be the task's last access to
+// the job, which may be freed as soon as its last task finishes
+static void finish_task(MR_Job *job) {
+#ifdef MR_ENABLE_STATS
+    // Charge the pool worker running the task to this job, since the pool's
+    // own counters cover every job sharing it
+    int worker = ThreadPool_worker_index(job->context->pool);
+    uint64_t started = ThreadPool_job_started_ns(job->context->pool);
+    if (worker >= 0 && started) {
+        atomic_fetch_add_explicit(&job->stats.task_ns[worker], stats_now_ns() - started, memory_order_relaxed);
+        atomic_fetch_add_explicit(&job->stats.tasks[worker], 1, memory_order_relaxed);
+    }
+#endif
+    pthread_mutex_lock(&job->pending_lock);
+    if (--job->pending == 0) {
+        pthread_cond_broadcast(&job->pending_done);
     }
+    pthread_mutex_unlock(&job->pending_lock);
+}
 
-    // Set user-defined functions and create a thread pool for worker threads
-    user_mapper = mapper;
-    user_reducer = reducer;
-    thread_pool = ThreadPool_create(num_workers);
+// Waits until every task submitted for a job has finished. Unlike
+// ThreadPool_check this ignores other jobs sharing the pool
+static void wait_for_tasks(MR_Job *job) {
+    pthread_mutex_lock(&job->pending_lock);
+    while (job->pending > 0) {
+        pthread_cond_wait(&job->pending_done, &job->pending_lock);
+    }
+    pthread_mutex_unlock(&job->pending_lock);
+}
 
-    printf("Starting map phase...\n");
+// Defines a key being sorted: eight key bytes starting at the current depth,
+// big-endian so that integer order matches strcmp order, next to its pair
+typedef struct {
+    uint64_t prefix;
+    KeyValuePair *pair;
+} SortEntry;
 
-    // Map phase: Submit each file to be processed by the mapper
-    for (unsigned int i = 0; i < file_count; i++) {
-        int job_size = 10;
-        ThreadPool_add_job(thread_pool, (thread_func_t)mapper, file_names[i], job_size);
+// Loads the eight key bytes at depth into an integer, padding with zeros
+// past the end of the key
+static inline uint64_t key_prefix(const KeyValuePair *pair, size_t depth) {
+    const unsigned char *key = (const unsigned char *)pair->key + depth;
+    if (depth + 8 <= pair->key_len) {
+        uint64_t prefix;
+        memcpy(&prefix, key, 8);
+        return __builtin_bswap64(prefix);
     }
-    ThreadPool_check(thread_pool);
-    printf("Map phase completed.\n");
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (depth + i < pair->key_len ? key[i] : 0);
+    }
+    return prefix;
+}
 
-    printf("Starting reduce phase...\n");
+// Orders two entries whose keys agree before depth
+static inline int compare_entries(const SortEntry *a, const SortEntry *b, size_t depth) {
+    if (a->prefix != b->prefix) {
+        return a->prefix < b->prefix ? -1 : 1;
+    }
+    // A zero last byte means both keys ended inside the prefix
+    if ((a->prefix & 0xff) == 0) {
+        return 0;
+    }
+    return strcmp(a->pair->key + depth + 8, b->pair->key + depth + 8);
+}
 
-    // Reduce phase: Submit a reduce task for each partition
-    for (unsigned int i = 0; i < num_parts; i++) {
-        unsigned int *partition_idx = malloc(sizeof(unsigned int));
-        *partition_idx = i;
-        int job_size = 20;
-        ThreadPool_add_job(thread_pool, reduce_task, partition_idx, job_size);
+static void insertion_sort_entries(SortEntry *entries, size_t count, size_t depth) {
+    for (size_t i = 1; i < count; i++) {
+        SortEntry entry = entries[i];
+        size_t j = i;
+        while (j > 0 && compare_entries(&entry, &entries[j - 1], depth) < 0) {
+            entries[j] = entries[j - 1];
+            j--;
+        }
+        entries[j] = entry;
     }
-    ThreadPool_check(thread_pool);
-    printf("Reduce phase completed.\n");
+}
 
-    // Clean up resources
-    ThreadPool_destroy(thread_pool);
-    for (unsigned int i = 0; i < num_parts; i++) {
-        pthread_mutex_destroy(&partitions[i].lock);
-        free(partitions[i].pairs);
+static inline uint64_t median_of_three(uint64_t a, uint64_t b, uint64_t c) {
+    if (a < b) {
+        return b < c ? b : (a < c ? c : a);
     }
-    free(partitions);
+    return a < c ? a : (b < c ? c : b);
+}
 
-    printf("MapReduce run completed.\n");
-}
\ No newline at end of file
+// Multikey quicksort over cached prefixes: a three-way partition on the
+// prefix at depth, recursing into the equal range with the next eight bytes.
+// Comparisons are integer compares on the entries themselves; keys are only
+// touched to load the next prefix or in small ranges
+static void multikey_sort(SortEntry *entries, size_t count, size_t depth) {
+    while (count > SORT_INSERTION_THRESHOLD) {
+        uint64_t pivot = median_of_three(entries[0].prefix, entries[count / 2].prefix,
+                                         entries[count - 1].prefix);
+        size_t lt = 0, i = 0, gt = count;
+        while (i < gt) {
+            if (entries[i].prefix < pivot) {
+                SortEntry tmp = entries[lt];
+                entries[lt++] = entries[i];
+                entries[i++] = tmp;
+            } else if (entries[i].prefix > pivot) {
+                SortEntry tmp = entries[--gt];
+                entries[gt] = entries[i];
+                entries[i] = tmp;
+            } else {
+                i++;
+            }
+        }
+
+        multikey_sort(entries, lt, depth);
+        if ((pivot & 0xff) != 0) {
+            for (size_t k = lt; k < gt; k++) {
+                entries[k].prefix = key_prefix(entries[k].pair, depth + 8);
+            }
+            multikey_sort(entries + lt, gt - lt, depth + 8);
+        }
+        entries += gt;
+        count -= gt;
+    }
+    insertion_sort_entries(entries, count, depth);
+}
+
+// Defines a parallel sort of one large partition. Entries are distributed
+// into buckets by their first two bytes, and workers claim whole buckets
+// through next_bucket. The state is freed by whichever of the owner and the
+// helper tasks lets go of it last
+typedef struct {
+    SortEntry *entries;
+    size_t *bucket_starts;
+    atomic_uint next_bucket;
+    atomic_uint finished_buckets;
+    atomic_uint refs;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+} ParallelSort;
+
+#define SORT_BUCKETS 65536
+
+static void release_parallel_sort(ParallelSort *sort) {
+    if (atomic_fetch_sub(&sort->refs, 1) == 1) {
+        pthread_mutex_destroy(&sort->lock);
+        pthread_cond_destroy(&sort->done);
+        free(sort->bucket_starts);
+        free(sort);
+    }
+}
+
+// Sorts buckets until none are left to claim
+static void sort_buckets(ParallelSort *sort) {
+    unsigned int bucket;
+    while ((bucket = atomic_fetch_add(&sort->next_bucket, 1)) < SORT_BUCKETS) {
+        size_t start = sort->bucket_starts[bucket];
+        size_t count = sort->bucket_starts[bucket + 1] - start;
+        if (count > 1) {
+            multikey_sort(sort->entries + start, count, 0);
+        }
+        if (atomic_fetch_add(&sort->finished_buckets, 1) + 1 == SORT_BUCKETS) {
+            pthread_mutex_lock(&sort->lock);
+            pthread_cond_broadcast(&sort->done);
+            pthread_mutex_unlock(&sort->lock);
+        }
+    }
+}
+
+// Helper task run by an idle worker on behalf of a partition's sort
+static void sort_task(void *arg) {
+    Task *task = arg;
+    MR_Job *job = task->job;
+    ParallelSort *sort = task->input;
+    free(task);
+    sort_buckets(sort);
+    release_parallel_sort(sort);
+    finish_task(job);
+}
+
+// Sorts entries with help from idle pool workers. The owner sorts buckets
+// too and then only waits for buckets already being sorted, never for helper
+// tasks that have not started, so it cannot deadlock a busy pool
+static void parallel_sort_entries(MR_Job *job, SortEntry *entries, size_t count) {
+    ParallelSort *sort = malloc(sizeof(ParallelSort));
+    sort->bucket_starts = calloc(SORT_BUCKETS + 1, sizeof(size_t));
+
+    // Distribute the entries into buckets by their first two bytes
+    for (size_t i = 0; i < count; i++) {
+        sort->bucket_starts[(entries[i].prefix >> 48) + 1]++;
+    }
+    for (unsigned int b = 0; b < SORT_BUCKETS; b++) {
+        sort->bucket_starts[b + 1] += sort->bucket_starts[b];
+    }
+    size_t *fill = malloc(SORT_BUCKETS * sizeof(size_t));
+    memcpy(fill, sort->bucket_starts, SORT_BUCKETS * sizeof(size_t));
+    sort->entries = malloc(count * sizeof(SortEntry));
+    for (size_t i = 0; i < count; i++) {
+        sort->entries[fill[entries[i].prefix >> 48]++] = entries[i];
+    }
+    free(fill);
+
+    atomic_init(&sort->next_bucket, 0);
+    atomic_init(&sort->finished_buckets, 0);
+    pthread_mutex_init(&sort->lock, NULL);
+    pthread_cond_init(&sort->done, NULL);
+
+    unsigned int helpers = job->context->pool->num_threads - 1;
+    atomic_init(&sort->refs, helpers + 1);
+    for (unsigned int i = 0; i < helpers; i++) {
+        Task *task = malloc(sizeof(Task));
+        task->job = job;
+        task->input = sort;
+        task->partition_idx = 0;
+        long size = 0;
+        submit_tasks(job, sort_task, (void **)&task, &size, 1);
+    }
+
+    sort_buckets(sort);
+    pthread_mutex_lock(&sort->lock);
+    while (atomic_load(&sort->finished_buckets) < SORT_BUCKETS) {
+        pthread_cond_wait(&sort->done, &sort->lock);
+    }
+    pthread_mutex_unlock(&sort->lock);
+
+    memcpy(entries, sort->entries, count * sizeof(SortEntry));
+    free(sort->entries);
+    release_parallel_sort(sort);
+}
+
+// Sorts key-value pairs in strcmp order of their keys. With a job, large
+// arrays are sorted by several pool workers
+static void sort_pairs(MR_Job *job, KeyValuePair *pairs, unsigned int count) {
+    if (count < 2) {
+        return;
+    }
+    SortEntry *entries = malloc(count * sizeof(SortEntry));
+    KeyValuePair *copy = malloc(count * sizeof(KeyValuePair));
+    memcpy(copy, pairs, count * sizeof(KeyValuePair));
+    for (unsigned int i = 0; i < count; i++) {
+        entries[i].prefix = key_prefix(&copy[i], 0);
+        entries[i].pair = &copy[i];
+    }
+
+    if (job && count >= job->parallel_sort_threshold && job->context->pool->num_threads > 1) {
+        parallel_sort_entries(job, entries, count);
+    } else {
+        multikey_sort(entries, count, 0);
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        pairs[i] = *entries[i].pair;
+    }
+    free(copy);
+    free(entries);
+}
+
+// Sorts the pairs of every partition of a job that interns keys at once.
+// The job's IDs are put in key order by one sort, parallel when large, and
+// each partition then takes its pairs in that order, with their tags moved
+// along. Reduce tasks then need no sort of their own
+static void sort_interned_pairs(MR_Job *job) {
+    unsigned int num_parts = job->num_partitions;
+    size_t count = 0;
+    for (unsigned int p = 0; p < num_parts; p++) {
+        count += job->partitions[p].pair_count;
+    }
+    if (count < 2) {
+        return;
+    }
+    SortEntry *entries = malloc(count * sizeof(SortEntry));
+    size_t next = 0;
+    for (unsigned int p = 0; p < num_parts; p++) {
+        Partition *partition = &job->partitions[p];
+        for (unsigned int i = 0; i < partition->pair_count; i++) {
+            entries[next].prefix = key_prefix(&partition->pairs[i], 0);
+            entries[next++].pair = &partition->pairs[i];
+        }
+    }
+    if (count >= job->parallel_sort_threshold && job->context->pool->num_threads > 1) {
+        parallel_sort_entries(job, entries, count);
+    } else {
+        multikey_sort(entries, count, 0);
+    }
+
+    // A key's partition follows from its hash, so one pass in key order
+    // fills every partition's new array
+    KeyValuePair **sorted = malloc(num_parts * sizeof(KeyValuePair *));
+    unsigned int *fill = calloc(num_parts, sizeof(unsigned int));
+    for (unsigned int p = 0; p < num_parts; p++) {
+        unsigned int capacity = job->partitions[p].pair_count > 10 ? job->partitions[p].pair_count : 10;
+        sorted[p] = malloc(capacity * sizeof(KeyValuePair));
+    }
+    for (size_t i = 0; i < count; i++) {
+        KeyValuePair *pair = entries[i].pair;
+        unsigned int p = pair->hash % num_parts;
+        sorted[p][fill[p]] = *pair;
+        *Intern_tag(pair->key) = ++fill[p];
+    }
+    for (unsigned int p = 0; p < num_parts; p++) {
+        Partition *partition = &job->partitions[p];
+        free(partition->pairs);
+        partition->pairs = sorted[p];
+        partition->capacity = partition->pair_count > 10 ? partition->pair_count : 10;
+    }
+    free(fill);
+    free(sorted);
+    free(entries);
+}
+
+// Sorts the contents of a partition into a run. The run takes over the
+// pairs and the arena, leaving the partition empty for reuse
+static Run *take_run(Partition *source) {
+    Run *run = malloc(sizeof(Run));
+    sort_pairs(NULL, source->pairs, source->pair_count);
+    run->pairs = source->pairs;
+    run->count = source->pair_count;
+    run->capacity = source->capacity;
+    run->size = source->pair_count + source->value_total;
+    run->arena = source->arena;
+    run->file = NULL;
+
+    source->pairs = malloc(10 * sizeof(KeyValuePair));
+    source->capacity = 10;
+    source->pair_count = 0;
+    source->value_total = 0;
+    source->arena.head = NULL;
+    source->arena.bytes_used = 0;
+    rebuild_index(source, 16);
+    return run;
+}
+
+// Creates an empty run, kept in memory or written to a spill file
+static Run *new_run(MR_Job *job, bool spilled) {
+    Run *run = calloc(1, sizeof(Run));
+    if (spilled) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s/mr-spill-XXXXXX", job->spill_dir);
+        int fd = mkstemp(name);
+        if (fd < 0) {
+            perror(name);
+            exit(1);
+        }
+        // The file lives only as long as its descriptor
+        unlink(name);
+        run->file = fdopen(fd, "w+");
+        setvbuf(run->file, NULL, _IOFBF, SPILL_BUFFER_SIZE);
+    }
+    return run;
+}
+
+// Bytes a run holds in memory
+static size_t run_memory(Run *run) {
+    if (run->file) {
+        return 0;
+    }
+    return run->arena.bytes_used + run->capacity * sizeof(KeyValuePair);
+}
+
+// Frees a run together with its keys and values, or its spill file
+static void free_run(Run *run) {
+    if (run->file) {
+        fclose(run->file);
+    }
+    arena_release(&run->arena);
+    free(run->pairs);
+    free(run);
+}
+
+// Writes an unsigned LEB128 varint
+static void write_varint(FILE *file, uint64_t value) {
+    while (value >= 0x80) {
+        putc_unlocked((int)((value & 0x7f) | 0x80), file);
+        value >>= 7;
+    }
+    putc_unlocked((int)value, file);
+}
+
+// Reads an unsigned LEB128 varint; returns false at end of file
+static bool read_varint(FILE *file, uint64_t *value) {
+    uint64_t result = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        int c = getc_unlocked(file);
+        if (c == EOF) {
+            return false;
+        }
+        result |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Appends a pair to a run being built. Spilled runs store each pair as
+// varint-prefixed key and values with zigzag-encoded integers
+static void run_append(Run *run, const KeyValuePair *pair) {
+    run->count++;
+    run->size += 1 + pair->value_count + pair->int_count;
+    if (run->file) {
+        write_varint(run->file, pair->key_len);
+        fwrite(pair->key, 1, pair->key_len, run->file);
+        write_varint(run->file, pair->value_count);
+        for (unsigned int i = 0; i < pair->value_count; i++) {
+            size_t len = strlen(pair->values[i]);
+            write_varint(run->file, len);
+            fwrite(pair->values[i], 1, len, run->file);
+        }
+        write_varint(run->file, pair->int_count);
+        for (unsigned int i = 0; i < pair->int_count; i++) {
+            uint64_t value = (uint64_t)pair->int_values[i];
+            write_varint(run->file, (value << 1) ^ (uint64_t)(pair->int_values[i] >> 63));
+        }
+        return;
+    }
+
+    if (run->count > run->capacity) {
+        run->capacity = run->capacity ? run->capacity * 2 : 64;
+        run->pairs = realloc(run->pairs, run->capacity * sizeof(KeyValuePair));
+    }
+    KeyValuePair *copy = &run->pairs[run->count - 1];
+    *copy = *pair;
+    copy->key = arena_strndup(&run->arena, pair->key, pair->key_len);
+    copy->values = NULL;
+    copy->value_capacity = pair->value_count;
+    if (pair->value_count > 0) {
+        copy->values = arena_alloc(&run->arena, pair->value_count * sizeof(char *));
+        for (unsigned int i = 0; i < pair->value_count; i++) {
+            copy->values[i] = arena_strdup(&run->arena, pair->values[i]);
+        }
+    }
+    copy->int_values = NULL;
+    copy->int_capacity = pair->int_count;
+    if (pair->int_count > 0) {
+        copy->int_values = arena_alloc(&run->arena, pair->int_count * sizeof(int64_t));
+        memcpy(copy->int_values, pair->int_values, pair->int_count * sizeof(int64_t));
+    }
+}
+
+// Finishes writing a spilled run so it can be read back from the start
+static void finish_run(Run *run) {
+    if (run->file) {
+        fflush(run->file);
+        rewind(run->file);
+    }
+}
+
+// Moves an in-memory run to a spill file, freeing its memory
+static void spill_run(MR_Job *job, Run *run) {
+    Run *spilled = new_run(job, true);
+    for (unsigned int i = 0; i < run->count; i++) {
+        run_append(spilled, &run->pairs[i]);
+    }
+    finish_run(spilled);
+    arena_release(&run->arena);
+    free(run->pairs);
+    *run = *spilled;
+    free(spilled);
+}
+
+// Defines a read position in a sorted run. head is the next pair, or NULL
+// once the run is exhausted; pairs of a spilled run are decoded into record,
+// with the key and values in scratch
+typedef struct {
+    Run *run;
+    unsigned int position;
+    KeyValuePair *head;
+    KeyValuePair record;
+    Arena scratch;
+} RunCursor;
+
+// Decodes the next pair of a spilled run into the cursor
+static bool read_record(RunCursor *cursor) {
+    FILE *file = cursor->run->file;
+    KeyValuePair *pair = &cursor->record;
+    uint64_t len, count;
+    arena_reset(&cursor->scratch);
+
+    if (!read_varint(file, &len)) {
+        return false;
+    }
+    pair->key = arena_alloc(&cursor->scratch, len + 1);
+    if (fread(pair->key, 1, len, file) != len) {
+        return false;
+    }
+    pair->key[len] = '\0';
+    pair->key_len = (unsigned int)len;
+    pair->hash = hash_key(pair->key, len);
+
+    if (!read_varint(file, &count)) {
+        return false;
+    }
+    pair->value_count = pair->value_capacity = (unsigned int)count;
+    pair->values = arena_alloc(&cursor->scratch, (count + 1) * sizeof(char *));
+    for (uint64_t i = 0; i < count; i++) {
+        if (!read_varint(file, &len)) {
+            return false;
+        }
+        pair->values[i] = arena_alloc(&cursor->scratch, len + 1);
+        if (fread(pair->values[i], 1, len, file) != len) {
+            return false;
+        }
+        pair->values[i][len] = '\0';
+    }
+
+    if (!read_varint(file, &count)) {
+        return false;
+    }
+    pair->int_count = pair->int_capacity = (unsigned int)count;
+    pair->int_values = arena_alloc(&cursor->scratch, (count + 1) * sizeof(int64_t));
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t value;
+        if (!read_varint(file, &value)) {
+            return false;
+        }
+        pair->int_values[i] = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+    return true;
+}
+
+// Moves a cursor to the next pair of its run
+static void cursor_advance(RunCursor *cursor) {
+    Run *run = cursor->run;
+    cursor->head = NULL;
+    if (cursor->position == run->count) {
+        return;
+    }
+    if (!run->file) {
+        cursor->head = &run->pairs[cursor->position++];
+        return;
+    }
+    cursor->position++;
+    if (read_record(cursor)) {
+        cursor->head = &cursor->record;
+    } else {
+        fprintf(stderr, "[MR_Run] Spilled run is truncated\n");
+    }
+}
+
+// Defines a k-way merge over sorted runs. heap holds the indexes of cursors
+// that still have pairs, ordered by their head key; out collects all values
+// of the current key across runs, with the key (and values read from spill
+// files) copied into scratch
+typedef struct {
+    RunCursor *cursors;
+    unsigned int *heap;
+    unsigned int heap_size;
+    char **values;
+    unsigned int value_capacity;
+    int64_t *ints;
+    unsigned int int_capacity;
+    Arena scratch;
+    KeyValuePair out;
+    Combiner combiner;
+} RunMerger;
+
+// Whether cursor a's head key sorts before cursor b's
+static bool merger_less(RunMerger *merger, unsigned int a, unsigned int b) {
+    return strcmp(merger->cursors[a].head->key, merger->cursors[b].head->key) < 0;
+}
+
+static void merger_sift_down(RunMerger *merger, unsigned int i) {
+    while (1) {
+        unsigned int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < merger->heap_size && merger_less(merger, merger->heap[left], merger->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < merger->heap_size && merger_less(merger, merger->heap[right], merger->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        unsigned int tmp = merger->heap[i];
+        merger->heap[i] = merger->heap[smallest];
+        merger->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void merger_init(RunMerger *merger, Run **runs, unsigned int count, Combiner combiner) {
+    memset(merger, 0, sizeof(RunMerger));
+    merger->combiner = combiner;
+    merger->cursors = calloc(count + 1, sizeof(RunCursor));
+    merger->heap = malloc((count + 1) * sizeof(unsigned int));
+    for (unsigned int i = 0; i < count; i++) {
+        merger->cursors[i].run = runs[i];
+        cursor_advance(&merger->cursors[i]);
+        if (merger->cursors[i].head) {
+            merger->heap[merger->heap_size++] = i;
+        }
+    }
+    for (unsigned int i = merger->heap_size / 2; i-- > 0;) {
+        merger_sift_down(merger, i);
+    }
+}
+
+// Gathers the next distinct key and all of its values into merger->out,
+// valid until the next call. Returns false when all runs are done
+static bool merger_next(RunMerger *merger) {
+    if (merger->heap_size == 0) {
+        return false;
+    }
+    KeyValuePair *first = merger->cursors[merger->heap[0]].head;
+    arena_reset(&merger->scratch);
+    merger->out.key = arena_strndup(&merger->scratch, first->key, first->key_len);
+    merger->out.key_len = first->key_len;
+    merger->out.hash = first->hash;
+    merger->out.value_count = 0;
+    merger->out.int_count = 0;
+
+    while (merger->heap_size > 0) {
+        RunCursor *cursor = &merger->cursors[merger->heap[0]];
+        KeyValuePair *pair = cursor->head;
+        if (strcmp(pair->key, merger->out.key) != 0) {
+            break;
+        }
+
+        // Append this run's values for the key; values decoded from a spill
+        // file are overwritten when the cursor advances, so copy them
+        if (pair->value_count > 0) {
+            if (merger->out.value_count + pair->value_count > merger->value_capacity) {
+                merger->value_capacity = (merger->out.value_count + pair->value_count) * 2;
+                merger->values = realloc(merger->values, merger->value_capacity * sizeof(char *));
+            }
+            for (unsigned int i = 0; i < pair->value_count; i++) {
+                merger->values[merger->out.value_count++] =
+                    cursor->run->file ? arena_strdup(&merger->scratch, pair->values[i]) : pair->values[i];
+            }
+        }
+        for (unsigned int i = 0; i < pair->int_count; i++) {
+            if (merger->combiner && merger->out.int_count > 0) {
+                merger->ints[0] = merger->combiner(merger->ints[0], pair->int_values[i]);
+                continue;
+            }
+            if (merger->out.int_count == merger->int_capacity) {
+                merger->int_capacity = merger->int_capacity ? merger->int_capacity * 2 : 16;
+                merger->ints = realloc(merger->ints, merger->int_capacity * sizeof(int64_t));
+            }
+            merger->ints[merger->out.int_count++] = pair->int_values[i];
+        }
+
+        // Advance the run, dropping it from the heap once exhausted
+        cursor_advance(cursor);
+        if (!cursor->head) {
+            merger->heap[0] = merger->heap[--merger->heap_size];
+        }
+        merger_sift_down(merger, 0);
+    }
+
+    merger->out.values = merger->values;
+    merger->out.value_capacity = merger->value_capacity;
+    merger->out.int_values = merger->ints;
+    merger->out.int_capacity = merger->int_capacity;
+    return true;
+}
+
+static void merger_free(RunMerger *merger, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        arena_release(&merger->cursors[i].scratch);
+    }
+    arena_release(&merger->scratch);
+    free(merger->cursors);
+    free(merger->heap);
+    free(merger->values);
+    free(merger->ints);
+}
+
+// Merges sorted runs into a single new run, in memory or spilled to disk
+static Run *merge_runs(MR_Job *job, Run **runs, unsigned int count, bool spilled) {
+    Run *merged = new_run(job, spilled);
+    RunMerger merger;
+    merger_init(&merger, runs, count, job->combiner);
+    while (merger_next(&merger)) {
+        run_append(merged, &merger.out);
+    }
+    merger_free(&merger, count);
+    finish_run(merged);
+    return merged;
+}
+
+// Adds a run to a locked partition's list of runs
+static void push_run(Partition *partition, Run *run) {
+    if (partition->run_count == partition->run_capacity) {
+        partition->run_capacity = partition->run_capacity ? partition->run_capacity * 2 : 8;
+        partition->runs = realloc(partition->runs, partition->run_capacity * sizeof(Run *));
+    }
+    partition->runs[partition->run_count++] = run;
+    partition->run_bytes += run_memory(run);
+}
+
+static int compare_run_sizes(const void *a, const void *b) {
+    const Run *runA = *(Run *const *)a;
+    const Run *runB = *(Run *const *)b;
+    return (runA->size > runB->size) - (runA->size < runB->size);
+}
+
+// Picks MERGE_FANIN runs of similar size (within 2x) from a locked
+// partition, removing them from its list. Merging only like-sized runs keeps
+// large runs from being copied again on every merge. Returns false when no
+// such group exists
+static bool pick_merge_batch(Partition *partition, Run **batch) {
+    if (partition->run_count < MERGE_FANIN) {
+        return false;
+    }
+    qsort(partition->runs, partition->run_count, sizeof(Run *), compare_run_sizes);
+    for (unsigned int i = 0; i + MERGE_FANIN <= partition->run_count; i++) {
+        if (partition->runs[i + MERGE_FANIN - 1]->size <= 2 * partition->runs[i]->size) {
+            memcpy(batch, &partition->runs[i], MERGE_FANIN * sizeof(Run *));
+            memmove(&partition->runs[i], &partition->runs[i + MERGE_FANIN],
+                    (partition->run_count - i - MERGE_FANIN) * sizeof(Run *));
+            partition->run_count -= MERGE_FANIN;
+            for (unsigned int b = 0; b < MERGE_FANIN; b++) {
+                partition->run_bytes -= run_memory(batch[b]);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether a locked partition holds more than its share of the memory budget
+static bool over_budget(MR_Job *job, Partition *partition, size_t extra) {
+    if (!job->memory_budget) {
+        return false;
+    }
+    size_t bytes = partition->arena.bytes_used + partition->capacity * sizeof(KeyValuePair) +
+                   partition->index_capacity * sizeof(unsigned int) + partition->run_bytes + extra;
+    return bytes > job->memory_budget;
+}
+
+static void merge_task(void *arg);
+
+// Hands a run to partition p, starting a background merge when enough
+// similar runs have piled up
+static void add_run(MR_Job *job, unsigned int p, Run *run) {
+    Partition *partition = &job->partitions[p];
+    bool start_merge = false;
+
+    uint64_t locked_at = lock_partition(job, partition);
+    push_run(partition, run);
+    if (!partition->merging && partition->run_count >= MERGE_FANIN) {
+        partition->merging = true;
+        start_merge = true;
+    }
+    unlock_partition(job, partition, locked_at);
+
+    if (start_merge) {
+        Task *task = malloc(sizeof(Task));
+        task->job = job;
+        task->input = NULL;
+        task->partition_idx = p;
+        long size = (long)run->size * MERGE_FANIN;
+        submit_tasks(job, merge_task, (void **)&task, &size, 1);
+    }
+}
+
+// Publishes a worker-local partition as a run of partition p, spilling it
+// straight to disk when the partition is over its memory budget
+static void publish_run(MR_Job *job, unsigned int p, Partition *local) {
+    Run *run = take_run(local);
+    Partition *partition = &job->partitions[p];
+    uint64_t locked_at = lock_partition(job, partition);
+    bool spill = over_budget(job, partition, run_memory(run));
+    unlock_partition(job, partition, locked_at);
+    if (spill) {
+        spill_run(job, run);
+    }
+    add_run(job, p, run);
+}
+
+// Detaches the table of a locked partition as a sorted run once the
+// partition exceeds its memory budget; the caller spills it after unlocking
+static Run *detach_if_over_budget(MR_Job *job, Partition *partition) {
+    if (partition->pair_count == 0 || !over_budget(job, partition, 0)) {
+        return NULL;
+    }
+    return take_run(partition);
+}
+
+// Writes a run detached from partition p to disk and hands it back
+static void spill_detached(MR_Job *job, unsigned int p, Run *run) {
+    if (run) {
+        spill_run(job, run);
+        add_run(job, p, run);
+    }
+}
+
+// Background merge of a partition's runs, overlapping the map phase. Only
+// one merge task per partition runs at a time; it keeps going while
+// mergeable groups remain. Merges involving spilled runs, or made while the
+// partition is over budget, are written to disk as well
+static void merge_task(void *arg) {
+    Task *task = arg;
+    MR_Job *job = task->job;
+    Partition *partition = &job->partitions[task->partition_idx];
+    Run *batch[MERGE_FANIN];
+    free(task);
+
+    pthread_mutex_lock(&partition->lock);
+    while (pick_merge_batch(partition, batch)) {
+        size_t batch_bytes = 0;
+        bool spilled = false;
+        for (unsigned int i = 0; i < MERGE_FANIN; i++) {
+            batch_bytes += run_memory(batch[i]);
+            spilled |= batch[i]->file != NULL;
+        }
+        spilled |= over_budget(job, partition, batch_bytes);
+        pthread_mutex_unlock(&partition->lock);
+
+        Run *merged = merge_runs(job, batch, MERGE_FANIN, spilled);
+        for (unsigned int i = 0; i < MERGE_FANIN; i++) {
+            free_run(batch[i]);
+        }
+        pthread_mutex_lock(&partition->lock);
+        push_run(partition, merged);
+    }
+    partition->merging = false;
+    pthread_mutex_unlock(&partition->lock);
+    finish_task(job);
+}
+
+// Publishes every non-empty local partition of this worker as a run
+static void publish_local_runs(MR_Job *job) {
+    LocalStore *store = get_local_store(job);
+    for (unsigned int p = 0; p < store->count; p++) {
+        if (store->parts[p].pair_count > 0) {
+            publish_run(job, p, &store->parts[p]);
+        }
+    }
+}
+
+// Adds an integer value to this worker's local partition for key, turning
+// the partition into a run early once it holds combine_limit keys
+static void insert_int_local(MR_Job *job, const char *key, size_t len, unsigned long hash, int64_t value) {
+    unsigned int p = hash % job->num_partitions;
+    Partition *local = &get_local_store(job)->parts[p];
+    insert_int_locked(local, key, len, hash, value, job->combiner);
+    if (local->pair_count >= job->combine_limit) {
+        publish_run(job, p, local);
+    }
+}
+
+// Frees the staging buffers of a worker
+static void free_stage_buffers(EmitStage *stage) {
+    for (unsigned int i = 0; i < stage->count; i++) {
+        free(stage->buffers[i].values);
+        free(stage->buffers[i].keys);
+        free(stage->buffers[i].slots);
+        free(stage->buffers[i].bytes);
+    }
+    free(stage->buffers);
+}
+
+// Frees a worker's staging buffers at thread exit
+static void free_emit_stage(void *arg) {
+    free_stage_buffers(arg);
+    free(arg);
+}
+
+static void create_stage_key(void) {
+    pthread_key_create(&stage_key, free_emit_stage);
+}
+
+// Returns the calling worker's staging buffers, (re)creating them when the
+// job's partition count or batch size differs from the worker's last job.
+// Buffers are empty between map tasks, so nothing is lost
+static EmitStage *get_emit_stage(MR_Job *job) {
+    pthread_once(&stage_once, create_stage_key);
+    EmitStage *stage = pthread_getspecific(stage_key);
+    if (!stage) {
+        stage = calloc(1, sizeof(EmitStage));
+        pthread_setspecific(stage_key, stage);
+    }
+    if (stage->count != job->num_partitions || stage->batch != job->emit_batch) {
+        free_stage_buffers(stage);
+        stage->buffers = calloc(job->num_partitions, sizeof(StageBuffer));
+        stage->count = job->num_partitions;
+        stage->batch = job->emit_batch;
+    }
+    return stage;
+}
+
+// Moves a staging buffer into partition p under one lock acquisition. Its
+// emits are already merged by key, so each distinct key is looked up in the
+// partition once however many times it was emitted
+static void flush_stage_buffer(MR_Job *job, unsigned int p, StageBuffer *buffer) {
+    if (buffer->count == 0) {
+        return;
+    }
+    Partition *partition = &job->partitions[p];
+    uint64_t locked_at = lock_partition(job, partition);
+    for (unsigned int k = 0; k < buffer->key_count; k++) {
+        StagedKey *staged = &buffer->keys[k];
+        KeyValuePair *pair = find_or_insert_pair(partition, buffer->bytes + staged->key_offset,
+                                                 staged->key_len, staged->hash);
+        for (unsigned int v = staged->first; v != 0; v = buffer->values[v - 1].next) {
+            StagedValue *value = &buffer->values[v - 1];
+            if (value->value_offset >= 0) {
+                append_string_value(partition, pair, buffer->bytes + value->value_offset);
+            } else {
+                append_int_value(partition, pair, value->int_value, NULL);
+            }
+        }
+    }
+    Run *spilled = detach_if_over_budget(job, partition);
+    unlock_partition(job, partition, locked_at);
+    spill_detached(job, p, spilled);
+
+    atomic_fetch_add_explicit(&job->flushes, 1, memory_order_relaxed);
+    memset(buffer->slots, 0, buffer->slot_capacity * sizeof(unsigned int));
+    buffer->count = 0;
+    buffer->key_count = 0;
+    buffer->used = 0;
+}
+
+// Copies len bytes plus a NUL into a staging buffer, returning their offset
+static size_t stage_bytes(StageBuffer *buffer, const char *data, size_t len) {
+    if (buffer->used + len + 1 > buffer->size) {
+        buffer->size = buffer->size ? buffer->size * 2 : 4096;
+        while (buffer->used + len + 1 > buffer->size) {
+            buffer->size *= 2;
+        }
+        buffer->bytes = realloc(buffer->bytes, buffer->size);
+    }
+    size_t offset = buffer->used;
+    memcpy(buffer->bytes + offset, data, len);
+    buffer->bytes[offset + len] = '\0';
+    buffer->used += len + 1;
+    return offset;
+}
+
+// Stages an emit in this worker's buffer for its partition, merging it
+// with earlier emits of the same key, and flushes the buffer once it holds
+// a full batch. value is NULL for an integer emit
+static void stage_emit(MR_Job *job, const char *key, size_t len, unsigned long hash,
+                       const char *value, int64_t int_value) {
+    unsigned int p = hash % job->num_partitions;
+    StageBuffer *buffer = &get_emit_stage(job)->buffers[p];
+    if (!buffer->values) {
+        // At most batch distinct keys, in a table kept at most half full
+        buffer->values = malloc(job->emit_batch * sizeof(StagedValue));
+        buffer->keys = malloc(job->emit_batch * sizeof(StagedKey));
+        buffer->slot_capacity = 16;
+        while (buffer->slot_capacity < job->emit_batch * 2) {
+            buffer->slot_capacity *= 2;
+        }
+        buffer->slots = calloc(buffer->slot_capacity, sizeof(unsigned int));
+    }
+
+    unsigned int slot = index_slot(hash, buffer->slot_capacity);
+    StagedKey *staged = NULL;
+    while (buffer->slots[slot] != 0) {
+        StagedKey *candidate = &buffer->keys[buffer->slots[slot] - 1];
+        if (candidate->hash == hash && candidate->key_len == len &&
+            memcmp(buffer->bytes + candidate->key_offset, key, len) == 0) {
+            staged = candidate;
+            break;
+        }
+        slot = (slot + 1) & (buffer->slot_capacity - 1);
+    }
+    if (!staged) {
+        staged = &buffer->keys[buffer->key_count];
+        staged->key_offset = stage_bytes(buffer, key, len);
+        staged->key_len = (unsigned int)len;
+        staged->hash = hash;
+        staged->first = 0;
+        buffer->slots[slot] = ++buffer->key_count;
+    }
+
+    StagedValue *staged_value = &buffer->values[buffer->count];
+    staged_value->value_offset = value ? (long)stage_bytes(buffer, value, strlen(value)) : -1;
+    staged_value->int_value = int_value;
+    staged_value->next = 0;
+    buffer->count++;
+    if (staged->first == 0) {
+        staged->first = buffer->count;
+    } else {
+        buffer->values[staged->last - 1].next = buffer->count;
+    }
+    staged->last = buffer->count;
+
+    if (buffer->count == job->emit_batch) {
+        flush_stage_buffer(job, p, buffer);
+    }
+}
+
+// Flushes every staging buffer of this worker
+static void flush_emit_stage(MR_Job *job) {
+    EmitStage *stage = get_emit_stage(job);
+    for (unsigned int p = 0; p < stage->count; p++) {
+        flush_stage_buffer(job, p, &stage->buffers[p]);
+    }
+}
+
+// Ends a map task: hands everything the worker buffered to the partitions
+static void finish_map_task(MR_Job *job) {
+    if (job->pipeline) {
+        publish_local_runs(job);
+        return;
+    }
+    if (job->combiner) {
+        flush_combine_table(job);
+    }
+    if (job->emit_batch > 1) {
+        flush_emit_stage(job);
+    }
+}
+
+// Map task run by the pool: maps one file, then flushes the local table
+static void map_task(void *arg) {
+    Task *task = arg;
+    MR_Job *previous = current_job;
+    InputCapture *previous_capture = current_capture;
+    current_job = task->job;
+    current_input = task->input_idx;
+    current_capture = task->job->captures ? &task->job->captures[task->input_idx] : NULL;
+    task->job->mapper((char *)task->input);
+    finish_map_task(task->job);
+    current_capture = previous_capture;
+    current_job = previous;
+    finish_task(task->job);
+}
+
+// Map task for one byte-range split of a file
+static void map_split_task(void *arg) {
+    Task *task = arg;
+    MR_Job *previous = current_job;
+    InputCapture *previous_capture = current_capture;
+    current_job = task->job;
+    current_input = task->input_idx;
+    current_capture = task->job->captures ? &task->job->captures[task->input_idx] : NULL;
+    task->job->split_mapper((MR_Split *)task->input);
+    finish_map_task(task->job);
+    current_capture = previous_capture;
+    current_job = previous;
+    finish_task(task->job);
+}
+
+// Map task for an unchanged input: feeds its cached partial results
+// through the combine table instead of mapping the file again
+static void replay_task(void *arg) {
+    Task *task = arg;
+    MR_Job *previous = current_job;
+    InputCapture *previous_capture = current_capture;
+    current_job = task->job;
+    current_capture = NULL;
+    const Cache_records_t *records = task->input;
+    size_t offset = 0, len;
+    const char *key;
+    int64_t value;
+    while (Cache_next_record(records, &offset, &key, &len, &value)) {
+        combine_locally(task->job, key, len, hash_key(key, len), value);
+    }
+    finish_map_task(task->job);
+    current_capture = previous_capture;
+    current_job = previous;
+    finish_task(task->job);
+}
+
+// Finds the cache entry of an input that has not changed since it was
+// cached: same size, and the same modification time or else the same
+// content hash. Only an input whose size matches but whose modification
+// time does not is hashed; the hash is kept so a later touch can reuse it
+static void identify_input(Cache_t *cache, const char *file_name, CachedInput *input) {
+    struct stat st;
+    if (stat(file_name, &st) != 0) {
+        return;
+    }
+    input->found = true;
+    input->size = (uint64_t)st.st_size;
+    input->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    Cache_entry_t *entry = Cache_find(cache, file_name);
+    input->stale = entry != NULL;
+    if (!entry || entry->size != input->size) {
+        return;
+    }
+    if (entry->mtime_ns == input->mtime_ns) {
+        input->hash = entry->hash;
+        input->entry = entry;
+        input->stale = false;
+        return;
+    }
+    if (Cache_hash_file(file_name, &input->hash) && entry->hash != 0 && input->hash == entry->hash) {
+        input->entry = entry;
+        input->stale = false;
+    }
+}
+
+// Writes the result cache for the next run: cached entries of unchanged
+// inputs, the captured output of mapped ones, and nothing for inputs that
+// are gone. Returns the number of entries dropped for inputs that are gone
+static unsigned int save_cache(MR_Job *job, const char *cache_file, Cache_t *old, CachedInput *inputs,
+                               unsigned int file_count, char *file_names[]) {
+    Cache_t *cache = Cache_create();
+    bool *used = calloc(old->count + 1, sizeof(bool));
+    unsigned int stale = 0;
+    for (unsigned int i = 0; i < file_count; i++) {
+        CachedInput *input = &inputs[i];
+        InputCapture *capture = &job->captures[i];
+        stale += input->stale;
+        if (input->entry) {
+            used[input->entry - old->entries] = true;
+            Cache_records_t records = input->entry->records;
+            records.bytes = malloc(records.len + 1);
+            if (records.len > 0) {
+                memcpy(records.bytes, input->entry->records.bytes, records.len);
+            }
+            records.capacity = records.len + 1;
+            Cache_add(cache, file_names[i], input->size, input->mtime_ns, input->hash, &records);
+        } else if (input->found && !capture->uncacheable) {
+            Cache_add(cache, file_names[i], input->size, input->mtime_ns, input->hash, &capture->records);
+        }
+    }
+    unsigned int unused = 0;
+    for (unsigned int i = 0; i < old->count; i++) {
+        unused += !used[i];
+    }
+    unsigned int dropped = unused > stale ? unused - stale : 0;
+    if (!Cache_save(cache, cache_file)) {
+        fprintf(stderr, "[MR_Run] Cannot write the result cache %s\n", cache_file);
+    }
+    free(used);
+    Cache_destroy(cache);
+    return dropped;
+}
+
+// Writes a worker request for a map task: its index, the settings and user
+// functions a worker needs to map it, and its input. Workers are forked
+// from this process, so function pointers are sent as addresses
+static void put_remote_task(Remote_buffer_t *request, MR_Job *job, Task *task, unsigned int task_idx) {
+    request->len = 0;
+    Remote_put_varint(request, task_idx);
+    Remote_put_varint(request, job->num_partitions);
+    Remote_put_varint(request, job->combine_limit);
+    Remote_put_varint(request, job->emit_batch);
+    Remote_put_varint(request, (uintptr_t)job->mapper);
+    Remote_put_varint(request, (uintptr_t)job->split_mapper);
+    Remote_put_varint(request, (uintptr_t)job->combiner);
+    const char *file_name = job->split_mapper ? ((MR_Split *)task->input)->file_name : task->input;
+    size_t len = strlen(file_name) + 1;
+    Remote_put_varint(request, len);
+    Remote_put_bytes(request, file_name, len);
+    if (job->split_mapper) {
+        Remote_put_varint(request, (uint64_t)((MR_Split *)task->input)->offset);
+        Remote_put_varint(request, (uint64_t)((MR_Split *)task->input)->length);
+    }
+}
+
+// Gives a worker's job num_parts empty partitions
+static void size_worker_job(MR_Job *job, unsigned int num_parts) {
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        destroy_partition(&job->partitions[p]);
+    }
+    free(job->partitions);
+    job->num_partitions = num_parts;
+    job->partitions = malloc(num_parts * sizeof(Partition));
+    for (unsigned int p = 0; p < num_parts; p++) {
+        init_partition(&job->partitions[p]);
+    }
+#ifdef MR_ENABLE_STATS
+    free(job->stats.lock_hold_ns);
+    free(job->stats.lock_wait_ns);
+    free(job->stats.emits);
+    free(job->stats.keys);
+    job->stats.lock_hold_ns = calloc(num_parts, sizeof(uint64_t));
+    job->stats.lock_wait_ns = calloc(num_parts, sizeof(uint64_t));
+    job->stats.slots = 1;
+    job->stats.emits = calloc(num_parts, sizeof(atomic_ulong));
+    job->stats.keys = calloc(num_parts, sizeof(atomic_ulong));
+#endif
+}
+
+// Reads a request written by put_remote_task into a worker's job and the
+// split to map; a whole-file task gets a split covering nothing but the
+// file name. Returns false for a malformed request
+static bool get_remote_task(Remote_reader_t *reader, MR_Job *job, uint64_t *task_idx, MR_Split *split) {
+    uint64_t num_parts, combine_limit, emit_batch, mapper, split_mapper, combiner, len;
+    uint64_t offset = 0, length = 0;
+    if (!Remote_get_varint(reader, task_idx) || !Remote_get_varint(reader, &num_parts) ||
+        !Remote_get_varint(reader, &combine_limit) || !Remote_get_varint(reader, &emit_batch) ||
+        !Remote_get_varint(reader, &mapper) || !Remote_get_varint(reader, &split_mapper) ||
+        !Remote_get_varint(reader, &combiner) || !Remote_get_varint(reader, &len) || len == 0 ||
+        !(split->file_name = (char *)Remote_get_bytes(reader, len)) || split->file_name[len - 1] != '\0') {
+        return false;
+    }
+    if (split_mapper && (!Remote_get_varint(reader, &offset) || !Remote_get_varint(reader, &length))) {
+        return false;
+    }
+    split->offset = (long)offset;
+    split->length = (long)length;
+    if (num_parts == 0 || (!mapper && !split_mapper)) {
+        return false;
+    }
+    if (num_parts != job->num_partitions) {
+        size_worker_job(job, (unsigned int)num_parts);
+    }
+    job->combine_limit = (unsigned int)combine_limit;
+    job->emit_batch = (unsigned int)emit_batch;
+    job->mapper = (Mapper)(uintptr_t)mapper;
+    job->split_mapper = (SplitMapper)(uintptr_t)split_mapper;
+    job->combiner = (Combiner)(uintptr_t)combiner;
+    return true;
+}
+
+// Body of a worker process in a distributed map phase. Workers are forked
+// before the context's pool starts and know nothing of the jobs run later,
+// so each request carries what mapping its task needs. The worker maps it
+// into partitions of its own, then sends their contents back grouped by
+// partition and empties them. Nothing is spilled here; the coordinator
+// applies the memory budget as it merges
+static void serve_map_tasks(int fd, void *arg) {
+    (void)arg;
+    MR_Context context;
+    memset(&context, 0, sizeof(context));
+    MR_Job job;
+    memset(&job, 0, sizeof(job));
+    job.context = &context;
+    atomic_init(&job.flushes, 0);
+    atomic_init(&job.lock_acquisitions, 0);
+    atomic_init(&job.lock_waits, 0);
+    Remote_buffer_t request = {0}, reply = {0};
+    while (Remote_recv(fd, &request)) {
+        Remote_reader_t reader = {request.bytes, request.bytes + request.len};
+        uint64_t task_idx;
+        MR_Split split;
+        if (!get_remote_task(&reader, &job, &task_idx, &split)) {
+            break;
+        }
+        current_job = &job;
+        if (job.split_mapper) {
+            job.split_mapper(&split);
+        } else {
+            job.mapper(split.file_name);
+        }
+        finish_map_task(&job);
+        current_job = NULL;
+
+        // The reply names the task, then lists each non-empty partition's
+        // index and pairs: key, integer values, string values
+        reply.len = 0;
+        Remote_put_varint(&reply, task_idx);
+        for (unsigned int p = 0; p < job.num_partitions; p++) {
+            Partition *partition = &job.partitions[p];
+            if (partition->pair_count == 0) {
+                continue;
+            }
+            Remote_put_varint(&reply, p);
+            Remote_put_varint(&reply, partition->pair_count);
+            for (unsigned int i = 0; i < partition->pair_count; i++) {
+                KeyValuePair *pair = &partition->pairs[i];
+                Remote_put_varint(&reply, pair->key_len);
+                Remote_put_bytes(&reply, pair->key, pair->key_len);
+                Remote_put_varint(&reply, pair->int_count);
+                for (unsigned int j = 0; j < pair->int_count; j++) {
+                    Remote_put_int(&reply, pair->int_values[j]);
+                }
+                Remote_put_varint(&reply, pair->value_count);
+                for (unsigned int j = 0; j < pair->value_count; j++) {
+                    size_t len = strlen(pair->values[j]) + 1;
+                    Remote_put_varint(&reply, len);
+                    Remote_put_bytes(&reply, pair->values[j], len);
+                }
+            }
+            reset_partition(partition);
+        }
+        fflush(NULL);
+        if (!Remote_send(fd, &reply)) {
+            break;
+        }
+    }
+    free(request.bytes);
+    free(reply.bytes);
+}
+
+// Decodes one pair of a worker's reply into a locked partition. String
+// values are sent with their terminating NUL, so they are used in place
+static bool merge_remote_pair(MR_Job *job, Partition *partition, Remote_reader_t *reader) {
+    uint64_t key_len, count, len;
+    const char *key, *value;
+    if (!Remote_get_varint(reader, &key_len) || !(key = Remote_get_bytes(reader, key_len)) ||
+        !Remote_get_varint(reader, &count)) {
+        return false;
+    }
+    KeyValuePair *pair = find_or_insert_pair(partition, key, key_len, hash_key(key, key_len));
+    for (uint64_t i = 0; i < count; i++) {
+        int64_t int_value;
+        if (!Remote_get_int(reader, &int_value)) {
+            return false;
+        }
+        append_int_value(partition, pair, int_value, job->combiner);
+    }
+    if (!Remote_get_varint(reader, &count)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        if (!Remote_get_varint(reader, &len) || !(value = Remote_get_bytes(reader, len))) {
+            return false;
+        }
+        append_string_value(partition, pair, value);
+    }
+    return true;
+}
+
+// Checks that a worker's reply decodes whole before any of it is merged:
+// the index of the task it was given, then pairs of partitions below
+// num_parts, with string values ending in their NUL, and nothing after them
+static bool check_remote_reply(const Remote_buffer_t *reply, unsigned int task_idx, unsigned int num_parts) {
+    Remote_reader_t reader = {reply->bytes, reply->bytes + reply->len};
+    uint64_t replied_idx, p, pair_count, len, count;
+    const char *value;
+    int64_t int_value;
+    if (!Remote_get_varint(&reader, &replied_idx) || replied_idx != task_idx) {
+        return false;
+    }
+    while (reader.pos < reader.end) {
+        if (!Remote_get_varint(&reader, &p) || p >= num_parts || !Remote_get_varint(&reader, &pair_count)) {
+            return false;
+        }
+        for (uint64_t i = 0; i < pair_count; i++) {
+            if (!Remote_get_varint(&reader, &len) || !Remote_get_bytes(&reader, len) ||
+                !Remote_get_varint(&reader, &count)) {
+                return false;
+            }
+            for (uint64_t j = 0; j < count; j++) {
+                if (!Remote_get_int(&reader, &int_value)) {
+                    return false;
+                }
+            }
+            if (!Remote_get_varint(&reader, &count)) {
+                return false;
+            }
+            for (uint64_t j = 0; j < count; j++) {
+                if (!Remote_get_varint(&reader, &len) || len == 0 || !(value = Remote_get_bytes(&reader, len)) ||
+                    value[len - 1] != '\0') {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Pool task merging a worker's reply, already checked by
+// check_remote_reply, into the partitions, taking each partition's lock once
+static void merge_remote_task(void *arg) {
+    Task *task = arg;
+    MR_Job *job = task->job;
+    Remote_buffer_t *reply = task->input;
+    Remote_reader_t reader = {reply->bytes, reply->bytes + reply->len};
+    uint64_t task_idx, p, pair_count;
+    bool decoded = Remote_get_varint(&reader, &task_idx);
+    while (decoded && Remote_get_varint(&reader, &p) && Remote_get_varint(&reader, &pair_count)) {
+        Partition *partition = &job->partitions[p];
+        uint64_t locked_at = lock_partition(job, partition);
+        for (uint64_t i = 0; i < pair_count && decoded; i++) {
+            decoded = merge_remote_pair(job, partition, &reader);
+        }
+        Run *spilled = detach_if_over_budget(job, partition);
+        unlock_partition(job, partition, locked_at);
+        spill_detached(job, (unsigned int)p, spilled);
+    }
+    free(reply->bytes);
+    free(reply);
+    finish_task(job);
+}
+
+// Orders map tasks by size, smallest first
+static int compare_task_sizes(const void *a, const void *b) {
+    const long *x = a, *y = b;
+    if (x[0] != y[0]) {
+        return x[0] < y[0] ? -1 : 1;
+    }
+    return x[1] < y[1] ? -1 : x[1] > y[1];
+}
+
+// Returns the indexes of the map tasks in the order schedule would run
+// them, for stages that hand tasks out themselves
+static unsigned int *order_tasks(long *task_sizes, unsigned int task_count, ThreadPool_policy_t schedule) {
+    long (*sorted)[2] = malloc((task_count + 1) * sizeof(*sorted));
+    for (unsigned int i = 0; i < task_count; i++) {
+        sorted[i][0] = schedule == TP_POLICY_FIFO ? 0 : task_sizes[i];
+        sorted[i][1] = i;
+    }
+    qsort(sorted, task_count, sizeof(*sorted), compare_task_sizes);
+    unsigned int *order = malloc((task_count + 1) * sizeof(unsigned int));
+    for (unsigned int i = 0; i < task_count; i++) {
+        order[i] = (unsigned int)sorted[schedule == TP_POLICY_LJF ? task_count - 1 - i : i][1];
+    }
+    free(sorted);
+    return order;
+}
+
+// Runs the map tasks on a context's worker processes, one task per worker
+// at a time, in the order of schedule. Replies are merged by pool tasks
+// while the calling thread hands out the next tasks. The task of a worker
+// that dies or sends a reply that does not decode is handed out again,
+// unless it has taken down MAX_TASK_ATTEMPTS workers, which fails the run.
+// Once no worker is left the rest are mapped by local_func on the pool.
+// Returns once every reply has been merged
+static void map_remotely(MR_Job *job, Remote_group_t *group, Task *tasks, void **task_args,
+                         long *task_sizes, unsigned int task_count, thread_func_t local_func,
+                         ThreadPool_policy_t schedule, MR_WorkerStats *stats) {
+    // Tasks are handed out from order[next..], after any waiting in retry
+    unsigned int *order = order_tasks(task_sizes, task_count, schedule);
+    unsigned int *retry = malloc((task_count + 1) * sizeof(unsigned int));
+    unsigned char *attempts = calloc(task_count + 1, 1);
+    unsigned int next = 0, retry_count = 0;
+
+    stats->workers = group->alive;
+    unsigned int *assigned = malloc((group->count + 1) * sizeof(unsigned int));
+    for (unsigned int w = 0; w < group->count; w++) {
+        assigned[w] = UINT_MAX;
+    }
+    Task *merges = malloc((task_count + 1) * sizeof(Task));
+    Remote_buffer_t request = {0};
+    unsigned int running = 0;
+
+    while (true) {
+        // Give every idle worker a task
+        for (unsigned int w = 0; w < group->count; w++) {
+            if (group->workers[w].fd < 0 || assigned[w] != UINT_MAX) {
+                continue;
+            }
+            if (retry_count == 0 && next == task_count) {
+                break;
+            }
+            unsigned int task_idx = retry_count > 0 ? retry[--retry_count] : order[next++];
+            put_remote_task(&request, job, &tasks[task_idx], task_idx);
+            if (!Remote_send(group->workers[w].fd, &request)) {
+                // The worker never got the task, so it does not count as an attempt
+                Remote_lose(group, w);
+                stats->lost++;
+                retry[retry_count++] = task_idx;
+                continue;
+            }
+            assigned[w] = task_idx;
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        int w = Remote_poll(group);
+        if (w < 0) {
+            // No reply can be waited for, so drop the workers still mapping,
+            // which could otherwise hand a stale reply to a later job, and
+            // map their tasks here
+            for (unsigned int v = 0; v < group->count; v++) {
+                if (assigned[v] != UINT_MAX) {
+                    retry[retry_count++] = assigned[v];
+                    assigned[v] = UINT_MAX;
+                    Remote_lose(group, v);
+                    stats->lost++;
+                }
+            }
+            break;
+        }
+        unsigned int task_idx = assigned[w];
+        Remote_buffer_t *reply = calloc(1, sizeof(Remote_buffer_t));
+        bool received = task_idx != UINT_MAX && Remote_recv(group->workers[w].fd, reply) &&
+                        check_remote_reply(reply, task_idx, job->num_partitions);
+        if (!received) {
+            // The worker died, before or while sending its reply, or sent
+            // one that does not decode
+            free(reply->bytes);
+            free(reply);
+            Remote_lose(group, (unsigned int)w);
+            stats->lost++;
+            if (task_idx == UINT_MAX) {
+                continue;
+            }
+            assigned[w] = UINT_MAX;
+            running--;
+            if (++attempts[task_idx] >= MAX_TASK_ATTEMPTS) {
+                fprintf(stderr, "[MR_Run] Giving up on map task %u after %u lost workers\n", task_idx,
+                        MAX_TASK_ATTEMPTS);
+                stats->abandoned++;
+                stats->failed = true;
+            } else {
+                retry[retry_count++] = task_idx;
+                stats->retried++;
+            }
+            continue;
+        }
+        assigned[w] = UINT_MAX;
+        running--;
+        stats->remote++;
+        merges[task_idx].job = job;
+        merges[task_idx].input = reply;
+        merges[task_idx].partition_idx = 0;
+        merges[task_idx].input_idx = tasks[task_idx].input_idx;
+        void *merge_arg = &merges[task_idx];
+        long merge_size = (long)reply->len;
+        submit_tasks(job, merge_remote_task, &merge_arg, &merge_size, 1);
+    }
+
+    // Whatever is left once no worker is alive is mapped here
+    void **local_args = malloc((task_count + 1) * sizeof(void *));
+    long *local_sizes = malloc((task_count + 1) * sizeof(long));
+    while (retry_count > 0 || next < task_count) {
+        unsigned int task_idx = retry_count > 0 ? retry[--retry_count] : order[next++];
+        local_args[stats->local] = task_args[task_idx];
+        local_sizes[stats->local] = task_sizes[task_idx];
+        stats->local++;
+    }
+    submit_tasks(job, local_func, local_args, local_sizes, stats->local);
+    wait_for_tasks(job);
+
+    free(local_args);
+    free(local_sizes);
+    free(request.bytes);
+    free(merges);
+    free(assigned);
+    free(attempts);
+    free(retry);
+    free(order);
+}
+
+// Map task for a split the I/O stage has read. MR_OpenInput serves the
+// split from the buffer, which goes back to the stage before the task ends
+static void prefetched_map_task(void *arg) {
+    PrefetchBuffer *buffer = arg;
+    Prefetch *prefetch = buffer->prefetch;
+    MR_Job *job = buffer->task.job;
+    MR_Job *previous = current_job;
+    InputCapture *previous_capture = current_capture;
+    PrefetchBuffer *previous_prefetch = current_prefetch;
+    current_job = job;
+    current_input = buffer->task.input_idx;
+    current_capture = job->captures ? &job->captures[buffer->task.input_idx] : NULL;
+    current_prefetch = buffer;
+    job->split_mapper((MR_Split *)buffer->task.input);
+    finish_map_task(job);
+    current_prefetch = previous_prefetch;
+    current_capture = previous_capture;
+    current_job = previous;
+
+    // Every reader may be waiting, including ones that will find no split left
+    pthread_mutex_lock(&prefetch->lock);
+    prefetch->free_buffers[prefetch->free_count++] = (unsigned int)(buffer - prefetch->buffers);
+    pthread_cond_broadcast(&prefetch->buffer_free);
+    pthread_mutex_unlock(&prefetch->lock);
+    finish_task(job);
+}
+
+// Reads a split into a buffer with pread, hinting sequential access. A
+// short read leaves length below the split's, and MR_OpenInput then maps
+// the split itself
+static void read_split(PrefetchBuffer *buffer) {
+    MR_Split *split = buffer->task.input;
+    size_t length = (size_t)split->length;
+    buffer->length = 0;
+    if (buffer->capacity < length) {
+        free(buffer->data);
+        buffer->data = malloc(length);
+        buffer->capacity = length;
+    }
+    int fd = open(split->file_name, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    posix_fadvise(fd, split->offset, split->length, POSIX_FADV_SEQUENTIAL);
+    while (buffer->length < length) {
+        ssize_t got = pread(fd, buffer->data + buffer->length, length - buffer->length,
+                            split->offset + (off_t)buffer->length);
+        if (got <= 0) {
+            break;
+        }
+        buffer->length += (size_t)got;
+    }
+    close(fd);
+}
+
+// Reader thread of the I/O stage: takes the next split once a buffer is
+// free, reads it and submits its map task to the pool
+static void *prefetch_reader(void *arg) {
+    Prefetch *prefetch = arg;
+    pthread_mutex_lock(&prefetch->lock);
+    while (prefetch->next < prefetch->count) {
+        // Backpressure: wait for a map task to hand a buffer back
+        if (prefetch->free_count == 0) {
+            uint64_t started = stats_now_ns();
+            pthread_cond_wait(&prefetch->buffer_free, &prefetch->lock);
+            atomic_fetch_add_explicit(&prefetch->wait_ns, stats_now_ns() - started, memory_order_relaxed);
+            continue;
+        }
+        PrefetchBuffer *buffer = &prefetch->buffers[prefetch->free_buffers[--prefetch->free_count]];
+        buffer->task = prefetch->tasks[prefetch->order[prefetch->next++]];
+        pthread_mutex_unlock(&prefetch->lock);
+
+        uint64_t started = stats_now_ns();
+        read_split(buffer);
+        atomic_fetch_add_explicit(&prefetch->read_ns, stats_now_ns() - started, memory_order_relaxed);
+        atomic_fetch_add_explicit(&prefetch->bytes_read, buffer->length, memory_order_relaxed);
+        void *task_arg = buffer;
+        long task_size = ((MR_Split *)buffer->task.input)->length;
+        submit_tasks(prefetch->job, prefetched_map_task, &task_arg, &task_size, 1);
+        pthread_mutex_lock(&prefetch->lock);
+    }
+    pthread_mutex_unlock(&prefetch->lock);
+    return NULL;
+}
+
+// Runs the split tasks behind an I/O stage of io_threads reader threads
+// sharing io_buffers buffers, so mappers compute on bytes already in memory
+// while the readers wait on the disk. Returns once every split is mapped
+static void map_prefetched(MR_Job *job, Task *tasks, long *task_sizes, unsigned int task_count,
+                           unsigned int io_threads, unsigned int io_buffers,
+                           ThreadPool_policy_t schedule, MR_IOStats *stats) {
+    Prefetch prefetch;
+    prefetch.job = job;
+    prefetch.tasks = tasks;
+    prefetch.order = order_tasks(task_sizes, task_count, schedule);
+    prefetch.count = task_count;
+    prefetch.next = 0;
+    prefetch.buffer_count = io_buffers;
+    prefetch.buffers = calloc(io_buffers, sizeof(PrefetchBuffer));
+    prefetch.free_buffers = malloc(io_buffers * sizeof(unsigned int));
+    for (unsigned int i = 0; i < io_buffers; i++) {
+        prefetch.buffers[i].prefetch = &prefetch;
+        prefetch.free_buffers[i] = io_buffers - 1 - i;
+    }
+    prefetch.free_count = io_buffers;
+    pthread_mutex_init(&prefetch.lock, NULL);
+    pthread_cond_init(&prefetch.buffer_free, NULL);
+    atomic_init(&prefetch.bytes_read, 0);
+    atomic_init(&prefetch.read_ns, 0);
+    atomic_init(&prefetch.wait_ns, 0);
+
+    // Every map task is submitted once the readers are done
+    pthread_t *readers = malloc(io_threads * sizeof(pthread_t));
+    for (unsigned int i = 0; i < io_threads; i++) {
+        pthread_create(&readers[i], NULL, prefetch_reader, &prefetch);
+    }
+    for (unsigned int i = 0; i < io_threads; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    wait_for_tasks(job);
+
+    stats->threads = io_threads;
+    stats->buffers = io_buffers;
+    stats->bytes_read = atomic_load(&prefetch.bytes_read);
+    stats->read_seconds = atomic_load(&prefetch.read_ns) / 1e9;
+    stats->buffer_wait_seconds = atomic_load(&prefetch.wait_ns) / 1e9;
+    for (unsigned int i = 0; i < io_buffers; i++) {
+        free(prefetch.buffers[i].data);
+    }
+    free(readers);
+    free(prefetch.buffers);
+    free(prefetch.free_buffers);
+    free(prefetch.order);
+    pthread_mutex_destroy(&prefetch.lock);
+    pthread_cond_destroy(&prefetch.buffer_free);
+}
+
+// Moves a split boundary forward until it directly follows whitespace, so
+// the token it would cut belongs entirely to the earlier split
+static long align_split_boundary(int fd, long boundary, long file_size) {
+    char buffer[4096];
+    while (boundary < file_size) {
+        ssize_t got = pread(fd, buffer, sizeof(buffer), boundary - 1);
+        if (got <= 0) {
+            return file_size;
+        }
+        for (ssize_t i = 0; i < got; i++) {
+            char c = buffer[i];
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                return boundary + i;
+            }
+        }
+        boundary += got;
+    }
+    return file_size;
+}
+
+// Cuts every input file into whitespace-aligned splits of about split_size
+// bytes. Returns the number of splits stored in *splits_out
+static unsigned int make_splits(unsigned int file_count, char *file_names[], long split_size,
+                                MR_Split **splits_out) {
+    unsigned int count = 0, capacity = file_count > 0 ? file_count : 1;
+    MR_Split *splits = malloc(capacity * sizeof(MR_Split));
+
+    for (unsigned int i = 0; i < file_count; i++) {
+        int fd = open(file_names[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "[MR_Run] Cannot open %s\n", file_names[i]);
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+
+        long file_size = (long)st.st_size;
+        long start = 0;
+        while (start < file_size) {
+            long end = start + split_size < file_size ? start + split_size : file_size;
+            end = align_split_boundary(fd, end, file_size);
+            if (count == capacity) {
+                capacity *= 2;
+                splits = realloc(splits, capacity * sizeof(MR_Split));
+            }
+            splits[count].file_name = file_names[i];
+            splits[count].offset = start;
+            splits[count].length = end - start;
+            count++;
+            start = end;
+        }
+        close(fd);
+    }
+
+    *splits_out = splits;
+    return count;
+}
+
+// Maps the bytes of a split into memory for reading, or points at the copy
+// the I/O stage read
+bool MR_OpenInput(MR_Split *split, MR_Input *input) {
+    input->data = NULL;
+    input->length = 0;
+    input->map_base = NULL;
+    input->map_length = 0;
+    if (split->length <= 0) {
+        return true;
+    }
+
+    // A split the I/O stage read ahead is served from its buffer, unless
+    // the read came up short
+    PrefetchBuffer *prefetched = current_prefetch;
+    if (prefetched && prefetched->task.input == split && prefetched->length == (size_t)split->length) {
+        input->data = prefetched->data;
+        input->length = prefetched->length;
+    } else {
+        int fd = open(split->file_name, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        // mmap offsets must be page aligned, so map from the page holding the
+        // split's first byte and point data past the leading slack
+        long page_size = sysconf(_SC_PAGESIZE);
+        long map_offset = split->offset - split->offset % page_size;
+        size_t map_length = (size_t)(split->offset - map_offset + split->length);
+        void *base = mmap(NULL, map_length, PROT_READ, MAP_PRIVATE, fd, map_offset);
+        close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        madvise(base, map_length, MADV_SEQUENTIAL);
+
+        input->data = (const char *)base + (split->offset - map_offset);
+        input->length = (size_t)split->length;
+        input->map_base = base;
+        input->map_length = map_length;
+    }
+#ifdef MR_ENABLE_STATS
+    MR_Job *job = current_job;
+    if (job && current_input < job->stats.input_count) {
+        atomic_fetch_add_explicit(&job->stats.input_bytes[current_input], input->length,
+                                  memory_order_relaxed);
+    }
+#endif
+    return true;
+}
+
+// Unmaps an input opened with MR_OpenInput
+void MR_CloseInput(MR_Input *input) {
+    if (input->map_base) {
+        munmap(input->map_base, input->map_length);
+    }
+    input->data = NULL;
+    input->length = 0;
+    input->map_base = NULL;
+    input->map_length = 0;
+}
+
+// Hash function to determine which partition a key should be placed in
+unsigned int MR_Partitioner(char *key, unsigned int num_partitions) {
+    return hash_key(key, strlen(key)) % num_partitions;
+}
+
+// Returns the calling worker's sketch, creating it on first use. Pool
+// threads each own a slot and never lock; any other thread shares the last
+// slot under sketch_lock, which it must release after the update
+static Sketch_t *get_sketch(MR_Job *job, bool *locked) {
+    ThreadPool_t *pool = job->context->pool;
+    int worker = ThreadPool_worker_index(pool);
+    *locked = worker < 0;
+    if (worker < 0) {
+        worker = pool->num_threads;
+        pthread_mutex_lock(&job->sketch_lock);
+    }
+    if (!job->sketches[worker]) {
+        unsigned int capacity = job->heavy_hitters * SKETCH_SLACK;
+        if (capacity < SKETCH_MIN_CAPACITY) {
+            capacity = SKETCH_MIN_CAPACITY;
+        }
+        job->sketches[worker] = Sketch_create(capacity, job->sketch_error);
+    }
+    return job->sketches[worker];
+}
+
+// Counts a key in the calling worker's sketch instead of a partition
+static void sketch_emit(MR_Job *job, const char *key, size_t len, uint64_t count) {
+    bool locked;
+    Sketch_add(get_sketch(job, &locked), key, len, count);
+    if (locked) {
+        pthread_mutex_unlock(&job->sketch_lock);
+    }
+}
+
+// Merges the workers' sketches once the map phase is over and stores the
+// heavy hitters in the partitions as one integer value per key, so the
+// reduce phase and output modes run on them unchanged
+static void finish_sketches(MR_Job *job) {
+    unsigned int slots = job->context->pool->num_threads + 1;
+    Sketch_t **sketches = malloc(slots * sizeof(Sketch_t *));
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < slots; i++) {
+        if (job->sketches[i]) {
+            sketches[count++] = job->sketches[i];
+        }
+    }
+    Sketch_item_t *items = malloc(job->heavy_hitters * sizeof(Sketch_item_t));
+    unsigned int found = Sketch_top(sketches, count, items, job->heavy_hitters);
+    for (unsigned int i = 0; i < found; i++) {
+        char *key = (char *)items[i].key;
+        insert_int_into_partition(job, MR_Partitioner(key, job->num_partitions), key,
+                                  (int64_t)items[i].count);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        Sketch_destroy(sketches[i]);
+    }
+    free(items);
+    free(sketches);
+    free(job->sketches);
+    job->sketches = NULL;
+}
+
+#ifdef MR_ENABLE_STATS
+// Counts an emit routed to partition p in the calling worker's slot
+static void count_emit(MR_Job *job, unsigned int p) {
+    int worker = ThreadPool_worker_index(job->context->pool);
+    unsigned int slot = worker >= 0 ? (unsigned int)worker : job->stats.slots - 1;
+    atomic_fetch_add_explicit(&job->stats.emits[slot * job->num_partitions + p], 1, memory_order_relaxed);
+}
+
+// Counts keys handed to the reducer of partition p
+static void count_keys(MR_Job *job, unsigned int p, unsigned long keys) {
+    atomic_fetch_add_explicit(&job->stats.keys[p], keys, memory_order_relaxed);
+}
+#else
+#define count_emit(job, p) ((void)0)
+#define count_keys(job, p, keys) ((void)(keys))
+#endif
+
+// Reports a call that needs the job of the task the calling thread runs
+// from a thread that runs none, such as a helper thread a mapper started.
+// The call cannot tell which job it belongs to, so its data is dropped;
+// only the first such call is reported
+static void report_outside_task(const char *function) {
+    static atomic_bool reported = false;
+    if (!atomic_exchange(&reported, true)) {
+        fprintf(stderr, "[%s] Called outside a map or reduce task; its data is dropped "
+                        "(later calls are not reported)\n", function);
+    }
+}
+
+// Emit function called by the Mapper to add a key-value pair to a partition
+void MR_Emit(char *key, char *value) {
+    MR_Job *job = current_job;
+    if (!job) {
+        report_outside_task("MR_Emit");
+        return;
+    }
+    if (key == NULL || key[0] == '\0') {
+        // printf("[MR_Emit] Skipping empty key.\n");
+        return;
+    }
+    if (job->sketches) {
+        sketch_emit(job, key, strlen(key), 1);
+        return;
+    }
+    if (current_capture) {
+        pthread_mutex_lock(&current_capture->lock);
+        current_capture->uncacheable = true;
+        pthread_mutex_unlock(&current_capture->lock);
+    }
+    // Determine the partition index for the key
+    unsigned int partition_idx = MR_Partitioner(key, job->num_partitions);
+    // printf("[MR_Emit] Key: %s, Value: %s, Partition: %u\n", key, value, partition_idx);
+    count_emit(job, partition_idx);
+    if (job->pipeline) {
+        size_t len = strlen(key);
+        Partition *local = &get_local_store(job)->parts[partition_idx];
+        insert_string_locked(local, key, len, hash_key(key, len), value);
+        if (local->pair_count >= job->combine_limit) {
+            publish_run(job, partition_idx, local);
+        }
+        return;
+    }
+    if (job->emit_batch > 1) {
+        size_t len = strlen(key);
+        stage_emit(job, key, len, hash_key(key, len), value, 0);
+        return;
+    }
+    insert_into_partition(job, partition_idx, key, value);
+}
+
+// Emit function for integer values; avoids the string copies of MR_Emit
+void MR_EmitInt(char *key, int64_t value) {
+    if (key == NULL) {
+        return;
+    }
+    MR_EmitIntSlice(key, strlen(key), value);
+}
+
+// Emits an integer value for a key given as a non-owning slice; the bytes
+// are only copied once a partition (or combine table) interns the key
+void MR_EmitIntSlice(const char *key, size_t key_len, int64_t value) {
+    MR_Job *job = current_job;
+    if (!job) {
+        report_outside_task("MR_EmitIntSlice");
+        return;
+    }
+    if (key == NULL || key_len == 0) {
+        return;
+    }
+    if (job->sketches) {
+        if (value > 0) {
+            sketch_emit(job, key, key_len, (uint64_t)value);
+        }
+        return;
+    }
+    unsigned long hash = hash_key(key, key_len);
+    count_emit(job, hash % job->num_partitions);
+    if (job->pipeline) {
+        insert_int_local(job, key, key_len, hash, value);
+        return;
+    }
+    if (job->combiner) {
+        combine_locally(job, key, key_len, hash, value);
+        return;
+    }
+    if (job->emit_batch > 1) {
+        stage_emit(job, key, key_len, hash, NULL, value);
+        return;
+    }
+    unsigned int partition_idx = hash % job->num_partitions;
+    Partition *partition = &job->partitions[partition_idx];
+    uint64_t locked_at = lock_partition(job, partition);
+    insert_int_locked(partition, key, key_len, hash, value, NULL);
+    Run *spilled = detach_if_over_budget(job, partition);
+    unlock_partition(job, partition, locked_at);
+    spill_detached(job, partition_idx, spilled);
+}
+
+// Finds the pair being reduced in a locked partition. The reducer normally
+// asks for the key it is currently being called with, so resume at that
+// pair and only fall back to the index, or the key's ID, otherwise
+static KeyValuePair *current_pair(MR_Job *job, unsigned int partition_idx, char *key) {
+    Partition *partition = &job->partitions[partition_idx];
+    if (partition->current &&
+        (partition->current->key == key || strcmp(partition->current->key, key) == 0)) {
+        return partition->current;
+    }
+    size_t len = strlen(key);
+    unsigned long hash = hash_key(key, len);
+    if (partition->dictionary) {
+        // Only the tags of this partition's keys point into its pairs
+        if (hash % job->num_partitions != partition_idx) {
+            return NULL;
+        }
+        uint32_t id = Intern_find(partition->dictionary, key, len, hash);
+        if (id == INTERN_NONE) {
+            return NULL;
+        }
+        uint32_t tag = *Intern_tag(Intern_key(partition->dictionary, id, &len));
+        return tag ? &partition->pairs[tag - 1] : NULL;
+    }
+    unsigned int slot = find_slot(partition, key, len, hash);
+    if (partition->index[slot] != 0) {
+        return &partition->pairs[partition->index[slot] - 1];
+    }
+    return NULL;
+}
+
+// Retrieves the next value associated with a key from a partition
+char *MR_GetNext(char *key, unsigned int partition_idx) {
+    MR_Job *job = current_job;
+    if (!job) {
+        report_outside_task("MR_GetNext");
+        return NULL;
+    }
+    if (partition_idx >= job->num_partitions || !key) {
+        // fprintf(stderr, "[MR_GetNext] Invalid partition index or null key.\n");
+        return NULL;
+    }
+
+    // A key range owns its pairs, so no lock is needed; it only serves the
+    // key being reduced
+    ReduceRange *range = current_range;
+    if (range && range->job == job && range->partition_idx == partition_idx) {
+        KeyValuePair *pair = range->pair;
+        if (pair && (pair->key == key || strcmp(pair->key, key) == 0) && pair->value_count > 0) {
+            return strdup(pair->values[--pair->value_count]);
+        }
+        return NULL;
+    }
+
+    Partition *partition = &job->partitions[partition_idx];
+    pthread_mutex_lock(&partition->lock);
+
+    char *value = NULL;
+    KeyValuePair *pair = current_pair(job, partition_idx, key);
+    if (pair && pair->value_count > 0) {
+        value = strdup(pair->values[--pair->value_count]);
+    }
+
+    pthread_mutex_unlock(&partition->lock);
+    return value;
+}
+
+// Retrieves the next integer value associated with a key from a partition
+bool MR_GetNextInt(char *key, unsigned int partition_idx, int64_t *value) {
+    MR_Job *job = current_job;
+    if (!job) {
+        report_outside_task("MR_GetNextInt");
+        return false;
+    }
+    if (partition_idx >= job->num_partitions || !key || !value) {
+        return false;
+    }
+
+    ReduceRange *range = current_range;
+    if (range && range->job == job && range->partition_idx == partition_idx) {
+        KeyValuePair *pair = range->pair;
+        if (pair && (pair->key == key || strcmp(pair->key, key) == 0) && pair->int_count > 0) {
+            *value = pair->int_values[--pair->int_count];
+            return true;
+        }
+        return false;
+    }
+
+    Partition *partition = &job->partitions[partition_idx];
+    pthread_mutex_lock(&partition->lock);
+
+    bool found = false;
+    KeyValuePair *pair = current_pair(job, partition_idx, key);
+    if (pair && pair->int_count > 0) {
+        *value = pair->int_values[--pair->int_count];
+        found = true;
+    }
+
+    pthread_mutex_unlock(&partition->lock);
+    return found;
+}
+
+// Whether entry a ranks below entry b: a smaller value, or an equal value
+// with a larger key
+static bool ranks_below(const TopEntry *a, const TopEntry *b) {
+    if (a->value != b->value) {
+        return a->value < b->value;
+    }
+    return strcmp(a->key, b->key) > 0;
+}
+
+static void top_sift_down(TopEntry *heap, unsigned int count, unsigned int i) {
+    while (1) {
+        unsigned int lowest = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && ranks_below(&heap[left], &heap[lowest])) {
+            lowest = left;
+        }
+        if (right < count && ranks_below(&heap[right], &heap[lowest])) {
+            lowest = right;
+        }
+        if (lowest == i) {
+            return;
+        }
+        TopEntry tmp = heap[i];
+        heap[i] = heap[lowest];
+        heap[lowest] = tmp;
+        i = lowest;
+    }
+}
+
+// Offers an output to a partition's bounded min-heap of its top_k entries.
+// The lowest-ranked entry sits at the root, so a full heap only admits
+// outputs that beat it
+static void top_push(TopHeap *heap, unsigned int top_k, const char *key, int64_t value) {
+    TopEntry entry = {(char *)key, value};
+    if (heap->count == top_k) {
+        if (!ranks_below(&heap->entries[0], &entry)) {
+            return;
+        }
+        free(heap->entries[0].key);
+        heap->entries[0].key = strdup(key);
+        heap->entries[0].value = value;
+        top_sift_down(heap->entries, heap->count, 0);
+        return;
+    }
+
+    // Sift the new entry up from the bottom
+    if (!heap->entries) {
+        heap->entries = malloc(top_k * sizeof(TopEntry));
+    }
+    unsigned int i = heap->count++;
+    while (i > 0 && ranks_below(&entry, &heap->entries[(i - 1) / 2])) {
+        heap->entries[i] = heap->entries[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->entries[i].key = strdup(key);
+    heap->entries[i].value = value;
+}
+
+static int compare_top_entries(const void *a, const void *b) {
+    const TopEntry *entryA = a;
+    const TopEntry *entryB = b;
+    if (ranks_below(entryA, entryB)) {
+        return 1;
+    }
+    return ranks_below(entryB, entryA) ? -1 : 0;
+}
+
+// Merges the per-partition heaps and writes the overall top_k entries,
+// highest first, to output_dir/top.txt
+static void write_top(MR_Job *job) {
+    unsigned int total = 0;
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        total += job->tops[p].count;
+    }
+    TopEntry *all = malloc((total + 1) * sizeof(TopEntry));
+    unsigned int count = 0;
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        memcpy(all + count, job->tops[p].entries, job->tops[p].count * sizeof(TopEntry));
+        count += job->tops[p].count;
+        free(job->tops[p].entries);
+    }
+    qsort(all, count, sizeof(TopEntry), compare_top_entries);
+
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/top.txt", job->output_dir);
+    FILE *file = fopen(name, "w");
+    if (!file) {
+        perror(name);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        if (file && i < job->top_k) {
+            fprintf(file, "%s: %lld\n", all[i].key, (long long)all[i].value);
+        }
+        free(all[i].key);
+    }
+    if (file) {
+        fclose(file);
+    }
+    free(all);
+}
+
+// Defines one step of the output merge tree: sorted "key: value" files
+// merged into a single sorted file
+typedef struct {
+    char *inputs[MERGE_FANIN];
+    unsigned int count;
+    char *output;
+} FileMerge;
+
+// Defines the current line of one merge input; key_len covers the text
+// before the last ": ", since values never contain one
+typedef struct {
+    FILE *file;
+    char *line;
+    size_t capacity;
+    ssize_t length;
+    size_t key_len;
+} MergeInput;
+
+static bool read_merge_line(MergeInput *input) {
+    input->length = getline(&input->line, &input->capacity, input->file);
+    if (input->length < 0) {
+        return false;
+    }
+    input->key_len = (size_t)input->length;
+    for (ssize_t i = input->length - 2; i >= 0; i--) {
+        if (input->line[i] == ':' && input->line[i + 1] == ' ') {
+            input->key_len = (size_t)i;
+            break;
+        }
+    }
+    return true;
+}
+
+static int compare_merge_keys(const MergeInput *a, const MergeInput *b) {
+    size_t len = a->key_len < b->key_len ? a->key_len : b->key_len;
+    int cmp = memcmp(a->line, b->line, len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+}
+
+// Merges a few sorted files into one, then removes the inputs
+static void merge_files(FileMerge *merge) {
+    MergeInput inputs[MERGE_FANIN];
+    unsigned int live = 0;
+    for (unsigned int i = 0; i < merge->count; i++) {
+        MergeInput *input = &inputs[live];
+        input->file = fopen(merge->inputs[i], "r");
+        input->line = NULL;
+        input->capacity = 0;
+        if (!input->file) {
+            perror(merge->inputs[i]);
+            continue;
+        }
+        if (read_merge_line(input)) {
+            live++;
+        } else {
+            fclose(input->file);
+            free(input->line);
+        }
+    }
+
+    FILE *output = fopen(merge->output, "w");
+    if (!output) {
+        perror(merge->output);
+    } else {
+        setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+    while (live > 0) {
+        // With at most MERGE_FANIN inputs a linear scan beats a heap
+        unsigned int smallest = 0;
+        for (unsigned int i = 1; i < live; i++) {
+            if (compare_merge_keys(&inputs[i], &inputs[smallest]) < 0) {
+                smallest = i;
+            }
+        }
+        if (output) {
+            fwrite(inputs[smallest].line, 1, (size_t)inputs[smallest].length, output);
+        }
+        if (!read_merge_line(&inputs[smallest])) {
+            fclose(inputs[smallest].file);
+            free(inputs[smallest].line);
+            inputs[smallest] = inputs[--live];
+        }
+    }
+    if (output) {
+        fclose(output);
+    }
+    for (unsigned int i = 0; i < merge->count; i++) {
+        remove(merge->inputs[i]);
+    }
+}
+
+// Merge tree step run by the pool
+static void merge_files_task(void *arg) {
+    Task *task = arg;
+    MR_Job *job = task->job;
+    merge_files(task->input);
+    free(task);
+    finish_task(job);
+}
+
+// Merges the sorted partition files into output_dir/result.txt. Each round
+// merges groups of MERGE_FANIN files as parallel pool tasks until one file
+// is left
+static void merge_outputs(MR_Job *job) {
+    char **files = malloc((job->num_partitions + 1) * sizeof(char *));
+    unsigned int count = 0;
+    for (unsigned int p = 0; p < job->num_partitions; p++) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s/result-%u.txt", job->output_dir, p);
+        if (access(name, F_OK) == 0) {
+            files[count++] = strdup(name);
+        }
+    }
+
+    unsigned int round = 0;
+    while (count > 1) {
+        unsigned int merges = (count + MERGE_FANIN - 1) / MERGE_FANIN;
+        FileMerge *steps = malloc(merges * sizeof(FileMerge));
+        Task **tasks = malloc(merges * sizeof(Task *));
+        long *sizes = calloc(merges, sizeof(long));
+        for (unsigned int m = 0; m < merges; m++) {
+            steps[m].count = 0;
+            for (unsigned int i = m * MERGE_FANIN; i < count && i < (m + 1) * MERGE_FANIN; i++) {
+                steps[m].inputs[steps[m].count++] = files[i];
+            }
+            char name[4096];
+            if (merges == 1) {
+                snprintf(name, sizeof(name), "%s/result.txt", job->output_dir);
+            } else {
+                snprintf(name, sizeof(name), "%s/result-merge-%u-%u.txt", job->output_dir, round, m);
+            }
+            steps[m].output = strdup(name);
+            tasks[m] = malloc(sizeof(Task));
+            tasks[m]->job = job;
+            tasks[m]->input = &steps[m];
+            tasks[m]->partition_idx = 0;
+        }
+        submit_tasks(job, merge_files_task, (void **)tasks, sizes, merges);
+        wait_for_tasks(job);
+
+        for (unsigned int i = 0; i < count; i++) {
+            free(files[i]);
+        }
+        for (unsigned int m = 0; m < merges; m++) {
+            files[m] = steps[m].output;
+        }
+        count = merges;
+        round++;
+        free(steps);
+        free(tasks);
+        free(sizes);
+    }
+
+    // A single partition file already is the whole sorted output
+    if (count == 1 && round == 0) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s/result.txt", job->output_dir);
+        rename(files[0], name);
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        free(files[i]);
+    }
+    free(files);
+}
+
+// Formats the name of a partition's output file, or of the file holding
+// the output of one of its later key ranges
+static void output_name(MR_Job *job, unsigned int partition_idx, unsigned int range_idx,
+                        char *name, size_t size) {
+    if (range_idx == 0) {
+        snprintf(name, size, "%s/result-%u.txt", job->output_dir, partition_idx);
+    } else {
+        snprintf(name, size, "%s/result-%u.txt.%u", job->output_dir, partition_idx, range_idx);
+    }
+}
+
+// Writes out everything buffered for a partition's output file
+static void flush_output(OutputWriter *writer) {
+    size_t written = 0;
+    while (written < writer->used) {
+        ssize_t n = write(writer->fd, writer->buffer + written, writer->used - written);
+        if (n < 0) {
+            perror("[MR_EmitOutput] write");
+            break;
+        }
+        written += (size_t)n;
+    }
+    writer->used = 0;
+}
+
+// Flushes and closes a partition's output file once its reduce task is done
+static void close_output(OutputWriter *writer) {
+    if (writer->fd >= 0) {
+        flush_output(writer);
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+// Appends "key: value" to a partition's buffered output file
+void MR_EmitOutput(unsigned int partition_idx, const char *key, int64_t value) {
+    MR_Job *job = current_job;
+    if (!job) {
+        report_outside_task("MR_EmitOutput");
+        return;
+    }
+    if (partition_idx >= job->num_partitions || !key) {
+        return;
+    }
+    ReduceRange *range = current_range;
+    if (range && (range->job != job || range->partition_idx != partition_idx)) {
+        range = NULL;
+    }
+    if (job->top_k) {
+        top_push(range ? &range->top : &job->tops[partition_idx], job->top_k, key, value);
+        return;
+    }
+    OutputWriter *writer = range ? &range->writer : &job->writers[partition_idx];
+
+    // Open the file on first use, so partitions without keys create none.
+    // Key ranges after the first write to a file of their own, appended to
+    // the partition's once every range is done
+    if (!writer->buffer) {
+        char name[4096];
+        output_name(job, partition_idx, range ? range->range_idx : 0, name, sizeof(name));
+        // Files that are only merge inputs start out empty
+        int mode = job->merge_output || (range && range->range_idx > 0) ? O_TRUNC : O_APPEND;
+        writer->fd = open(name, O_WRONLY | O_CREAT | mode, 0644);
+        if (writer->fd < 0) {
+            perror(name);
+        }
+        writer->buffer = malloc(OUTPUT_BUFFER_SIZE);
+        writer->used = 0;
+        if (range) {
+            range->opened = true;
+        }
+    }
+    if (writer->fd < 0) {
+        return;
+    }
+
+    // Format the line by hand; snprintf would dominate for short keys. A
+    // reducer normally writes the key it was called with, whose length its
+    // pair holds (for an interned key, the dictionary's)
+    KeyValuePair *reduced = range ? range->pair : job->partitions[partition_idx].current;
+    size_t key_len = reduced && reduced->key == key ? reduced->key_len : strlen(key);
+    char digits[24];
+    unsigned int digit_count = 0;
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    do {
+        digits[digit_count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        digits[digit_count++] = '-';
+    }
+
+    size_t line_len = key_len + 2 + digit_count + 1;
+    if (writer->used + line_len > OUTPUT_BUFFER_SIZE) {
+        flush_output(writer);
+    }
+    if (line_len > OUTPUT_BUFFER_SIZE) {
+        // A key longer than the buffer goes straight to the file
+        if (write(writer->fd, key, key_len) < 0) {
+            perror("[MR_EmitOutput] write");
+        }
+        key = "";
+        key_len = 0;
+    }
+    char *out = writer->buffer + writer->used;
+    memcpy(out, key, key_len);
+    out += key_len;
+    *out++ = ':';
+    *out++ = ' ';
+    while (digit_count > 0) {
+        *out++ = digits[--digit_count];
+    }
+    *out++ = '\n';
+    writer->used = (size_t)(out - writer->buffer);
+}
+
+// Reduces a partition built from runs (in pipelined mode, or after spills)
+// by streaming a k-way merge of its remaining runs into the reducer
+static void reduce_runs(MR_Job *job, Partition *partition, unsigned int partition_idx) {
+    RunMerger merger;
+    unsigned long keys = 0;
+    merger_init(&merger, partition->runs, partition->run_count, job->combiner);
+    while (merger_next(&merger)) {
+        pthread_mutex_lock(&partition->lock);
+        partition->current = &merger.out;
+        pthread_mutex_unlock(&partition->lock);
+        job->reducer(merger.out.key, partition_idx);
+        keys++;
+    }
+    count_keys(job, partition_idx, keys);
+    pthread_mutex_lock(&partition->lock);
+    partition->current = NULL;
+    pthread_mutex_unlock(&partition->lock);
+    merger_free(&merger, partition->run_count);
+
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < partition->run_count; i++) {
+        bytes += partition->runs[i]->arena.bytes_used;
+        free_run(partition->runs[i]);
+    }
+    partition->run_count = 0;
+    partition->run_bytes = 0;
+    job->arena_usage[partition_idx] = bytes;
+}
+
+// Appends the output files of a split partition's later key ranges to the
+// partition's file, in key order, and removes them
+static void join_range_outputs(MR_Job *job, unsigned int partition_idx, SplitReduce *split) {
+    char name[4096];
+    int fd = -1;
+    char *buffer = NULL;
+    for (unsigned int r = 1; r < split->range_count; r++) {
+        if (!split->ranges[r].opened) {
+            continue;
+        }
+        if (fd < 0) {
+            output_name(job, partition_idx, 0, name, sizeof(name));
+            // Truncate a stale merge input unless the first range wrote it
+            int mode = job->merge_output && !split->ranges[0].opened ? O_TRUNC : O_APPEND;
+            fd = open(name, O_WRONLY | O_CREAT | mode, 0644);
+            buffer = malloc(OUTPUT_BUFFER_SIZE);
+            if (fd < 0) {
+                perror(name);
+                break;
+            }
+        }
+        output_name(job, partition_idx, r, name, sizeof(name));
+        int in = open(name, O_RDONLY);
+        ssize_t got;
+        while (in >= 0 && (got = read(in, buffer, OUTPUT_BUFFER_SIZE)) > 0) {
+            OutputWriter chunk = {fd, buffer, (size_t)got};
+            flush_output(&chunk);
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        unlink(name);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buffer);
+}
+
+// Calls the reducer on every key of one range of a split partition. The
+// last range to finish releases the partition and joins the outputs
+static void reduce_range(ReduceRange *range) {
+    MR_Job *job = range->job;
+    Partition *partition = &job->partitions[range->partition_idx];
+    ReduceRange *previous = current_range;
+    current_range = range;
+    count_keys(job, range->partition_idx, range->end - range->begin);
+    for (unsigned int i = range->begin; i < range->end; i++) {
+        range->pair = &partition->pairs[i];
+        job->reducer(partition->pairs[i].key, range->partition_idx);
+    }
+    range->pair = NULL;
+    current_range = previous;
+    close_output(&range->writer);
+
+    SplitReduce *split = range->split;
+    if (atomic_fetch_sub(&split->remaining, 1) != 1) {
+        return;
+    }
+    unsigned int partition_idx = range->partition_idx;
+    job->arena_usage[partition_idx] = partition->arena.bytes_used;
+    arena_reset(&partition->arena);
+    join_range_outputs(job, partition_idx, split);
+    for (unsigned int r = 0; r < split->range_count; r++) {
+        TopHeap *top = &split->ranges[r].top;
+        for (unsigned int i = 0; i < top->count; i++) {
+            top_push(&job->tops[partition_idx], job->top_k, top->entries[i].key, top->entries[i].value);
+            free(top->entries[i].key);
+        }
+        free(top->entries);
+    }
+    free(split);
+}
+
+// Pool task for a key range after the first
+static void reduce_range_task(void *arg) {
+    ReduceRange *range = arg;
+    MR_Job *job = range->job;
+    MR_Job *previous = current_job;
+    current_job = job;
+    reduce_range(range);
+    current_job = previous;
+    finish_task(job);
+}
+
+// Decides how many key ranges a partition's reduce work is split into:
+// enough for each to be about a mean partition's work, when the partition
+// holds SKEW_FACTOR times the mean. Done from the exact counts once the map
+// phase is over, which makes sampling unnecessary
+static unsigned int plan_ranges(MR_Job *job, Partition *partition, double mean_work) {
+    unsigned int threads = job->context->pool->num_threads;
+    double work = (double)(partition->pair_count + partition->value_total);
+    if (!job->balance_reduce || job->pipeline || partition->run_count > 0 || threads < 2 ||
+        mean_work <= 0 || work < SKEW_FACTOR * mean_work || partition->pair_count < 2) {
+        return 1;
+    }
+    unsigned int ranges = (unsigned int)(work / mean_work + 0.5);
+    if (ranges > threads) {
+        ranges = threads;
+    }
+    if (ranges > partition->pair_count) {
+        ranges = partition->pair_count;
+    }
+    return ranges;
+}
+
+// Sorts a skewed partition, cuts it into ranges of about equal work (a key
+// and its values stay together), and reduces the first range itself while
+// the pool takes the others
+static void reduce_split(MR_Job *job, Partition *partition, unsigned int partition_idx,
+                         unsigned int range_count) {
+    if (!job->dictionary) {
+        sort_pairs(job, partition->pairs, partition->pair_count);
+    }
+    SplitReduce *split = calloc(1, sizeof(SplitReduce) + range_count * sizeof(ReduceRange));
+
+    unsigned long work = partition->pair_count + partition->value_total;
+    unsigned long done = 0;
+    unsigned int begin = 0;
+    for (unsigned int r = 0; r < range_count; r++) {
+        unsigned int end = begin;
+        unsigned long target = work * (r + 1) / range_count;
+        if (r == range_count - 1) {
+            end = partition->pair_count;
+        }
+        // Stop before a pair that would overshoot the target by more than
+        // stopping short undershoots it, so a hot key gets a range of its own
+        while (end < partition->pair_count && (done < target || end == begin)) {
+            KeyValuePair *pair = &partition->pairs[end];
+            unsigned long pair_work = 1 + pair->value_count + pair->int_count;
+            if (end > begin && done + pair_work > 2 * target - done) {
+                break;
+            }
+            done += pair_work;
+            end++;
+        }
+        ReduceRange *range = &split->ranges[split->range_count++];
+        range->job = job;
+        range->partition_idx = partition_idx;
+        range->range_idx = r;
+        range->begin = begin;
+        range->end = end;
+        range->writer.fd = -1;
+        range->split = split;
+        begin = end;
+        if (begin == partition->pair_count) {
+            break;
+        }
+    }
+    atomic_init(&split->remaining, split->range_count);
+    job->range_counts[partition_idx] = split->range_count;
+
+    // Sizes are the ranges' work, so they queue among the other partitions
+    unsigned int others = split->range_count - 1;
+    if (others > 0) {
+        void **args = malloc(others * sizeof(void *));
+        long *sizes = malloc(others * sizeof(long));
+        for (unsigned int r = 0; r < others; r++) {
+            args[r] = &split->ranges[r + 1];
+            sizes[r] = (long)(work / split->range_count);
+        }
+        submit_tasks(job, reduce_range_task, args, sizes, others);
+        free(args);
+        free(sizes);
+    }
+    reduce_range(&split->ranges[0]);
+}
+
+// Reducer task for each partition
+void reduce_task(void *arg) {
+    Task *task = arg;
+    MR_Job *job = task->job;
+    unsigned int partition_idx = task->partition_idx;
+    Partition *partition = &job->partitions[partition_idx];
+    MR_Job *previous = current_job;
+    current_job = job;
+
+    // input carries the number of key ranges chosen for this partition
+    unsigned int range_count = (unsigned int)(uintptr_t)task->input;
+    if (range_count > 1) {
+        reduce_split(job, partition, partition_idx, range_count);
+        close_output(&job->writers[partition_idx]);
+        current_job = previous;
+        finish_task(job);
+        return;
+    }
+
+    if (job->pipeline || partition->run_count > 0) {
+        // Whatever was not spilled becomes one more run
+        if (partition->pair_count > 0) {
+            push_run(partition, take_run(partition));
+        }
+        reduce_runs(job, partition, partition_idx);
+    } else {
+        // Sort key-value pairs in lexicographic order, unless the pairs of
+        // interned keys were sorted for all partitions at once
+        if (!job->dictionary) {
+            sort_pairs(job, partition->pairs, partition->pair_count);
+            rebuild_index(partition, partition->index_capacity);
+        }
+
+        // For each key in the partition, call the user-defined reducer
+        count_keys(job, partition_idx, partition->pair_count);
+        for (unsigned int i = 0; i < partition->pair_count; i++) {
+            partition->current = &partition->pairs[i];
+            job->reducer(partition->pairs[i].key, partition_idx);
+        }
+        partition->current = NULL;
+
+        // Drop the keys and all associated values in bulk once no reducer
+        // call can look them up through the index anymore
+        job->arena_usage[partition_idx] = partition->arena.bytes_used;
+        arena_reset(&partition->arena);
+    }
+
+    close_output(&job->writers[partition_idx]);
+    current_job = previous;
+    finish_task(job);
+}
+
+// Returns the arena bytes a partition used in a run
+size_t MR_ArenaBytes(const MR_Results *results, unsigned int partition_idx) {
+    return partition_idx < results->num_partitions ? results->arena_usage[partition_idx] : 0;
+}
+
+// Returns how many key ranges a partition was reduced in during a run
+unsigned int MR_ReduceRanges(const MR_Results *results, unsigned int partition_idx) {
+    return partition_idx < results->num_partitions ? results->range_counts[partition_idx] : 0;
+}
+
+// Creates empty results
+MR_Results *MR_CreateResults(void) {
+    return calloc(1, sizeof(MR_Results));
+}
+
+// Frees what results hold and empties them
+static void clear_results(MR_Results *results) {
+    free(results->arena_usage);
+    free(results->range_counts);
+    free(results->partition_stats);
+    free(results->input_bytes);
+    for (unsigned int i = 0; i < results->input_count; i++) {
+        free(results->input_names[i]);
+    }
+    free(results->input_names);
+    ThreadPool_free_stats(&results->pool_stats);
+    memset(results, 0, sizeof(*results));
+}
+
+// Destroys results and what they hold
+void MR_DestroyResults(MR_Results *results) {
+    if (!results) {
+        return;
+    }
+    clear_results(results);
+    free(results);
+}
+
+#ifdef MR_ENABLE_STATS
+// Moves a finished job's instrumentation into its results. Each pool worker
+// is charged with the tasks of this job it ran; its idle and queue lock
+// times and the queue depth series are the pool's since the job started
+static void store_job_stats(MR_Job *job, MR_Results *results) {
+    JobStats *stats = &job->stats;
+    unsigned int num_parts = job->num_partitions;
+    results->partition_stats = calloc(num_parts, sizeof(MR_PartitionStats));
+    for (unsigned int p = 0; p < num_parts; p++) {
+        for (unsigned int slot = 0; slot < stats->slots; slot++) {
+            results->partition_stats[p].emits += atomic_load(&stats->emits[slot * num_parts + p]);
+        }
+        results->partition_stats[p].keys = atomic_load(&stats->keys[p]);
+        results->partition_stats[p].lock_hold_seconds = stats->lock_hold_ns[p] / 1e9;
+        results->partition_stats[p].lock_wait_seconds = stats->lock_wait_ns[p] / 1e9;
+    }
+
+    results->input_bytes = malloc((stats->input_count + 1) * sizeof(unsigned long));
+    for (unsigned int i = 0; i < stats->input_count; i++) {
+        results->input_bytes[i] = atomic_load(&stats->input_bytes[i]);
+    }
+    results->input_names = stats->input_names;
+    results->input_count = stats->input_count;
+
+    ThreadPool_stats_t *pool_stats = &results->pool_stats;
+    ThreadPool_get_stats(job->context->pool, pool_stats);
+    for (unsigned int i = 0; i < pool_stats->num_threads; i++) {
+        ThreadPool_worker_stats_t *now = &pool_stats->workers[i];
+        ThreadPool_worker_stats_t *before = &stats->pool_before.workers[i];
+        now->idle_ns -= before->idle_ns < now->idle_ns ? before->idle_ns : now->idle_ns;
+        now->lock_wait_ns -= before->lock_wait_ns;
+        now->run_ns = atomic_load(&stats->task_ns[i]);
+        now->jobs = atomic_load(&stats->tasks[i]);
+    }
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < pool_stats->sample_count; i++) {
+        if (pool_stats->samples[i].time_ns >= stats->started_ns) {
+            pool_stats->samples[kept++] = pool_stats->samples[i];
+        }
+    }
+    pool_stats->sample_count = kept;
+    results->started_ns = stats->started_ns;
+
+    ThreadPool_free_stats(&stats->pool_before);
+    free(stats->lock_hold_ns);
+    free(stats->lock_wait_ns);
+    free(stats->emits);
+    free(stats->task_ns);
+    free(stats->tasks);
+    free(stats->keys);
+    free(stats->input_bytes);
+}
+#endif
+
+// Copies the instrumentation of a partition in a run
+bool MR_GetPartitionStats(const MR_Results *results, unsigned int partition_idx, MR_PartitionStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    bool found = results->partition_stats && partition_idx < results->num_partitions;
+    if (found) {
+        *stats = results->partition_stats[partition_idx];
+    }
+    return found;
+}
+
+// Returns the bytes read from an input in a run
+unsigned long MR_InputBytes(const MR_Results *results, unsigned int input_idx) {
+    return input_idx < results->input_count ? results->input_bytes[input_idx] : 0;
+}
+
+// Writes a string as a JSON string literal
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Writes the statistics of a run as JSON
+bool MR_WriteStats(const MR_Results *results, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    const MR_PhaseTimes *phase_times = &results->phase_times;
+    const MR_EmitStats *emit_stats = &results->emit_stats;
+    fprintf(file, "{\n  \"stats_enabled\": %s,\n", results->partition_stats ? "true" : "false");
+    fprintf(file, "  \"phases\": {\"map_seconds\": %.6f, \"reduce_seconds\": %.6f, \"output_seconds\": %.6f},\n",
+            phase_times->map_seconds, phase_times->reduce_seconds, phase_times->output_seconds);
+    fprintf(file, "  \"emits\": {\"flushes\": %lu, \"lock_acquisitions\": %lu, \"lock_waits\": %lu},\n",
+            emit_stats->flushes, emit_stats->lock_acquisitions, emit_stats->lock_waits);
+
+    fprintf(file, "  \"partitions\": [");
+    for (unsigned int p = 0; p < results->num_partitions; p++) {
+        fprintf(file, "%s\n    {\"arena_bytes\": %zu, \"reduce_ranges\": %u", p ? "," : "",
+                results->arena_usage[p], results->range_counts[p]);
+        if (results->partition_stats) {
+            MR_PartitionStats *stats = &results->partition_stats[p];
+            fprintf(file, ", \"emits\": %lu, \"keys\": %lu, \"lock_hold_seconds\": %.6f, \"lock_wait_seconds\": %.6f",
+                    stats->emits, stats->keys, stats->lock_hold_seconds, stats->lock_wait_seconds);
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n  ]");
+
+    if (results->partition_stats) {
+        const ThreadPool_stats_t *pool_stats = &results->pool_stats;
+        fprintf(file, ",\n  \"inputs\": [");
+        for (unsigned int i = 0; i < results->input_count; i++) {
+            fprintf(file, "%s\n    {\"file\": ", i ? "," : "");
+            write_json_string(file, results->input_names[i]);
+            fprintf(file, ", \"bytes_read\": %lu}", results->input_bytes[i]);
+        }
+        fprintf(file, "\n  ],\n  \"pool\": {\"threads\": %u, \"max_queue_depth\": %u, \"workers\": [",
+                pool_stats->num_threads, pool_stats->max_depth);
+        for (unsigned int i = 0; i < pool_stats->num_threads; i++) {
+            ThreadPool_worker_stats_t *worker = &pool_stats->workers[i];
+            fprintf(file, "%s\n      {\"idle_seconds\": %.6f, \"run_seconds\": %.6f, \"lock_wait_seconds\": %.6f, \"jobs\": %lu}",
+                    i ? "," : "", worker->idle_ns / 1e9, worker->run_ns / 1e9, worker->lock_wait_ns / 1e9,
+                    worker->jobs);
+        }
+        // Queue depth as [seconds since the run started, queued jobs] pairs
+        fprintf(file, "\n    ],\n    \"queue_depth\": [");
+        for (unsigned int i = 0; i < pool_stats->sample_count; i++) {
+            fprintf(file, "%s[%.6f, %u]", i ? ", " : "",
+                    (pool_stats->samples[i].time_ns - results->started_ns) / 1e9, pool_stats->samples[i].depth);
+        }
+        fprintf(file, "]\n  }");
+    }
+    fprintf(file, "\n}\n");
+    return fclose(file) == 0;
+}
+
+// Copies the key dictionary counters of a run
+void MR_GetInternStats(const MR_Results *results, MR_InternStats *stats) {
+    *stats = results->intern_stats;
+}
+
+// Copies the result cache counters of a run
+void MR_GetCacheStats(const MR_Results *results, MR_CacheStats *stats) {
+    *stats = results->cache_stats;
+}
+
+// Copies the I/O stage counters of a run
+void MR_GetIOStats(const MR_Results *results, MR_IOStats *stats) {
+    *stats = results->io_stats;
+}
+
+// Copies the worker process counters of a run
+void MR_GetWorkerStats(const MR_Results *results, MR_WorkerStats *stats) {
+    *stats = results->worker_stats;
+}
+
+// Copies the phase timings of a run
+void MR_GetPhaseTimes(const MR_Results *results, MR_PhaseTimes *times) {
+    *times = results->phase_times;
+}
+
+// Copies the emit counters of a run
+void MR_GetEmitStats(const MR_Results *results, MR_EmitStats *stats) {
+    *stats = results->emit_stats;
+}
+
+// Creates a context with a long-lived pool of worker threads
+MR_Context *MR_CreateContext(unsigned int num_workers, const MR_Options *options) {
+    MR_Options defaults = {0};
+    if (!options) {
+        options = &defaults;
+    }
+    MR_Context *context = malloc(sizeof(MR_Context));
+
+    // Worker processes are forked before the pool's threads exist, so no
+    // child starts with a lock one of them held
+    context->workers = NULL;
+    if (options->processes > 0) {
+        context->workers = Remote_start(options->processes, serve_map_tasks, NULL);
+    }
+    pthread_mutex_init(&context->workers_lock, NULL);
+    context->pool = ThreadPool_create_mode(num_workers, options->pool_mode);
+    ThreadPool_set_policy(context->pool, options->schedule);
+    context->spares = NULL;
+    context->spare_count = 0;
+    pthread_mutex_init(&context->lock, NULL);
+    return context;
+}
+
+// Destroys a context, its pool and its recycled partitions
+void MR_DestroyContext(MR_Context *context) {
+    if (!context) {
+        return;
+    }
+    ThreadPool_destroy(context->pool);
+    if (context->workers) {
+        Remote_stop(context->workers);
+    }
+    pthread_mutex_destroy(&context->workers_lock);
+    while (context->spares) {
+        PartitionSet *set = context->spares;
+        context->spares = set->next;
+        for (unsigned int i = 0; i < set->count; i++) {
+            destroy_partition(&set->parts[i]);
+        }
+        free(set->parts);
+        free(set);
+    }
+    pthread_mutex_destroy(&context->lock);
+    free(context);
+}
+
+// Takes a recycled set of num_parts partitions from a context, or creates one
+static Partition *acquire_partitions(MR_Context *context, unsigned int num_parts) {
+    Partition *parts = NULL;
+    pthread_mutex_lock(&context->lock);
+    for (PartitionSet **link = &context->spares; *link; link = &(*link)->next) {
+        if ((*link)->count == num_parts) {
+            PartitionSet *set = *link;
+            *link = set->next;
+            context->spare_count--;
+            parts = set->parts;
+            free(set);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&context->lock);
+
+    if (!parts) {
+        parts = malloc(num_parts * sizeof(Partition));
+        for (unsigned int i = 0; i < num_parts; i++) {
+            init_partition(&parts[i]);
+        }
+    }
+    return parts;
+}
+
+// Empties a job's partitions and returns them to the context for the next
+// run, freeing them instead when the context already keeps enough sets
+static void release_partitions(MR_Context *context, Partition *parts, unsigned int num_parts) {
+    for (unsigned int i = 0; i < num_parts; i++) {
+        reset_partition(&parts[i]);
+    }
+    pthread_mutex_lock(&context->lock);
+    if (context->spare_count < MAX_SPARE_SETS) {
+        PartitionSet *set = malloc(sizeof(PartitionSet));
+        set->parts = parts;
+        set->count = num_parts;
+        set->next = context->spares;
+        context->spares = set;
+        context->spare_count++;
+        parts = NULL;
+    }
+    pthread_mutex_unlock(&context->lock);
+
+    if (parts) {
+        for (unsigned int i = 0; i < num_parts; i++) {
+            destroy_partition(&parts[i]);
+        }
+        free(parts);
+    }
+}
+
+// Executes the MapReduce process, handling map and reduce phases
+void MR_Run(unsigned int file_count, char *file_names[], Mapper mapper, Reducer reducer, unsigned int num_workers, unsigned int num_parts) {
+    MR_RunWithOptions(file_count, file_names, mapper, reducer, num_workers, num_parts, NULL);
+}
+
+// Executes the MapReduce process with optional settings on a pool of its own
+void MR_RunWithOptions(unsigned int file_count, char *file_names[], Mapper mapper, Reducer reducer,
+                       unsigned int num_workers, unsigned int num_parts, const MR_Options *options) {
+    MR_Context *context = MR_CreateContext(num_workers, options);
+    MR_RunInContext(context, file_count, file_names, mapper, reducer, num_parts, options);
+    MR_DestroyContext(context);
+}
+
+// Reads the monotonic clock in seconds
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Executes one MapReduce job on a context's pool
+void MR_RunInContext(MR_Context *context, unsigned int file_count, char *file_names[], Mapper mapper,
+                     Reducer reducer, unsigned int num_parts, const MR_Options *options) {
+    MR_Options defaults = {0};
+    if (!options) {
+        options = &defaults;
+    }
+
+    // Set up the job: user-defined functions, settings and partitions
+    MR_Job job;
+    job.context = context;
+    job.num_partitions = num_parts;
+    job.partitions = acquire_partitions(context, num_parts);
+    job.mapper = mapper;
+    job.split_mapper = options->split_mapper;
+    job.reducer = reducer;
+    job.combiner = options->combiner;
+    job.combine_limit = options->combine_limit ? options->combine_limit : DEFAULT_COMBINE_LIMIT;
+    job.pipeline = options->pipeline;
+    job.parallel_sort_threshold =
+        options->sort_threshold ? options->sort_threshold : DEFAULT_PARALLEL_SORT_THRESHOLD;
+    job.memory_budget = options->memory_budget ? options->memory_budget / num_parts + 1 : 0;
+    job.spill_dir = options->spill_dir ? options->spill_dir : getenv("TMPDIR");
+    if (!job.spill_dir) {
+        job.spill_dir = "/tmp";
+    }
+    job.emit_batch = options->emit_batch ? options->emit_batch : DEFAULT_EMIT_BATCH;
+    job.balance_reduce = options->balance_reduce;
+    job.range_counts = calloc(num_parts, sizeof(unsigned int));
+    job.captures = NULL;
+    atomic_init(&job.flushes, 0);
+    atomic_init(&job.lock_acquisitions, 0);
+    atomic_init(&job.lock_waits, 0);
+    job.arena_usage = calloc(num_parts, sizeof(size_t));
+    job.pending = 0;
+    pthread_mutex_init(&job.pending_lock, NULL);
+    pthread_cond_init(&job.pending_done, NULL);
+
+    // Output files are opened lazily by MR_EmitOutput
+    job.output_dir = options->output_dir ? options->output_dir : ".";
+    if (options->output_dir) {
+        mkdir(job.output_dir, 0755);
+    }
+    job.merge_output = options->merge_output;
+    job.top_k = options->top_k;
+    job.tops = calloc(num_parts, sizeof(TopHeap));
+
+    // In heavy-hitter mode mappers feed per-worker sketches, not partitions
+    job.heavy_hitters = options->heavy_hitters;
+    job.sketch_error = options->sketch_error;
+    job.sketches = NULL;
+    if (job.heavy_hitters) {
+        job.sketches = calloc(context->pool->num_threads + 1, sizeof(Sketch_t *));
+    }
+    pthread_mutex_init(&job.sketch_lock, NULL);
+
+    // Interned keys are found by ID in the partitions, which pipelined and
+    // spilled runs move into runs and heavy-hitter runs do not fill
+    job.dictionary = NULL;
+    if (options->intern_keys && (job.pipeline || job.memory_budget || job.heavy_hitters)) {
+        fprintf(stderr, "[MR_Run] Keys cannot be interned with pipeline, a memory budget or heavy "
+                        "hitters; not interning\n");
+    } else if (options->intern_keys) {
+        job.dictionary = Intern_create();
+        for (unsigned int i = 0; i < num_parts; i++) {
+            job.partitions[i].dictionary = job.dictionary;
+        }
+    }
+    job.writers = malloc(num_parts * sizeof(OutputWriter));
+    for (unsigned int i = 0; i < num_parts; i++) {
+        job.writers[i].fd = -1;
+        job.writers[i].buffer = NULL;
+        job.writers[i].used = 0;
+    }
+
+#ifdef MR_ENABLE_STATS
+    job.stats.lock_hold_ns = calloc(num_parts, sizeof(uint64_t));
+    job.stats.lock_wait_ns = calloc(num_parts, sizeof(uint64_t));
+    job.stats.slots = context->pool->num_threads + 1;
+    job.stats.emits = calloc((size_t)job.stats.slots * num_parts, sizeof(atomic_ulong));
+    job.stats.task_ns = calloc(context->pool->num_threads, sizeof(atomic_ullong));
+    job.stats.tasks = calloc(context->pool->num_threads, sizeof(atomic_ulong));
+    job.stats.keys = calloc(num_parts, sizeof(atomic_ulong));
+    job.stats.input_bytes = calloc(file_count + 1, sizeof(atomic_ulong));
+    job.stats.input_names = malloc((file_count + 1) * sizeof(char *));
+    for (unsigned int i = 0; i < file_count; i++) {
+        job.stats.input_names[i] = strdup(file_names[i]);
+    }
+    job.stats.input_count = file_count;
+    job.stats.started_ns = stats_now_ns();
+    ThreadPool_get_stats(context->pool, &job.stats.pool_before);
+#endif
+
+    printf("Starting map phase...\n");
+    MR_PhaseTimes times;
+    double phase_start = now_seconds();
+
+    // With a result cache, inputs that have not changed since the last run
+    // are replayed from the cache and only the others are mapped. Cached
+    // values are combined partial results, so a combiner is required
+    Cache_t *cache = NULL;
+    CachedInput *cached_inputs = NULL;
+    char **map_names = file_names;
+    unsigned int *map_inputs = malloc((file_count + 1) * sizeof(unsigned int));
+    unsigned int map_count = 0, replay_count = 0;
+    bool caching = options->cache_file && job.combiner && !job.pipeline && !job.heavy_hitters;
+    if (options->cache_file && !caching) {
+        fprintf(stderr, "[MR_Run] The result cache needs a combiner and no pipeline or heavy "
+                        "hitters; not using %s\n", options->cache_file);
+    }
+    // Worker processes map into partitions of their own and send them back,
+    // which the modes that keep other state during the map phase cannot do
+    bool remote = options->processes > 0 && !job.pipeline && !job.heavy_hitters && !options->cache_file;
+    if (options->processes > 0 && !remote) {
+        fprintf(stderr, "[MR_Run] Worker processes cannot run with pipeline, heavy hitters or a "
+                        "result cache; mapping in this process\n");
+    }
+    if (remote && !context->workers) {
+        fprintf(stderr, "[MR_Run] The context was created without worker processes; mapping in "
+                        "this process\n");
+        remote = false;
+    }
+    // The I/O stage hands mappers the bytes of their split, so it needs a
+    // split mapper; worker processes read their own input
+    unsigned int io_threads = job.split_mapper && !remote ? options->io_threads : 0;
+    if (options->io_threads > 0 && !io_threads) {
+        fprintf(stderr, "[MR_Run] The I/O stage needs a split mapper and no worker processes; "
+                        "mappers read their own input\n");
+    }
+    if (caching) {
+        if (!Cache_load(options->cache_file, &cache)) {
+            fprintf(stderr, "[MR_Run] Ignoring unreadable result cache %s\n", options->cache_file);
+        }
+        cached_inputs = calloc(file_count + 1, sizeof(CachedInput));
+        job.captures = calloc(file_count + 1, sizeof(InputCapture));
+        map_names = malloc((file_count + 1) * sizeof(char *));
+    }
+    for (unsigned int i = 0; i < file_count; i++) {
+        if (caching) {
+            pthread_mutex_init(&job.captures[i].lock, NULL);
+            identify_input(cache, file_names[i], &cached_inputs[i]);
+            if (cached_inputs[i].entry) {
+                replay_count++;
+                continue;
+            }
+            map_names[map_count] = file_names[i];
+        }
+        map_inputs[map_count++] = i;
+    }
+
+    // Map phase: Submit each file (or each split of it) to be processed by
+    // the mapper, sized by its length in bytes, as one batch
+    MR_Split *splits = NULL;
+    unsigned int task_count = map_count;
+    if (job.split_mapper) {
+        long split_size = options->split_size > 0 ? options->split_size : DEFAULT_SPLIT_SIZE;
+        task_count = make_splits(map_count, map_names, split_size, &splits);
+    }
+    Task *tasks = malloc((task_count + replay_count + 1) * sizeof(Task));
+    void **task_args = malloc((task_count + replay_count + 1) * sizeof(void *));
+    long *task_sizes = malloc((task_count + replay_count + 1) * sizeof(long));
+    unsigned int map_idx = 0;
+    for (unsigned int i = 0; i < task_count; i++) {
+        tasks[i].job = &job;
+        tasks[i].partition_idx = 0;
+        if (job.split_mapper) {
+            // Splits come in file order, skipping files that could not be opened
+            while (map_names[map_idx] != splits[i].file_name) {
+                map_idx++;
+            }
+            tasks[i].input_idx = map_inputs[map_idx];
+            tasks[i].input = &splits[i];
+            task_sizes[i] = splits[i].length;
+        } else {
+            struct stat st;
+            tasks[i].input_idx = map_inputs[i];
+            tasks[i].input = map_names[i];
+            task_sizes[i] = stat(map_names[i], &st) == 0 ? (long)st.st_size : 0;
+        }
+        task_args[i] = &tasks[i];
+    }
+    MR_WorkerStats run_worker_stats = {0};
+    MR_IOStats run_io_stats = {0};
+    if (remote) {
+        pthread_mutex_lock(&context->workers_lock);
+        map_remotely(&job, context->workers, tasks, task_args, task_sizes, task_count,
+                     job.split_mapper ? map_split_task : map_task, options->schedule, &run_worker_stats);
+        pthread_mutex_unlock(&context->workers_lock);
+        printf("Worker processes: %u workers, %u lost, %u tasks re-executed, %u mapped locally, "
+               "%u abandoned.\n", run_worker_stats.workers, run_worker_stats.lost,
+               run_worker_stats.retried, run_worker_stats.local, run_worker_stats.abandoned);
+    } else if (io_threads) {
+        unsigned int io_buffers = options->io_buffers ? options->io_buffers
+                                                      : io_threads + context->pool->num_threads;
+        map_prefetched(&job, tasks, task_sizes, task_count, io_threads, io_buffers, options->schedule,
+                       &run_io_stats);
+        printf("I/O stage: %u threads read %lu bytes into %u buffers in %.3f s, waiting %.3f s "
+               "for free buffers.\n", io_threads, run_io_stats.bytes_read, io_buffers,
+               run_io_stats.read_seconds, run_io_stats.buffer_wait_seconds);
+    } else {
+        submit_tasks(&job, job.split_mapper ? map_split_task : map_task, task_args, task_sizes, task_count);
+    }
+
+    // Replay tasks for the unchanged inputs, sized by their cached bytes
+    unsigned int replay_idx = task_count;
+    for (unsigned int i = 0; caching && i < file_count; i++) {
+        if (cached_inputs[i].entry) {
+            tasks[replay_idx].job = &job;
+            tasks[replay_idx].partition_idx = 0;
+            tasks[replay_idx].input_idx = i;
+            tasks[replay_idx].input = &cached_inputs[i].entry->records;
+            task_sizes[replay_idx] = (long)cached_inputs[i].entry->records.len;
+            task_args[replay_idx] = &tasks[replay_idx];
+            replay_idx++;
+        }
+    }
+    submit_tasks(&job, replay_task, task_args + task_count, task_sizes + task_count, replay_count);
+    wait_for_tasks(&job);
+    free(tasks);
+    free(task_args);
+    free(task_sizes);
+    free(splits);
+
+    MR_CacheStats run_cache_stats = {replay_count, map_count, 0};
+    if (caching) {
+        run_cache_stats.dropped = save_cache(&job, options->cache_file, cache, cached_inputs, file_count, file_names);
+        printf("Result cache: %u inputs reused, %u mapped, %u dropped.\n", run_cache_stats.reused,
+               run_cache_stats.mapped, run_cache_stats.dropped);
+        for (unsigned int i = 0; i < file_count; i++) {
+            free(job.captures[i].records.bytes);
+            pthread_mutex_destroy(&job.captures[i].lock);
+        }
+        free(job.captures);
+        job.captures = NULL;
+        free(cached_inputs);
+        free(map_names);
+        Cache_destroy(cache);
+    }
+    free(map_inputs);
+    if (job.sketches) {
+        finish_sketches(&job);
+    }
+    times.map_seconds = now_seconds() - phase_start;
+    printf("Map phase completed.\n");
+
+    printf("Starting reduce phase...\n");
+    phase_start = now_seconds();
+    MR_InternStats run_intern_stats = {0};
+    if (job.dictionary) {
+        run_intern_stats.keys = Intern_count(job.dictionary);
+        run_intern_stats.bytes = Intern_bytes(job.dictionary);
+        printf("Interned %u distinct keys in %zu bytes.\n", run_intern_stats.keys, run_intern_stats.bytes);
+        sort_interned_pairs(&job);
+    }
+
+    // Reduce phase: Submit a reduce task for each partition, sized by the
+    // number of keys and values it holds. Partitions far above the mean are
+    // split into key ranges reduced in parallel
+    tasks = malloc(num_parts * sizeof(Task));
+    task_args = malloc(num_parts * sizeof(void *));
+    task_sizes = malloc(num_parts * sizeof(long));
+    double mean_work = 0;
+    for (unsigned int i = 0; i < num_parts; i++) {
+        mean_work += (double)(job.partitions[i].pair_count + job.partitions[i].value_total) / num_parts;
+    }
+    for (unsigned int i = 0; i < num_parts; i++) {
+        Partition *partition = &job.partitions[i];
+        job.range_counts[i] = 1;
+        tasks[i].job = &job;
+        tasks[i].input = (void *)(uintptr_t)plan_ranges(&job, partition, mean_work);
+        tasks[i].partition_idx = i;
+        task_args[i] = &tasks[i];
+        task_sizes[i] = (long)(partition->pair_count + partition->value_total);
+        for (unsigned int r = 0; r < partition->run_count; r++) {
+            task_sizes[i] += (long)partition->runs[r]->size;
+        }
+    }
+    submit_tasks(&job, reduce_task, task_args, task_sizes, num_parts);
+    wait_for_tasks(&job);
+    free(tasks);
+    free(task_args);
+    free(task_sizes);
+    times.reduce_seconds = now_seconds() - phase_start;
+    printf("Reduce phase completed.\n");
+
+    // Combine the per-partition outputs if asked to
+    phase_start = now_seconds();
+    if (job.top_k) {
+        write_top(&job);
+    } else if (job.merge_output) {
+        merge_outputs(&job);
+    }
+    times.output_seconds = now_seconds() - phase_start;
+
+    // Hand the run's statistics to the caller's results, or to results of
+    // its own for the stats file, and recycle the partitions
+    MR_Results run_results = {0};
+    MR_Results *results = options->results ? options->results : &run_results;
+    clear_results(results);
+    results->num_partitions = num_parts;
+    results->arena_usage = job.arena_usage;
+    results->range_counts = job.range_counts;
+    results->emit_stats.flushes = atomic_load(&job.flushes);
+    results->emit_stats.lock_acquisitions = atomic_load(&job.lock_acquisitions);
+    results->emit_stats.lock_waits = atomic_load(&job.lock_waits);
+    results->phase_times = times;
+    results->cache_stats = run_cache_stats;
+    results->worker_stats = run_worker_stats;
+    results->io_stats = run_io_stats;
+    results->intern_stats = run_intern_stats;
+#ifdef MR_ENABLE_STATS
+    store_job_stats(&job, results);
+#endif
+    if (options->stats_file && !MR_WriteStats(results, options->stats_file)) {
+        fprintf(stderr, "[MR_Run] Cannot write %s\n", options->stats_file);
+    }
+    clear_results(&run_results);
+    release_partitions(context, job.partitions, num_parts);
+    Intern_destroy(job.dictionary);
+    free(job.writers);
+    free(job.tops);
+    pthread_mutex_destroy(&job.sketch_lock);
+    pthread_mutex_destroy(&job.pending_lock);
+    pthread_cond_destroy(&job.pending_done);
+
+    printf("MapReduce run completed.\n");
+}
@@ -1,9 +1,166 @@
 #ifndef MAPREDUCE_H
 #define MAPREDUCE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threadpool.h"
+
+// Byte range of an input file handed to a split-aware mapper. Splits start
+// and end on whitespace, so no token is cut in two
+typedef struct {
+    char *file_name;
+    long offset;
+    long length;
+} MR_Split;
+
+// Read-only view of a split's bytes, filled in by MR_OpenInput. The data is
+// not NUL-terminated; map_base and map_length are for MR_CloseInput
+typedef struct {
+    const char *data;
+    size_t length;
+    void *map_base;
+    size_t map_length;
+} MR_Input;
+
 // function pointer typedefs
 typedef void (*Mapper)(char *file_name);
+typedef void (*SplitMapper)(MR_Split *split);
 typedef void (*Reducer)(char *key, unsigned int partition_idx);
+typedef int64_t (*Combiner)(int64_t accumulated, int64_t value);
+
+// A long-lived pool plus partition storage reused by the jobs run on it
+typedef struct MR_Context MR_Context;
+
+// The statistics of one finished run, owned by the caller, who passes it in
+// MR_Options and reads it with MR_GetPhaseTimes and friends
+typedef struct MR_Results MR_Results;
+
+// Counters of how map-phase emits reached the partitions, for checking
+// lock contention
+typedef struct {
+    unsigned long flushes;            // Staging buffers flushed into partitions
+    unsigned long lock_acquisitions;  // Partition locks taken by map tasks
+    unsigned long lock_waits;         // Acquisitions that found the lock already held
+} MR_EmitStats;
+
+// Wall-clock time of each phase of a run, in seconds
+typedef struct {
+    double map_seconds;     // Map tasks, including flushes of buffered emits
+    double reduce_seconds;  // Reduce tasks
+    double output_seconds;  // Merging result files or writing top.txt
+} MR_PhaseTimes;
+
+// What the result cache did in a run. Without a cache every input is
+// counted as mapped
+typedef struct {
+    unsigned int reused;   // Unchanged inputs replayed from the cache
+    unsigned int mapped;   // Inputs that were mapped
+    unsigned int dropped;  // Cache entries of inputs no longer in the run
+} MR_CacheStats;
+
+// What the worker processes of a distributed map phase did in a run. A
+// task is re-executed when the worker running it dies, and mapped in the
+// calling process once no worker is left. A task that takes down three
+// workers is abandoned, which fails the run: its input is missing from the
+// results
+typedef struct {
+    unsigned int workers;    // Worker processes alive when the map phase began
+    unsigned int lost;       // Workers that died or broke their connection
+    unsigned int remote;     // Map tasks whose output a worker sent back
+    unsigned int retried;    // Map tasks handed out again after losing their worker
+    unsigned int local;      // Map tasks run in the calling process
+    unsigned int abandoned;  // Map tasks given up on after taking down three workers
+    bool failed;             // Set when a task was abandoned, so the results are incomplete
+} MR_WorkerStats;
+
+// What the I/O stage did in a run; all zero when mappers read their own
+// input. Read and wait times are summed over the reader threads
+typedef struct {
+    unsigned int threads;         // Reader threads
+    unsigned int buffers;         // Split buffers shared by the readers and map tasks
+    unsigned long bytes_read;     // Bytes read ahead of the mappers
+    double read_seconds;          // Time spent reading
+    double buffer_wait_seconds;   // Time readers waited for a map task to free a buffer
+} MR_IOStats;
+
+// Size of the key dictionary of a run with intern_keys; zero otherwise
+typedef struct {
+    unsigned int keys;  // Distinct keys, i.e. IDs handed out
+    size_t bytes;       // Memory of the keys, the ID index and the lookup tables
+} MR_InternStats;
+
+// Instrumentation of one partition in a run, collected in builds with
+// MR_ENABLE_STATS. Lock times cover the map phase
+typedef struct {
+    unsigned long emits;       // MR_Emit and MR_EmitInt calls routed to the partition
+    unsigned long keys;        // Distinct keys its reducer was called with
+    double lock_hold_seconds;  // Time map tasks held the partition lock
+    double lock_wait_seconds;  // Time map tasks blocked on the partition lock
+} MR_PartitionStats;
+
+// Optional settings for MR_RunWithOptions; a zero-initialized struct
+// selects the defaults. README describes each feature in more detail
+typedef struct {
+    // Each worker merges its MR_EmitInt values in a local table and flushes
+    // one combined value per key when a map task ends or combine_limit keys
+    // are buffered
+    Combiner combiner;             // Map-side combiner for MR_EmitInt values (NULL to disable)
+    unsigned int combine_limit;    // Distinct keys a worker buffers before flushing (0 for default)
+    // Map jobs are sized by their bytes, reduce jobs by their keys and values
+    ThreadPool_policy_t schedule;  // Order of map and reduce jobs (SJF by default)
+    // Files are cut into whitespace-aligned splits, each its own map job;
+    // the mapper argument is then unused and may be NULL
+    SplitMapper split_mapper;      // Maps byte-range splits instead of whole files (NULL to disable)
+    long split_size;               // Target bytes per split (0 for default)
+    ThreadPool_mode_t pool_mode;   // Shared SJF queue (default) or work-stealing deques
+    // Map tasks publish sorted runs that background jobs merge; MR_GetNext
+    // then only serves the key currently being reduced
+    bool pipeline;                 // Stream sorted runs into background merges during the map phase
+    const char *output_dir;        // Directory for MR_EmitOutput files, created if missing (default ".")
+    // A partition past budget / num_parts bytes is sorted and spilled as a
+    // run that its reduce task merges back; combine tables are not counted
+    size_t memory_budget;          // Bytes of partition data kept in memory before spilling (0 = no limit)
+    const char *spill_dir;         // Directory for spill files (default $TMPDIR, else /tmp)
+    unsigned int sort_threshold;   // Keys in a partition before idle workers help sort it (0 for default)
+    bool merge_output;             // Merge the sorted result-N.txt files into one result.txt
+    unsigned int top_k;            // Only write the K highest MR_EmitOutput values, to top.txt (0 to disable)
+    // Emits go to per-worker sketches instead of the partitions, which get
+    // the K most frequent keys with one upper-bound count each (within
+    // sketch_error of the total with 99% probability), for MR_GetNextInt
+    unsigned int heavy_hitters;    // Count approximately and keep only the K most frequent keys (0 = exact)
+    double sketch_error;           // Count-Min error as a fraction of all counts (0 for default 0.0001)
+    // Applies to MR_Emit, and MR_EmitInt without a combiner; values of a
+    // key keep each worker's emit order. See MR_GetEmitStats
+    unsigned int emit_batch;       // Emits a worker stages per partition before flushing (0 for default, 1 = off)
+    // Partitions with twice the mean keys plus values are reduced in key
+    // ranges at once, so MR_GetNext only serves the key being reduced.
+    // Pipelined and spilled partitions are not split. See MR_ReduceRanges
+    bool balance_reduce;           // Split skewed partitions into key ranges reduced in parallel
+    const char *stats_file;        // Write MR_WriteStats JSON here when the run ends (NULL to disable)
+    // Replaces what results held; jobs running at once need results each
+    MR_Results *results;           // Filled in with the run's statistics when it ends (NULL to skip)
+    // Needs a combiner. Inputs with unchanged size and modification time
+    // are replayed instead of mapped (a file is hashed only when its size
+    // matches but its modification time does not); inputs whose mapper
+    // calls MR_Emit are not cached. See MR_GetCacheStats
+    const char *cache_file;        // Per-input result cache for incremental runs (NULL to disable)
+    // Uses the workers forked by MR_CreateContext. A task whose worker dies
+    // is retried elsewhere; one that takes down three is abandoned and the
+    // run fails. Ignored with pipeline, heavy_hitters and cache_file. See
+    // MR_GetWorkerStats
+    unsigned int processes;        // Worker processes mapping for the run (0 = map in this process)
+    // Needs a split_mapper. Readers pread splits into io_buffers buffers
+    // that MR_OpenInput serves, staying at most io_buffers splits ahead of
+    // the mappers. See MR_GetIOStats
+    unsigned int io_threads;       // Reader threads prefetching splits for the mappers (0 = mappers read)
+    unsigned int io_buffers;       // Splits read ahead at most (0 for io_threads plus pool threads)
+    // Partitions and combine tables hold IDs from one shared dictionary,
+    // all keys are sorted at once, and reducers get the dictionary's
+    // strings. Ignored with pipeline, memory_budget and heavy_hitters. See
+    // MR_GetInternStats
+    bool intern_keys;              // Give each distinct key a 32-bit ID and work on IDs
+} MR_Options;
 
 // library functions that must be implemented
 
@@ -22,13 +179,132 @@ void MR_Run(unsigned int file_count, char *file_names[],
             unsigned int num_workers, unsigned int num_parts);
 
 /**
-* Write a specifc map output, a <key, value> pair, to a partition
+* Run the MapReduce framework with optional settings (see MR_Options). The
+* pool is created for this run and destroyed when it ends
+* Parameters:
+*     file_count   - Number of files (i.e. input splits)
+*     file_names   - Array of filenames
+*     mapper       - Function pointer to the map function
+*     reducer      - Function pointer to the reduce function
+*     num_workers  - Number of threads in the thread pool
+*     num_parts    - Number of partitions to be created
+*     options      - Optional settings, or NULL for the defaults
+*/
+void MR_RunWithOptions(unsigned int file_count, char *file_names[],
+                       Mapper mapper, Reducer reducer,
+                       unsigned int num_workers, unsigned int num_parts,
+                       const MR_Options *options);
+
+/**
+* Create a context whose pool of worker threads stays up across many jobs.
+* Only the pool_mode, schedule and processes of options are used here; they
+* apply to every job run on the context. With processes set, the worker
+* processes are forked here, before the pool's threads start, and serve
+* every job run with processes set. They do not exec, so create the context
+* before the program starts threads of its own, and use mappers and
+* combiners linked into the program rather than loaded later. Workers that
+* die are not replaced
+* Parameters:
+*     num_workers  - Number of threads in the thread pool
+*     options      - Pool settings, or NULL for the defaults
+* Return:
+*     MR_Context*  - The new context
+*/
+MR_Context *MR_CreateContext(unsigned int num_workers, const MR_Options *options);
+
+/**
+* Destroy a context once no job is running on it
+* Parameters:
+*     context      - Context to destroy
+*/
+void MR_DestroyContext(MR_Context *context);
+
+/**
+* Create an empty results object for options->results. Until a run fills it
+* in, its counters are zero and it knows no partitions or inputs
+* Return:
+*     MR_Results*  - The new results
+*/
+MR_Results *MR_CreateResults(void);
+
+/**
+* Destroy a results object once no run is filling it in
+* Parameters:
+*     results      - Results to destroy
+*/
+void MR_DestroyResults(MR_Results *results);
+
+/**
+* Run one MapReduce job on a context's pool, like MR_RunWithOptions but
+* without creating threads. Several threads may run jobs on the same context
+* at once; each waits only for its own tasks. Partition memory is recycled
+* between jobs with the same num_parts. Do not call it from a mapper or
+* reducer, which already run on the pool
+* Parameters:
+*     context      - Context whose pool runs the job
+*     file_count   - Number of files (i.e. input splits)
+*     file_names   - Array of filenames
+*     mapper       - Function pointer to the map function
+*     reducer      - Function pointer to the reduce function
+*     num_parts    - Number of partitions to be created
+*     options      - Optional settings, or NULL for the defaults; pool_mode
+*                    and schedule are ignored, and processes only selects
+*                    the context's worker processes
+*/
+void MR_RunInContext(MR_Context *context, unsigned int file_count, char *file_names[],
+                     Mapper mapper, Reducer reducer, unsigned int num_parts,
+                     const MR_Options *options);
+
+/**
+* Write a specifc map output, a <key, value> pair, to a partition. Call it
+* (and the other MR_Emit functions) from the mapper's own thread: the job
+* is found through the calling thread, so emits from threads the mapper
+* starts are dropped, with a diagnostic on stderr
 * Parameters:
 *     key           - Key of the output
 *     value         - Value of the output
 */
 void MR_Emit(char *key, char *value);
 
+/**
+* Write a map output with an integer value to a partition. The value is
+* stored inline, so no string is allocated for it
+* Parameters:
+*     key           - Key of the output
+*     value         - Integer value of the output
+*/
+void MR_EmitInt(char *key, int64_t value);
+
+/**
+* Write a map output with an integer value, taking the key as a slice of a
+* larger buffer (e.g. an MR_Input). The key is not copied unless it becomes
+* a new entry in a partition or combine table
+* Parameters:
+*     key           - Start of the key bytes (need not be NUL-terminated)
+*     key_len       - Number of bytes in the key
+*     value         - Integer value of the output
+*/
+void MR_EmitIntSlice(const char *key, size_t key_len, int64_t value);
+
+/**
+* Map the bytes of a split into memory with sequential read-ahead hints, so
+* a mapper can tokenize its input in place without copying it
+* Parameters:
+*     split         - Split to read
+*     input         - Filled in with a view of the split's bytes
+* Return:
+*     true          - On success
+*     false         - If the file cannot be opened or mapped
+*/
+bool MR_OpenInput(MR_Split *split, MR_Input *input);
+
+/**
+* Release an input opened with MR_OpenInput
+* Parameters:
+*     input         - Input to release
+*/
+void MR_CloseInput(MR_Input *input);
+
 /**
 * Hash a mapper's output to determine the partition that will hold it
 * Parameters:
@@ -48,7 +324,8 @@ unsigned int MR_Partitioner(char *key, unsigned int num_partitions);
 void MR_Reduce(void *threadarg);
 
 /**
-* Get the next value of the given key in the partition
+* Get the next value of the given key in the partition. Like MR_Emit, it
+* only works on the reducer's own thread
 * Parameters:
 *     key           - Key of the values being reduced
 *     partition_idx - Index of the partition containing this key
@@ -58,4 +335,145 @@ void MR_Reduce(void *threadarg);
 */
 char *MR_GetNext(char *key, unsigned int partition_idx);
 
+/**
+* Get the next integer value (emitted with MR_EmitInt) of the given key
+* Parameters:
+*     key           - Key of the values being reduced
+*     partition_idx - Index of the partition containing this key
+*     value         - Set to the next integer value when one is left
+* Return:
+*     true          - If a value was stored in *value
+*     false         - Otherwise
+*/
+bool MR_GetNextInt(char *key, unsigned int partition_idx, int64_t *value);
+
+/**
+* Append a "key: value" line to the partition's output file,
+* output_dir/result-<partition_idx>.txt. Lines are buffered in memory and
+* written in large blocks; the file is flushed and closed when the
+* partition's reduce task returns. Call it only from the reducer's own
+* thread; calls from other threads are dropped with a diagnostic on stderr.
+* Because reducers see keys in sorted order, every partition file is sorted;
+* with options->merge_output they are merged into output_dir/result.txt in a
+* tree of parallel merges once all reducers are done. With options->top_k,
+* each partition instead keeps the top_k highest values in a bounded heap,
+* and the heaps are merged into output_dir/top.txt, highest value first
+* Parameters:
+*     partition_idx - Index of the partition being reduced
+*     key           - Key to write
+*     value         - Value to write after the key
+*/
+void MR_EmitOutput(unsigned int partition_idx, const char *key, int64_t value);
+
+/**
+* Get the number of bytes a partition's arena held for keys and values
+* during a run
+* Parameters:
+*     results       - Results of the run
+*     partition_idx - Index of the partition
+* Return:
+*     size_t        - Arena bytes used, or 0 for an unknown partition
+*/
+size_t MR_ArenaBytes(const MR_Results *results, unsigned int partition_idx);
+
+/**
+* Get the number of key ranges a partition was reduced in during a run: 1
+* unless balance_reduce split it
+* Parameters:
+*     results       - Results of the run
+*     partition_idx - Index of the partition
+* Return:
+*     unsigned int  - Number of ranges, or 0 for an unknown partition
+*/
+unsigned int MR_ReduceRanges(const MR_Results *results, unsigned int partition_idx);
+
+/**
+* Get the result cache counters of a run
+* Parameters:
+*     results       - Results of the run
+*     stats         - Filled in with the counters
+*/
+void MR_GetCacheStats(const MR_Results *results, MR_CacheStats *stats);
+
+/**
+* Get the worker process counters of a run
+* Parameters:
+*     results       - Results of the run
+*     stats         - Filled in with the counters
+*/
+void MR_GetWorkerStats(const MR_Results *results, MR_WorkerStats *stats);
+
+/**
+* Get the I/O stage counters of a run
+* Parameters:
+*     results       - Results of the run
+*     stats         - Filled in with the counters
+*/
+void MR_GetIOStats(const MR_Results *results, MR_IOStats *stats);
+
+/**
+* Get the key dictionary counters of a run
+* Parameters:
+*     results       - Results of the run
+*     stats         - Filled in with the counters
+*/
+void MR_GetInternStats(const MR_Results *results, MR_InternStats *stats);
+
+/**
+* Get the phase timings of a run
+* Parameters:
+*     results       - Results of the run
+*     times         - Filled in with the timings
+*/
+void MR_GetPhaseTimes(const MR_Results *results, MR_PhaseTimes *times);
+
+/**
+* Get the emit counters of a run: staging buffer flushes, and how many
+* partition locks map tasks took and how many of them had to wait
+* Parameters:
+*     results       - Results of the run
+*     stats         - Filled in with the counters
+*/
+void MR_GetEmitStats(const MR_Results *results, MR_EmitStats *stats);
+
+/**
+* Get the instrumentation of a partition in a run. Only collected when the
+* library is built with MR_ENABLE_STATS (make STATS=1)
+* Parameters:
+*     results       - Results of the run
+*     partition_idx - Index of the partition
+*     stats         - Filled in with the counters, or zeroed
+* Return:
+*     true          - When statistics were collected for the partition
+*     false         - Otherwise
+*/
+bool MR_GetPartitionStats(const MR_Results *results, unsigned int partition_idx, MR_PartitionStats *stats);
+
+/**
+* Get the number of bytes map tasks read from an input file through
+* MR_OpenInput in a run (only counted with MR_ENABLE_STATS)
+* Parameters:
+*     results       - Results of the run
+*     input_idx     - Index of the file in the run's file_names
+* Return:
+*     unsigned long - Bytes read, or 0 for an unknown input
+*/
+unsigned long MR_InputBytes(const MR_Results *results, unsigned int input_idx);
+
+/**
+* Write the statistics of a run as a JSON object: phase times and emit
+* counters, and in builds with MR_ENABLE_STATS the per-partition counters,
+* bytes read per input, and the thread pool. Per pool worker, run_seconds
+* and jobs count only this run's tasks; idle and queue lock wait times and
+* the queue depth series are the pool's over the span of the run, so they
+* include other jobs sharing the context
+* Parameters:
+*     results       - Results of the run
+*     path          - File to write
+* Return:
+*     true          - On success
+*     false         - When the file cannot be written
+*/
+bool MR_WriteStats(const MR_Results *results, const char *path);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,271 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "remote.h"
+
+// Coordinator ends of the sockets of every live worker in this process. A
+// new worker closes all of them, so the workers of another group still see
+// EOF once their coordinator closes its end
+static int *open_fds;
+static unsigned int open_count;
+static unsigned int open_capacity;
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Records a coordinator socket; called with open_lock held
+static void add_open_fd(int fd) {
+    if (open_count == open_capacity) {
+        open_capacity = open_capacity ? open_capacity * 2 : 16;
+        open_fds = realloc(open_fds, open_capacity * sizeof(int));
+    }
+    open_fds[open_count++] = fd;
+}
+
+// Closes a coordinator socket and forgets it
+static void close_open_fd(int fd) {
+    pthread_mutex_lock(&open_lock);
+    for (unsigned int i = 0; i < open_count; i++) {
+        if (open_fds[i] == fd) {
+            open_fds[i] = open_fds[--open_count];
+            break;
+        }
+    }
+    close(fd);
+    pthread_mutex_unlock(&open_lock);
+}
+
+// Makes room for extra more bytes in a message
+static void reserve(Remote_buffer_t *message, size_t extra) {
+    if (message->len + extra <= message->capacity) {
+        return;
+    }
+    size_t capacity = message->capacity ? message->capacity : 4096;
+    while (capacity < message->len + extra) {
+        capacity *= 2;
+    }
+    message->bytes = realloc(message->bytes, capacity);
+    message->capacity = capacity;
+}
+
+// Start worker processes connected by socket pairs
+Remote_group_t *Remote_start(unsigned int count, Remote_serve_t serve, void *arg) {
+    Remote_group_t *group = calloc(1, sizeof(Remote_group_t));
+    group->workers = calloc(count + 1, sizeof(Remote_worker_t));
+    fflush(NULL);
+
+    pthread_mutex_lock(&open_lock);
+    for (unsigned int i = 0; i < count; i++) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            perror("[Remote_start] socketpair");
+            break;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("[Remote_start] fork");
+            close(sockets[0]);
+            close(sockets[1]);
+            break;
+        }
+        if (pid == 0) {
+            // The child only keeps its own end, so every worker sees EOF
+            // once its coordinator goes away
+            close(sockets[0]);
+            for (unsigned int j = 0; j < open_count; j++) {
+                close(open_fds[j]);
+            }
+            serve(sockets[1], arg);
+            fflush(NULL);
+            _exit(0);
+        }
+        close(sockets[1]);
+        add_open_fd(sockets[0]);
+        group->workers[group->count].pid = pid;
+        group->workers[group->count].fd = sockets[0];
+        group->count++;
+    }
+    pthread_mutex_unlock(&open_lock);
+    group->alive = group->count;
+    return group;
+}
+
+// Wait for a live worker with something to read
+int Remote_poll(Remote_group_t *group) {
+    if (group->alive == 0) {
+        return -1;
+    }
+    struct pollfd *fds = malloc(group->count * sizeof(struct pollfd));
+    for (unsigned int i = 0; i < group->count; i++) {
+        fds[i].fd = group->workers[i].fd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    int ready = -1;
+    while (ready < 0) {
+        if (poll(fds, group->count, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[Remote_poll] poll");
+            break;
+        }
+        // Start after the worker served last time
+        for (unsigned int n = 0; n < group->count && ready < 0; n++) {
+            unsigned int i = (group->next_poll + n) % group->count;
+            if (fds[i].fd >= 0 && fds[i].revents) {
+                ready = (int)i;
+            }
+        }
+    }
+    free(fds);
+    if (ready >= 0) {
+        group->next_poll = (unsigned int)ready + 1;
+    }
+    return ready;
+}
+
+// Kill, close and reap a worker
+void Remote_lose(Remote_group_t *group, unsigned int index) {
+    Remote_worker_t *worker = &group->workers[index];
+    if (worker->fd < 0) {
+        return;
+    }
+    kill(worker->pid, SIGKILL);
+    close_open_fd(worker->fd);
+    waitpid(worker->pid, NULL, 0);
+    worker->fd = -1;
+    group->alive--;
+}
+
+// Stop every worker that is still alive
+void Remote_stop(Remote_group_t *group) {
+    for (unsigned int i = 0; i < group->count; i++) {
+        if (group->workers[i].fd >= 0) {
+            close_open_fd(group->workers[i].fd);
+        }
+    }
+    for (unsigned int i = 0; i < group->count; i++) {
+        if (group->workers[i].fd >= 0) {
+            waitpid(group->workers[i].pid, NULL, 0);
+        }
+    }
+    free(group->workers);
+    free(group);
+}
+
+// Writes all of data, retrying short writes
+static bool write_all(int fd, const void *data, size_t len) {
+    const char *pos = data;
+    while (len > 0) {
+        ssize_t wrote = send(fd, pos, len, MSG_NOSIGNAL);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pos += wrote;
+        len -= (size_t)wrote;
+    }
+    return true;
+}
+
+// Reads exactly len bytes; false on EOF or error
+static bool read_all(int fd, void *data, size_t len) {
+    char *pos = data;
+    while (len > 0) {
+        ssize_t got = read(fd, pos, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        pos += got;
+        len -= (size_t)got;
+    }
+    return true;
+}
+
+// Send a length-prefixed message
+bool Remote_send(int fd, const Remote_buffer_t *message) {
+    uint64_t len = message->len;
+    return write_all(fd, &len, sizeof(len)) && write_all(fd, message->bytes, message->len);
+}
+
+// Receive a length-prefixed message
+bool Remote_recv(int fd, Remote_buffer_t *message) {
+    uint64_t len;
+    message->len = 0;
+    if (!read_all(fd, &len, sizeof(len))) {
+        return false;
+    }
+    reserve(message, (size_t)len);
+    if (!read_all(fd, message->bytes, (size_t)len)) {
+        return false;
+    }
+    message->len = (size_t)len;
+    return true;
+}
+
+// Append an unsigned varint
+void Remote_put_varint(Remote_buffer_t *message, uint64_t value) {
+    reserve(message, 10);
+    while (value >= 0x80) {
+        message->bytes[message->len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    message->bytes[message->len++] = (unsigned char)value;
+}
+
+// Append a zigzag-encoded signed integer
+void Remote_put_int(Remote_buffer_t *message, int64_t value) {
+    Remote_put_varint(message, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+// Append raw bytes
+void Remote_put_bytes(Remote_buffer_t *message, const void *data, size_t len) {
+    reserve(message, len);
+    memcpy(message->bytes + message->len, data, len);
+    message->len += len;
+}
+
+// Read an unsigned varint
+bool Remote_get_varint(Remote_reader_t *reader, uint64_t *value) {
+    uint64_t result = 0;
+    for (unsigned int shift = 0; shift < 64 && reader->pos < reader->end; shift += 7) {
+        unsigned char byte = *reader->pos++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read a zigzag-encoded signed integer
+bool Remote_get_int(Remote_reader_t *reader, int64_t *value) {
+    uint64_t encoded;
+    if (!Remote_get_varint(reader, &encoded)) {
+        return false;
+    }
+    *value = (int64_t)(encoded >> 1) ^ -(int64_t)(encoded & 1);
+    return true;
+}
+
+// Read raw bytes in place
+const void *Remote_get_bytes(Remote_reader_t *reader, size_t len) {
+    if (len > (size_t)(reader->end - reader->pos)) {
+        return NULL;
+    }
+    const void *data = reader->pos;
+    reader->pos += len;
+    return data;
+}
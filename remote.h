@@ -0,0 +1,166 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Growable message buffer. Messages are sequences of varints and raw bytes,
+// sent with an eight-byte length in front
+typedef struct {
+    unsigned char *bytes;
+    size_t len;
+    size_t capacity;
+} Remote_buffer_t;
+
+// Read position in a received message
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+} Remote_reader_t;
+
+// A worker process and the coordinator's end of its socket. fd is -1 once
+// the worker is lost
+typedef struct {
+    pid_t pid;
+    int fd;
+} Remote_worker_t;
+
+// The worker processes of a coordinator
+typedef struct {
+    Remote_worker_t *workers;
+    unsigned int count;
+    unsigned int alive;
+    unsigned int next_poll;
+} Remote_group_t;
+
+// Body of a worker process: serves requests read from fd until the
+// coordinator closes its end
+typedef void (*Remote_serve_t)(int fd, void *arg);
+
+/**
+ * Fork worker processes, each connected to the coordinator by a Unix-domain
+ * socket pair. A child runs serve on its end and exits when it returns,
+ * without running atexit handlers. stdio buffers are flushed first so the
+ * children do not write them out again. The children do not exec, so call
+ * this before the process starts threads that may hold locks (malloc's,
+ * stdio's) a child would then find taken. A child closes the coordinator
+ * ends of every other group's sockets
+ * Parameters:
+ *     count - Number of workers to start
+ *     serve - Body of each worker
+ *     arg   - Argument passed to serve
+ * Return:
+ *     Remote_group_t* - The workers that could be started (possibly none)
+ */
+Remote_group_t *Remote_start(unsigned int count, Remote_serve_t serve, void *arg);
+
+/**
+ * Wait until a live worker has a message to read or has gone away. Workers
+ * are checked round-robin, so a busy one cannot starve the others
+ * Parameters:
+ *     group - Workers to wait for
+ * Return:
+ *     int   - Index of the worker, or -1 when none is alive
+ */
+int Remote_poll(Remote_group_t *group);
+
+/**
+ * Give up on a worker: kill it if it is still running, close its socket
+ * and reap it
+ * Parameters:
+ *     group - Group of the worker
+ *     index - Index of the worker
+ */
+void Remote_lose(Remote_group_t *group, unsigned int index);
+
+/**
+ * Close every worker's socket, which makes the workers exit, reap them and
+ * free the group
+ * Parameters:
+ *     group - Workers to stop
+ */
+void Remote_stop(Remote_group_t *group);
+
+/**
+ * Send a message. SIGPIPE is suppressed; a peer that has gone away makes
+ * the send fail instead
+ * Parameters:
+ *     fd      - Socket to write
+ *     message - Message to send
+ * Return:
+ *     true    - On success
+ *     false   - When the peer is gone
+ */
+bool Remote_send(int fd, const Remote_buffer_t *message);
+
+/**
+ * Receive a whole message into a buffer, replacing its contents
+ * Parameters:
+ *     fd      - Socket to read
+ *     message - Receives the message
+ * Return:
+ *     true    - On success
+ *     false   - When the peer closed the socket or died, even mid-message
+ */
+bool Remote_recv(int fd, Remote_buffer_t *message);
+
+/**
+ * Append an unsigned varint to a message
+ * Parameters:
+ *     message - Message to extend
+ *     value   - Value to append
+ */
+void Remote_put_varint(Remote_buffer_t *message, uint64_t value);
+
+/**
+ * Append a signed integer (zigzag varint) to a message
+ * Parameters:
+ *     message - Message to extend
+ *     value   - Value to append
+ */
+void Remote_put_int(Remote_buffer_t *message, int64_t value);
+
+/**
+ * Append raw bytes to a message
+ * Parameters:
+ *     message - Message to extend
+ *     data    - Bytes to append
+ *     len     - Number of bytes
+ */
+void Remote_put_bytes(Remote_buffer_t *message, const void *data, size_t len);
+
+/**
+ * Read an unsigned varint
+ * Parameters:
+ *     reader - Read position, advanced past the value
+ *     value  - Receives the value
+ * Return:
+ *     true   - On success
+ *     false  - At the end of the message
+ */
+bool Remote_get_varint(Remote_reader_t *reader, uint64_t *value);
+
+/**
+ * Read a signed integer written by Remote_put_int
+ * Parameters:
+ *     reader - Read position, advanced past the value
+ *     value  - Receives the value
+ * Return:
+ *     true   - On success
+ *     false  - At the end of the message
+ */
+bool Remote_get_int(Remote_reader_t *reader, int64_t *value);
+
+/**
+ * Read raw bytes in place
+ * Parameters:
+ *     reader - Read position, advanced past the bytes
+ *     len    - Number of bytes
+ * Return:
+ *     const void* - The bytes inside the message, or NULL if too few are left
+ */
+const void *Remote_get_bytes(Remote_reader_t *reader, size_t len);
+
+#endif
@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sketch.h"
+
+// Rows of the Count-Min sketch; each row fails to bound a key's error with
+// probability 1/e, so five rows fail together less than 1% of the time
+#define SKETCH_DEPTH 5
+
+// Hashes a key with 64-bit FNV-1a and a final avalanche, so that both
+// halves are usable as independent row hashes
+static uint64_t sketch_hash(const char *key, size_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Returns the counter of a row for a hash, by double hashing
+static inline uint64_t *row_counter(const Sketch_t *sketch, unsigned int row, uint64_t hash) {
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    return &sketch->counters[(size_t)row * sketch->width + ((h1 + row * h2) & (sketch->width - 1))];
+}
+
+// Count-Min estimate for a hash: the smallest of its counters
+static uint64_t estimate_hash(const Sketch_t *sketch, uint64_t hash) {
+    uint64_t best = *row_counter(sketch, 0, hash);
+    for (unsigned int row = 1; row < sketch->depth; row++) {
+        uint64_t value = *row_counter(sketch, row, hash);
+        if (value < best) {
+            best = value;
+        }
+    }
+    return best;
+}
+
+Sketch_t *Sketch_create(unsigned int capacity, double epsilon) {
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    if (epsilon <= 0 || epsilon >= 1) {
+        epsilon = 0.0001;
+    }
+    Sketch_t *sketch = calloc(1, sizeof(Sketch_t));
+    // The error bound needs at least e / epsilon counters per row; round up
+    // to a power of two so a row index is a mask
+    double needed = 2.718281828459045 / epsilon;
+    sketch->width = 1;
+    while (sketch->width < needed && sketch->width < (1u << 30)) {
+        sketch->width <<= 1;
+    }
+    sketch->depth = SKETCH_DEPTH;
+    sketch->counters = calloc((size_t)sketch->width * sketch->depth, sizeof(uint64_t));
+
+    // Keep the index at most half full
+    sketch->capacity = capacity;
+    sketch->index_capacity = 16;
+    while (sketch->index_capacity < capacity * 2) {
+        sketch->index_capacity <<= 1;
+    }
+    sketch->entries = calloc(capacity, sizeof(Sketch_entry_t));
+    sketch->heap = malloc(capacity * sizeof(unsigned int));
+    sketch->index = calloc(sketch->index_capacity, sizeof(unsigned int));
+    return sketch;
+}
+
+void Sketch_destroy(Sketch_t *sketch) {
+    if (!sketch) {
+        return;
+    }
+    for (unsigned int i = 0; i < sketch->capacity; i++) {
+        free(sketch->entries[i].key);
+    }
+    free(sketch->entries);
+    free(sketch->heap);
+    free(sketch->index);
+    free(sketch->counters);
+    free(sketch);
+}
+
+size_t Sketch_bytes(const Sketch_t *sketch) {
+    return sizeof(Sketch_t) + (size_t)sketch->width * sketch->depth * sizeof(uint64_t) +
+           sketch->capacity * (sizeof(Sketch_entry_t) + sizeof(unsigned int)) +
+           sketch->index_capacity * sizeof(unsigned int);
+}
+
+// Finds the index slot holding key, or the empty slot where it would go
+static unsigned int find_slot(const Sketch_t *sketch, const char *key, size_t len, uint64_t hash) {
+    unsigned int mask = sketch->index_capacity - 1;
+    unsigned int slot = (unsigned int)(hash >> 20) & mask;
+    while (sketch->index[slot] != 0) {
+        const Sketch_entry_t *entry = &sketch->entries[sketch->index[slot] - 1];
+        if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, key, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Removes a slot from the index, shifting later entries of its probe chain
+// back so lookups never stop early at a hole
+static void remove_slot(Sketch_t *sketch, unsigned int slot) {
+    unsigned int mask = sketch->index_capacity - 1;
+    unsigned int next = (slot + 1) & mask;
+    while (sketch->index[next] != 0) {
+        uint64_t hash = sketch->entries[sketch->index[next] - 1].hash;
+        unsigned int home = (unsigned int)(hash >> 20) & mask;
+        // Move the entry into the hole unless its home lies cyclically in
+        // (slot, next], where it is still reachable
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            sketch->index[slot] = sketch->index[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    sketch->index[slot] = 0;
+}
+
+// Swaps two heap positions and keeps the entries' back-pointers in step
+static inline void heap_swap(Sketch_t *sketch, unsigned int a, unsigned int b) {
+    unsigned int entry = sketch->heap[a];
+    sketch->heap[a] = sketch->heap[b];
+    sketch->heap[b] = entry;
+    sketch->entries[sketch->heap[a]].heap_pos = a;
+    sketch->entries[sketch->heap[b]].heap_pos = b;
+}
+
+static void sift_up(Sketch_t *sketch, unsigned int pos) {
+    while (pos > 0) {
+        unsigned int parent = (pos - 1) / 2;
+        if (sketch->entries[sketch->heap[parent]].heap_count <= sketch->entries[sketch->heap[pos]].heap_count) {
+            break;
+        }
+        heap_swap(sketch, pos, parent);
+        pos = parent;
+    }
+}
+
+static void sift_down(Sketch_t *sketch, unsigned int pos) {
+    for (;;) {
+        unsigned int smallest = pos;
+        unsigned int left = 2 * pos + 1;
+        unsigned int right = left + 1;
+        if (left < sketch->size &&
+            sketch->entries[sketch->heap[left]].heap_count < sketch->entries[sketch->heap[smallest]].heap_count) {
+            smallest = left;
+        }
+        if (right < sketch->size &&
+            sketch->entries[sketch->heap[right]].heap_count < sketch->entries[sketch->heap[smallest]].heap_count) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            return;
+        }
+        heap_swap(sketch, pos, smallest);
+        pos = smallest;
+    }
+}
+
+// Copies a key into an entry, reusing the entry's buffer when it fits
+static void set_key(Sketch_entry_t *entry, const char *key, size_t len, uint64_t hash) {
+    if (!entry->key || entry->key_len < len) {
+        free(entry->key);
+        entry->key = malloc(len + 1);
+    }
+    memcpy(entry->key, key, len);
+    entry->key[len] = '\0';
+    entry->key_len = len;
+    entry->hash = hash;
+}
+
+// Raises a key's counters to at least value, the conservative update
+static void raise_counters(Sketch_t *sketch, uint64_t hash, uint64_t value) {
+    for (unsigned int row = 0; row < sketch->depth; row++) {
+        uint64_t *counter = row_counter(sketch, row, hash);
+        if (*counter < value) {
+            *counter = value;
+        }
+    }
+}
+
+void Sketch_add(Sketch_t *sketch, const char *key, size_t len, uint64_t count) {
+    uint64_t hash = sketch_hash(key, len);
+    sketch->total += count;
+
+    // Monitored keys count exactly in the table and skip the Count-Min rows,
+    // so the frequent keys that make up most of the stream touch one entry
+    // instead of depth scattered counters. The heap is fixed up lazily
+    unsigned int slot = find_slot(sketch, key, len, hash);
+    if (sketch->index[slot] != 0) {
+        sketch->entries[sketch->index[slot] - 1].count += count;
+        return;
+    }
+
+    // Conservative update: raise only the counters below the new estimate,
+    // which keeps every estimate an upper bound with less overshoot
+    uint64_t estimate = estimate_hash(sketch, hash) + count;
+    raise_counters(sketch, hash, estimate);
+
+    // A new key enters with its Count-Min estimate, which already bounds
+    // what it had before. Once the table is full it only replaces the
+    // smallest entry if it is larger, so rare keys do not churn the table
+    if (sketch->size < sketch->capacity) {
+        unsigned int e = sketch->size++;
+        Sketch_entry_t *entry = &sketch->entries[e];
+        set_key(entry, key, len, hash);
+        entry->count = estimate;
+        entry->heap_count = estimate;
+        entry->heap_pos = e;
+        sketch->heap[e] = e;
+        sketch->index[slot] = e + 1;
+        sift_up(sketch, e);
+        return;
+    }
+    // Counts only grow, so heap_count never exceeds count and a root whose
+    // heap_count is current holds the smallest count
+    Sketch_entry_t *entry = &sketch->entries[sketch->heap[0]];
+    while (entry->heap_count != entry->count) {
+        entry->heap_count = entry->count;
+        sift_down(sketch, 0);
+        entry = &sketch->entries[sketch->heap[0]];
+    }
+    unsigned int e = sketch->heap[0];
+    if (estimate <= entry->count) {
+        return;
+    }
+
+    // The evicted key's counters must cover what it counted in the table
+    raise_counters(sketch, entry->hash, entry->count);
+    remove_slot(sketch, find_slot(sketch, entry->key, entry->key_len, entry->hash));
+    set_key(entry, key, len, hash);
+    entry->count = estimate;
+    entry->heap_count = estimate;
+    sketch->index[find_slot(sketch, key, len, hash)] = e + 1;
+    sift_down(sketch, 0);
+}
+
+uint64_t Sketch_estimate(const Sketch_t *sketch, const char *key, size_t len) {
+    uint64_t hash = sketch_hash(key, len);
+    unsigned int slot = find_slot(sketch, key, len, hash);
+    if (sketch->index[slot] != 0) {
+        return sketch->entries[sketch->index[slot] - 1].count;
+    }
+    return estimate_hash(sketch, hash);
+}
+
+// Orders candidates by hash then key, so duplicates end up adjacent
+static int compare_candidates(const void *a, const void *b) {
+    const Sketch_entry_t *x = *(Sketch_entry_t *const *)a;
+    const Sketch_entry_t *y = *(Sketch_entry_t *const *)b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return strcmp(x->key, y->key);
+}
+
+// Orders results by count, highest first, then by key
+static int compare_items(const void *a, const void *b) {
+    const Sketch_item_t *x = a;
+    const Sketch_item_t *y = b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    return strcmp(x->key, y->key);
+}
+
+unsigned int Sketch_top(Sketch_t **sketches, unsigned int count, Sketch_item_t *items, unsigned int max) {
+    if (count == 0 || max == 0) {
+        return 0;
+    }
+
+    // Gather every monitored key once
+    size_t total = 0;
+    for (unsigned int s = 0; s < count; s++) {
+        total += sketches[s]->size;
+    }
+    Sketch_entry_t **candidates = malloc((total + 1) * sizeof(Sketch_entry_t *));
+    size_t n = 0;
+    for (unsigned int s = 0; s < count; s++) {
+        for (unsigned int i = 0; i < sketches[s]->size; i++) {
+            candidates[n++] = &sketches[s]->entries[i];
+        }
+    }
+    qsort(candidates, n, sizeof(Sketch_entry_t *), compare_candidates);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique == 0 || compare_candidates(&candidates[unique - 1], &candidates[i]) != 0) {
+            candidates[unique++] = candidates[i];
+        }
+    }
+
+    // Bound each candidate by the sum of the per-sketch bounds: its exact
+    // count where a sketch monitors it, its Count-Min estimate elsewhere
+    Sketch_item_t *results = malloc((unique + 1) * sizeof(Sketch_item_t));
+    for (size_t i = 0; i < unique; i++) {
+        const Sketch_entry_t *candidate = candidates[i];
+        uint64_t bound = 0;
+        for (unsigned int s = 0; s < count; s++) {
+            const Sketch_t *sketch = sketches[s];
+            unsigned int slot = find_slot(sketch, candidate->key, candidate->key_len, candidate->hash);
+            if (sketch->index[slot] != 0) {
+                bound += sketch->entries[sketch->index[slot] - 1].count;
+            } else {
+                bound += estimate_hash(sketch, candidate->hash);
+            }
+        }
+        results[i].key = candidate->key;
+        results[i].count = bound;
+    }
+
+    // Fold the table counts into each Count-Min table, then sum the tables
+    // into the first sketch and tighten the bounds
+    for (unsigned int s = 0; s < count; s++) {
+        for (unsigned int i = 0; i < sketches[s]->size; i++) {
+            const Sketch_entry_t *entry = &sketches[s]->entries[i];
+            raise_counters(sketches[s], entry->hash, entry->count);
+        }
+    }
+    Sketch_t *merged = sketches[0];
+    size_t cells = (size_t)merged->width * merged->depth;
+    for (unsigned int s = 1; s < count; s++) {
+        for (size_t c = 0; c < cells; c++) {
+            merged->counters[c] += sketches[s]->counters[c];
+        }
+        merged->total += sketches[s]->total;
+    }
+    for (size_t i = 0; i < unique; i++) {
+        uint64_t estimate = estimate_hash(merged, candidates[i]->hash);
+        if (estimate < results[i].count) {
+            results[i].count = estimate;
+        }
+    }
+
+    qsort(results, unique, sizeof(Sketch_item_t), compare_items);
+    unsigned int filled = unique < max ? (unsigned int)unique : max;
+    memcpy(items, results, filled * sizeof(Sketch_item_t));
+    free(results);
+    free(candidates);
+    return filled;
+}
@@ -0,0 +1,110 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A frequent key and an upper bound on its count
+typedef struct {
+    const char *key;
+    uint64_t count;
+} Sketch_item_t;
+
+// Entry of the Space-Saving table: a monitored key and an upper bound on
+// its count (its Count-Min estimate on entry plus everything since).
+// heap_count is the count the heap last ordered the entry by
+typedef struct {
+    char *key;
+    size_t key_len;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t heap_count;
+    unsigned int heap_pos;
+} Sketch_entry_t;
+
+// Fixed-size frequency summary of one stream: a Count-Min sketch of depth
+// rows by width counters, plus a Space-Saving table of the capacity most
+// frequent keys. The table is a min-heap on heap_count (heap) with an
+// open-addressing index of entry positions + 1 (index)
+typedef struct {
+    uint64_t *counters;
+    unsigned int width;
+    unsigned int depth;
+    Sketch_entry_t *entries;
+    unsigned int *heap;
+    unsigned int *index;
+    unsigned int index_capacity;
+    unsigned int size;
+    unsigned int capacity;
+    uint64_t total;
+} Sketch_t;
+
+/**
+ * C style constructor for a sketch. Its memory is fixed at creation, apart
+ * from the copies of the keys currently in the Space-Saving table
+ * Parameters:
+ *     capacity - Number of frequent keys to track
+ *     epsilon  - Count-Min error, as a fraction of the total count
+ * Return:
+ *     Sketch_t* - The new sketch
+ */
+Sketch_t *Sketch_create(unsigned int capacity, double epsilon);
+
+/**
+ * C style destructor for a sketch
+ * Parameters:
+ *     sketch - Sketch to destroy
+ */
+void Sketch_destroy(Sketch_t *sketch);
+
+/**
+ * Count occurrences of a key. Keys in the Space-Saving table are counted
+ * there only; other keys go to the Count-Min table and replace the smallest
+ * table entry once their estimate exceeds its count
+ * Parameters:
+ *     sketch - Sketch to update
+ *     key    - Key bytes (need not be NUL-terminated)
+ *     len    - Length of the key
+ *     count  - Number of occurrences to add
+ */
+void Sketch_add(Sketch_t *sketch, const char *key, size_t len, uint64_t count);
+
+/**
+ * Get an estimate of a key's count, which never underestimates and
+ * overestimates by at most epsilon * total with high probability
+ * Parameters:
+ *     sketch - Sketch to query
+ *     key    - Key bytes
+ *     len    - Length of the key
+ * Return:
+ *     uint64_t - Estimated count
+ */
+uint64_t Sketch_estimate(const Sketch_t *sketch, const char *key, size_t len);
+
+/**
+ * Merge sketches of disjoint parts of a stream and list the most frequent
+ * keys overall. Count-Min tables are summed; every key monitored by any
+ * Space-Saving table is a candidate, and its count is the smaller of the
+ * merged Count-Min estimate and the sum of per-sketch upper bounds. All
+ * sketches must have been created with the same parameters
+ * Parameters:
+ *     sketches - Sketches to merge; the first one receives the merged counters
+ *     count    - Number of sketches
+ *     items    - Array receiving the top keys, highest count first; the keys
+ *                point into the sketches
+ *     max      - Size of items
+ * Return:
+ *     unsigned int - Number of items filled in
+ */
+unsigned int Sketch_top(Sketch_t **sketches, unsigned int count, Sketch_item_t *items, unsigned int max);
+
+/**
+ * Get the memory a sketch occupies, excluding key copies
+ * Parameters:
+ *     sketch - Sketch to measure
+ * Return:
+ *     size_t - Bytes used
+ */
+size_t Sketch_bytes(const Sketch_t *sketch);
+
+#endif
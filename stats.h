@@ -0,0 +1,20 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Instrumentation of the thread pool and the MapReduce library is compiled
+// in only when MR_ENABLE_STATS is defined (make STATS=1). Without it the
+// counters and timers expand to nothing, so the hot paths are the same as
+// in an uninstrumented build; the query functions still exist and report
+// that no statistics were collected
+
+// Reads the monotonic clock in nanoseconds
+static inline uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "mapreduce.h"
 #include "threadpool.h"
 
@@ -21,14 +25,69 @@ void test_mapper(char *file_name) {
     fclose(fp);
 }
 
+// Mapper that uses the typed integer value path
+void test_int_mapper(char *file_name) {
+    FILE *fp = fopen(file_name, "r");
+    if (!fp) {
+        perror("Error opening file");
+        return;
+    }
+
+    char word[256];
+    while (fscanf(fp, "%s", word) != EOF) {
+        MR_EmitInt(word, 1);
+    }
+
+    fclose(fp);
+}
+
+// Split-aware mapper that only reads its byte range
+void test_split_mapper(MR_Split *split) {
+    FILE *fp = fopen(split->file_name, "r");
+    if (!fp) {
+        perror("Error opening file");
+        return;
+    }
+
+    char *buffer = malloc(split->length + 1);
+    fseek(fp, split->offset, SEEK_SET);
+    size_t got = fread(buffer, 1, split->length, fp);
+    buffer[got] = '\0';
+
+    char *token, *rest = buffer;
+    while ((token = strsep(&rest, " \t\n\r")) != NULL) {
+        MR_EmitInt(token, 1);
+    }
+
+    free(buffer);
+    fclose(fp);
+}
+
+// Split-aware mapper that reads through the library's mapped input
+void test_mapped_mapper(MR_Split *split) {
+    MR_Input input;
+    assert(MR_OpenInput(split, &input));
+
+    size_t start = 0;
+    for (size_t i = 0; i <= input.length; i++) {
+        if (i == input.length || input.data[i] == ' ' || input.data[i] == '\n') {
+            MR_EmitIntSlice(input.data + start, i - start, 1);
+            start = i + 1;
+        }
+    }
+
+    MR_CloseInput(&input);
+}
+
 typedef struct {
     char word[256];
     int count;
 } WordCount;
 
 // Global variable to store reduce results for verification
-WordCount reduce_results[256];
+WordCount reduce_results[512];
 int reduce_result_count = 0;
+pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void test_reducer(char *key, unsigned int partition_idx) {
     int count = 0;
@@ -39,9 +98,28 @@ void test_reducer(char *key, unsigned int partition_idx) {
     }
 
     // Store result in global array for verification
+    pthread_mutex_lock(&results_mutex);
     strcpy(reduce_results[reduce_result_count].word, key);
     reduce_results[reduce_result_count].count = count;
     reduce_result_count++;
+    pthread_mutex_unlock(&results_mutex);
+}
+
+void test_int_reducer(char *key, unsigned int partition_idx) {
+    int64_t count = 0, value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        count += value;
+    }
+
+    pthread_mutex_lock(&results_mutex);
+    strcpy(reduce_results[reduce_result_count].word, key);
+    reduce_results[reduce_result_count].count = (int)count;
+    reduce_result_count++;
+    pthread_mutex_unlock(&results_mutex);
+}
+
+int64_t test_sum_combiner(int64_t accumulated, int64_t value) {
+    return accumulated + value;
 }
 
 // Helper function to create a test file with content
@@ -186,6 +264,1190 @@ void test_large_input() {
     printf("Test 5 passed: Large input handled.\n");
 }
 
+// Test 6: Many Distinct Keys
+void test_many_distinct_keys() {
+    printf("Test 6: Many Distinct Keys\n");
+
+    // Enough distinct words to force every partition index to grow
+    FILE *file = fopen("test6.txt", "w");
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 400; i++) {
+            fprintf(file, "w%d ", i);
+        }
+    }
+    fclose(file);
+
+    char *files[] = {"test6.txt"};
+    reduce_result_count = 0;
+
+    MR_Options options = {0};
+    options.results = MR_CreateResults();
+    MR_RunWithOptions(1, files, test_mapper, test_reducer, 2, 2, &options);
+
+    // Verify results
+    assert(reduce_result_count == 400);
+    verify_result("w0", 2);
+    verify_result("w199", 2);
+    verify_result("w399", 2);
+
+    // Both partitions held keys and values in their arenas
+    assert(MR_ArenaBytes(options.results, 0) > 0 && MR_ArenaBytes(options.results, 1) > 0);
+    assert(MR_ArenaBytes(options.results, 2) == 0);
+    MR_DestroyResults(options.results);
+
+    // Cleanup
+    remove("test6.txt");
+
+    printf("Test 6 passed: Many distinct keys.\n");
+}
+
+// Test 7: Integer Values
+void test_int_values() {
+    printf("Test 7: Integer Values\n");
+
+    create_test_file("test7a.txt", "red green red blue");
+    create_test_file("test7b.txt", "red blue");
+
+    char *files[] = {"test7a.txt", "test7b.txt"};
+    reduce_result_count = 0;
+
+    MR_Run(2, files, test_int_mapper, test_int_reducer, 2, 2);
+
+    // Verify results
+    verify_result("red", 3);
+    verify_result("green", 1);
+    verify_result("blue", 2);
+
+    // Cleanup
+    remove("test7a.txt");
+    remove("test7b.txt");
+
+    printf("Test 7 passed: Integer values.\n");
+}
+
+// Test 8: Map-Side Combiner
+void test_combiner() {
+    printf("Test 8: Map-Side Combiner\n");
+
+    create_test_file("test8a.txt", "the the the cat the dog cat");
+    create_test_file("test8b.txt", "the dog the bird");
+
+    char *files[] = {"test8a.txt", "test8b.txt"};
+    reduce_result_count = 0;
+
+    // A tiny limit forces flushes in the middle of a map task
+    MR_Options options = {0};
+    options.combiner = test_sum_combiner;
+    options.combine_limit = 2;
+    MR_RunWithOptions(2, files, test_int_mapper, test_int_reducer, 2, 3, &options);
+
+    // Verify results
+    verify_result("the", 6);
+    verify_result("cat", 2);
+    verify_result("dog", 2);
+    verify_result("bird", 1);
+
+    // Cleanup
+    remove("test8a.txt");
+    remove("test8b.txt");
+
+    printf("Test 8 passed: Map-side combiner.\n");
+}
+
+// Test 9: Input Splits
+void test_input_splits() {
+    printf("Test 9: Input Splits\n");
+
+    create_test_file("test9.txt", "alpha beta gamma alpha\nbeta alpha delta\n  epsilon alpha");
+
+    char *files[] = {"test9.txt"};
+    reduce_result_count = 0;
+
+    // Splits far smaller than a line, so boundaries land inside words
+    MR_Options options = {0};
+    options.split_mapper = test_split_mapper;
+    options.split_size = 7;
+    MR_RunWithOptions(1, files, NULL, test_int_reducer, 3, 2, &options);
+
+    // Verify results
+    assert(reduce_result_count == 5);
+    verify_result("alpha", 4);
+    verify_result("beta", 2);
+    verify_result("gamma", 1);
+    verify_result("delta", 1);
+    verify_result("epsilon", 1);
+
+    // Cleanup
+    remove("test9.txt");
+
+    printf("Test 9 passed: Input splits.\n");
+}
+
+// Test 10: Mapped Input Reader
+void test_mapped_input() {
+    printf("Test 10: Mapped Input Reader\n");
+
+    // Long enough that splits start past the first page of the file
+    FILE *file = fopen("test10.txt", "w");
+    for (int i = 0; i < 3000; i++) {
+        fprintf(file, "%s\n", i % 3 == 0 ? "fizz" : "plain text");
+    }
+    fclose(file);
+
+    char *files[] = {"test10.txt"};
+    reduce_result_count = 0;
+
+    MR_Options options = {0};
+    options.split_mapper = test_mapped_mapper;
+    options.split_size = 5000;
+    MR_RunWithOptions(1, files, NULL, test_int_reducer, 2, 2, &options);
+
+    // Verify results
+    assert(reduce_result_count == 3);
+    verify_result("fizz", 1000);
+    verify_result("plain", 2000);
+    verify_result("text", 2000);
+
+    // Cleanup
+    remove("test10.txt");
+
+    printf("Test 10 passed: Mapped input reader.\n");
+}
+
+// Test 11: Work-Stealing Pool
+void test_work_stealing_pool() {
+    printf("Test 11: Work-Stealing Pool\n");
+
+    create_test_file("test11a.txt", "one two two three three three");
+    create_test_file("test11b.txt", "three two one one");
+
+    char *files[] = {"test11a.txt", "test11b.txt"};
+    reduce_result_count = 0;
+
+    MR_Options options = {0};
+    options.split_mapper = test_split_mapper;
+    options.split_size = 4;
+    options.pool_mode = TP_MODE_WORK_STEALING;
+    MR_RunWithOptions(2, files, NULL, test_int_reducer, 3, 4, &options);
+
+    // Verify results
+    verify_result("one", 3);
+    verify_result("two", 3);
+    verify_result("three", 4);
+
+    // Cleanup
+    remove("test11a.txt");
+    remove("test11b.txt");
+
+    printf("Test 11 passed: Work-stealing pool.\n");
+}
+
+// Test 12: Pipelined Shuffle
+void test_pipeline() {
+    printf("Test 12: Pipelined Shuffle\n");
+
+    // One key per run forces many runs and several background merges
+    FILE *file = fopen("test12.txt", "w");
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 50; i++) {
+            fprintf(file, "p%d ", i);
+        }
+    }
+    fclose(file);
+
+    char *files[] = {"test12.txt"};
+    reduce_result_count = 0;
+
+    MR_Options options = {0};
+    options.pipeline = true;
+    options.combine_limit = 1;
+    MR_RunWithOptions(1, files, test_mapper, test_reducer, 2, 2, &options);
+
+    // Verify results
+    assert(reduce_result_count == 50);
+    verify_result("p0", 3);
+    verify_result("p49", 3);
+
+    // Integer values folded by the combiner while runs are merged
+    reduce_result_count = 0;
+    options.combiner = test_sum_combiner;
+    options.split_mapper = test_split_mapper;
+    options.split_size = 16;
+    MR_RunWithOptions(1, files, NULL, test_int_reducer, 3, 3, &options);
+
+    assert(reduce_result_count == 50);
+    verify_result("p7", 3);
+    verify_result("p42", 3);
+
+    // Cleanup
+    remove("test12.txt");
+
+    printf("Test 12 passed: Pipelined shuffle.\n");
+}
+
+// Reducer that writes its totals through the library's output writer
+void test_output_reducer(char *key, unsigned int partition_idx) {
+    int64_t count = 0, value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        count += value;
+    }
+    MR_EmitOutput(partition_idx, key, count - 5);
+}
+
+// Test 13: Buffered Output Writer
+void test_output_writer() {
+    printf("Test 13: Buffered Output Writer\n");
+
+    create_test_file("test13.txt", "sun moon sun star sun moon moon moon moon moon moon");
+
+    char *files[] = {"test13.txt"};
+    MR_Options options = {0};
+    options.output_dir = "test13_out";
+    MR_RunWithOptions(1, files, test_int_mapper, test_output_reducer, 2, 2, &options);
+
+    // Every line of both partition files, in any order
+    char lines[3][64];
+    int line_count = 0;
+    for (int p = 0; p < 2; p++) {
+        char name[64];
+        sprintf(name, "test13_out/result-%d.txt", p);
+        FILE *file = fopen(name, "r");
+        if (!file) {
+            continue;
+        }
+        while (line_count < 3 && fgets(lines[line_count], sizeof(lines[0]), file)) {
+            line_count++;
+        }
+        fclose(file);
+        remove(name);
+    }
+    assert(line_count == 3);
+
+    // Negative values are written with their sign
+    const char *expected[] = {"sun: -2\n", "moon: 2\n", "star: -4\n"};
+    for (int e = 0; e < 3; e++) {
+        bool found = false;
+        for (int i = 0; i < line_count; i++) {
+            found |= strcmp(lines[i], expected[e]) == 0;
+        }
+        assert(found);
+        printf("Verified line %s", expected[e]);
+    }
+
+    // Cleanup
+    remove("test13.txt");
+    rmdir("test13_out");
+
+    printf("Test 13 passed: Buffered output writer.\n");
+}
+
+// Test 14: Spill to Disk
+void test_spill_to_disk() {
+    printf("Test 14: Spill to Disk\n");
+
+    FILE *file = fopen("test14.txt", "w");
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 30; i++) {
+            fprintf(file, "s%d ", i);
+        }
+    }
+    fclose(file);
+
+    char *files[] = {"test14.txt"};
+    reduce_result_count = 0;
+
+    // A one-byte budget spills a partition after every insert
+    MR_Options options = {0};
+    options.memory_budget = 1;
+    options.spill_dir = ".";
+    MR_RunWithOptions(1, files, test_mapper, test_reducer, 2, 3, &options);
+
+    // Verify results
+    assert(reduce_result_count == 30);
+    verify_result("s0", 4);
+    verify_result("s29", 4);
+
+    // Integer values spilled from pipelined runs and merged on disk
+    reduce_result_count = 0;
+    options.pipeline = true;
+    options.combine_limit = 2;
+    options.combiner = test_sum_combiner;
+    MR_RunWithOptions(1, files, test_int_mapper, test_int_reducer, 2, 3, &options);
+
+    assert(reduce_result_count == 30);
+    verify_result("s5", 4);
+    verify_result("s17", 4);
+
+    // Cleanup
+    remove("test14.txt");
+
+    printf("Test 14 passed: Spill to disk.\n");
+}
+
+// Totals of the jobs run concurrently on one context
+int64_t context_totals[2];
+
+void context_reducer_a(char *key, unsigned int partition_idx) {
+    int64_t value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        __atomic_fetch_add(&context_totals[0], value, __ATOMIC_RELAXED);
+    }
+}
+
+void context_reducer_b(char *key, unsigned int partition_idx) {
+    int64_t value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        __atomic_fetch_add(&context_totals[1], value, __ATOMIC_RELAXED);
+    }
+}
+
+typedef struct {
+    MR_Context *context;
+    char *file;
+    Reducer reducer;
+    MR_Results *results;
+} ContextJob;
+
+// Runs a job without a combiner or staging, so each emit takes a lock
+void *run_context_job(void *arg) {
+    ContextJob *job = arg;
+    char *files[] = {job->file};
+    MR_Options options = {0};
+    options.emit_batch = 1;
+    options.results = job->results;
+    MR_RunInContext(job->context, 1, files, test_int_mapper, job->reducer, 3, &options);
+    return NULL;
+}
+
+// Test 15: Reusable Context
+void test_context() {
+    printf("Test 15: Reusable Context\n");
+
+    create_test_file("test15a.txt", "a b c a b a");
+    create_test_file("test15b.txt", "x y z x y x w w w w");
+    MR_Context *context = MR_CreateContext(3, NULL);
+
+    // Back-to-back jobs reuse the pool and the recycled partitions
+    char *files[] = {"test15a.txt"};
+    for (int round = 0; round < 3; round++) {
+        reduce_result_count = 0;
+        MR_RunInContext(context, 1, files, test_int_mapper, test_int_reducer, 2, NULL);
+        assert(reduce_result_count == 3);
+        verify_result("a", 3);
+        verify_result("c", 1);
+    }
+
+    // Two jobs at once on the same pool each see only their own data and
+    // get their own statistics
+    for (int round = 0; round < 5; round++) {
+        context_totals[0] = context_totals[1] = 0;
+        ContextJob jobs[2] = {{context, "test15a.txt", context_reducer_a, MR_CreateResults()},
+                              {context, "test15b.txt", context_reducer_b, MR_CreateResults()}};
+        pthread_t threads[2];
+        for (int i = 0; i < 2; i++) {
+            pthread_create(&threads[i], NULL, run_context_job, &jobs[i]);
+        }
+        for (int i = 0; i < 2; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        assert(context_totals[0] == 6);
+        assert(context_totals[1] == 10);
+        MR_EmitStats stats[2];
+        for (int i = 0; i < 2; i++) {
+            MR_GetEmitStats(jobs[i].results, &stats[i]);
+            MR_DestroyResults(jobs[i].results);
+        }
+        assert(stats[0].lock_acquisitions == 6 && stats[1].lock_acquisitions == 10);
+    }
+    printf("Verified concurrent job totals: 6 and 10\n");
+
+    // Emits from a thread running no task belong to no job and are dropped
+    MR_EmitInt("stray", 1);
+    reduce_result_count = 0;
+    MR_RunInContext(context, 1, files, test_int_mapper, test_int_reducer, 2, NULL);
+    assert(reduce_result_count == 3);
+    for (int i = 0; i < reduce_result_count; i++) {
+        assert(strcmp(reduce_results[i].word, "stray") != 0);
+    }
+
+    MR_DestroyContext(context);
+
+    // Cleanup
+    remove("test15a.txt");
+    remove("test15b.txt");
+
+    printf("Test 15 passed: Reusable context.\n");
+}
+
+// Keys in the order the reducer saw them
+char sorted_keys[2000][40];
+int sorted_key_count = 0;
+
+void order_reducer(char *key, unsigned int partition_idx) {
+    int64_t value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+    }
+    pthread_mutex_lock(&results_mutex);
+    strcpy(sorted_keys[sorted_key_count++], key);
+    pthread_mutex_unlock(&results_mutex);
+}
+
+// Test 16: Key Sort
+void test_key_sort() {
+    printf("Test 16: Key Sort\n");
+
+    // Keys sharing long prefixes, ending at and around 8-byte boundaries,
+    // and using bytes above 0x7f
+    FILE *file = fopen("test16.txt", "w");
+    const char *stem = "abcdefghijklmnopqrstuvwx";
+    for (int len = 1; len <= 24; len++) {
+        fprintf(file, "%.*s ", len, stem);
+    }
+    srand(16);
+    for (int i = 0; i < 1500; i++) {
+        int len = 1 + rand() % 20;
+        for (int c = 0; c < len; c++) {
+            fputc(c < 9 && i % 3 ? stem[c] : "ab\xc3\xa9zZ09"[rand() % 8], file);
+        }
+        fputc(i % 7 ? ' ' : '\n', file);
+    }
+    fclose(file);
+
+    char *files[] = {"test16.txt"};
+    sorted_key_count = 0;
+
+    // A tiny threshold makes every partition sort in parallel
+    MR_Options options = {0};
+    options.sort_threshold = 2;
+    MR_RunWithOptions(1, files, test_int_mapper, order_reducer, 4, 1, &options);
+
+    // Every key appears once, in strcmp order
+    assert(sorted_key_count > 500);
+    for (int i = 1; i < sorted_key_count; i++) {
+        assert(strcmp(sorted_keys[i - 1], sorted_keys[i]) < 0);
+    }
+    printf("Verified %d keys in order\n", sorted_key_count);
+
+    // Cleanup
+    remove("test16.txt");
+
+    printf("Test 16 passed: Key sort.\n");
+}
+
+// Reducer that writes word counts through the output writer
+void count_output_reducer(char *key, unsigned int partition_idx) {
+    int64_t count = 0, value;
+    while (MR_GetNextInt(key, partition_idx, &value)) {
+        count += value;
+    }
+    MR_EmitOutput(partition_idx, key, count);
+}
+
+// Test 17: Merged Output and Top-K
+void test_merged_output() {
+    printf("Test 17: Merged Output and Top-K\n");
+
+    FILE *file = fopen("test17.txt", "w");
+    for (int i = 0; i < 200; i++) {
+        for (int repeat = 0; repeat <= i % 10; repeat++) {
+            fprintf(file, "m%03d ", i);
+        }
+    }
+    fclose(file);
+
+    char *files[] = {"test17.txt"};
+    MR_Options options = {0};
+    options.output_dir = "test17_out";
+    options.merge_output = true;
+    MR_RunWithOptions(1, files, test_int_mapper, count_output_reducer, 3, 7, &options);
+
+    // One file holding every key in order, and no partition files left
+    file = fopen("test17_out/result.txt", "r");
+    assert(file);
+    char line[64], previous[64] = "";
+    int lines = 0;
+    while (fgets(line, sizeof(line), file)) {
+        assert(strcmp(previous, line) < 0);
+        strcpy(previous, line);
+        lines++;
+    }
+    fclose(file);
+    assert(lines == 200);
+    assert(access("test17_out/result-0.txt", F_OK) != 0);
+    remove("test17_out/result.txt");
+    printf("Verified %d merged lines in order\n", lines);
+
+    // Top 5: the 20 keys seen 10 times each, smallest keys first on ties
+    options.merge_output = false;
+    options.top_k = 5;
+    MR_RunWithOptions(1, files, test_int_mapper, count_output_reducer, 3, 7, &options);
+
+    file = fopen("test17_out/top.txt", "r");
+    assert(file);
+    const char *expected[] = {"m009: 10\n", "m019: 10\n", "m029: 10\n", "m039: 10\n", "m049: 10\n"};
+    lines = 0;
+    while (fgets(line, sizeof(line), file)) {
+        assert(lines < 5 && strcmp(line, expected[lines]) == 0);
+        lines++;
+    }
+    fclose(file);
+    assert(lines == 5);
+    printf("Verified top 5\n");
+
+    // Cleanup
+    remove("test17_out/top.txt");
+    rmdir("test17_out");
+    remove("test17.txt");
+
+    printf("Test 17 passed: Merged output and top-K.\n");
+}
+
+// Test 18: Approximate Heavy Hitters
+void test_heavy_hitters() {
+    printf("Test 18: Approximate Heavy Hitters\n");
+
+    // Five hot keys seen 600, 500, ..., 200 times among 6000 keys seen once,
+    // spread over three files so several workers' sketches are merged
+    char *files[] = {"test18a.txt", "test18b.txt", "test18c.txt"};
+    FILE *outputs[3];
+    for (int f = 0; f < 3; f++) {
+        outputs[f] = fopen(files[f], "w");
+    }
+    int emitted = 0;
+    for (int i = 0; i < 6000; i++) {
+        FILE *file = outputs[i % 3];
+        fprintf(file, "cold%d ", i);
+        emitted++;
+        for (int hot = 0; hot < 5; hot++) {
+            if (i % 60 < 6 - hot) {
+                fprintf(file, "hot%d ", hot);
+                emitted++;
+            }
+        }
+    }
+    for (int f = 0; f < 3; f++) {
+        fclose(outputs[f]);
+    }
+
+    MR_Options options = {0};
+    options.heavy_hitters = 5;
+    options.sketch_error = 0.01;
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, test_int_mapper, test_int_reducer, 3, 4, &options);
+
+    // Exactly the hot keys come back, never undercounted and overcounted by
+    // no more than the error bound
+    assert(reduce_result_count == 5);
+    for (int i = 0; i < reduce_result_count; i++) {
+        assert(strncmp(reduce_results[i].word, "hot", 3) == 0);
+        int expected = (6 - (reduce_results[i].word[3] - '0')) * 100;
+        assert(reduce_results[i].count >= expected);
+        assert(reduce_results[i].count <= expected + emitted / 100);
+        printf("Verified %s: count = %d (exact %d)\n", reduce_results[i].word,
+               reduce_results[i].count, expected);
+    }
+
+    // Cleanup
+    for (int f = 0; f < 3; f++) {
+        remove(files[f]);
+    }
+
+    printf("Test 18 passed: Approximate heavy hitters.\n");
+}
+
+// Mapper that emits one key with its values numbered in emit order
+void sequence_mapper(char *file_name) {
+    (void)file_name;
+    char value[16];
+    for (int i = 0; i < 3000; i++) {
+        sprintf(value, "%d", i);
+        MR_Emit(i % 2 ? "odd" : "even", value);
+    }
+}
+
+// Reducer that checks values arrive in the order they were stored, which
+// MR_GetNext hands back newest first
+void sequence_reducer(char *key, unsigned int partition_idx) {
+    int previous = 3000, count = 0;
+    char *value;
+    while ((value = MR_GetNext(key, partition_idx)) != NULL) {
+        assert(atoi(value) < previous);
+        previous = atoi(value);
+        count++;
+        free(value);
+    }
+    pthread_mutex_lock(&results_mutex);
+    strcpy(reduce_results[reduce_result_count].word, key);
+    reduce_results[reduce_result_count].count = count;
+    reduce_result_count++;
+    pthread_mutex_unlock(&results_mutex);
+}
+
+// Test 19: Staged Emits
+void test_staged_emits() {
+    printf("Test 19: Staged Emits\n");
+
+    FILE *file = fopen("test19.txt", "w");
+    for (int i = 0; i < 20000; i++) {
+        fprintf(file, "%s ", i % 3 ? "the" : (i % 5 ? "of" : "zipf"));
+    }
+    fclose(file);
+    char *files[] = {"test19.txt", "test19.txt", "test19.txt"};
+
+    // Unstaged: one lock acquisition per emit
+    MR_Options options = {0};
+    options.emit_batch = 1;
+    options.results = MR_CreateResults();
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, test_mapper, test_reducer, 3, 4, &options);
+    MR_EmitStats unstaged;
+    MR_GetEmitStats(options.results, &unstaged);
+    assert(unstaged.flushes == 0);
+    assert(unstaged.lock_acquisitions == 60000);
+    verify_result("the", 39999);
+    verify_result("zipf", 4002);
+
+    // Staged with a small batch: same counts, one lock per flush
+    for (unsigned int batch = 7; batch <= 1024; batch += 1017) {
+        options.emit_batch = batch;
+        reduce_result_count = 0;
+        MR_RunWithOptions(3, files, test_mapper, test_reducer, 3, 4, &options);
+        MR_EmitStats staged;
+        MR_GetEmitStats(options.results, &staged);
+        assert(staged.flushes > 0 && staged.lock_acquisitions == staged.flushes);
+        assert(staged.lock_acquisitions * batch >= 60000);
+        assert(staged.lock_waits <= staged.lock_acquisitions);
+        assert(reduce_result_count == 3);
+        verify_result("the", 39999);
+        verify_result("of", 15999);
+        verify_result("zipf", 4002);
+        printf("Batch %u: %lu lock acquisitions instead of %lu\n", batch,
+               staged.lock_acquisitions, unstaged.lock_acquisitions);
+    }
+
+    // Values keep their emit order through sorted flushes
+    options.emit_batch = 64;
+    reduce_result_count = 0;
+    MR_RunWithOptions(1, files, sequence_mapper, sequence_reducer, 2, 2, &options);
+    verify_result("even", 1500);
+    verify_result("odd", 1500);
+
+    // Cleanup
+    MR_DestroyResults(options.results);
+    remove("test19.txt");
+
+    printf("Test 19 passed: Staged emits.\n");
+}
+
+// Reads a whole output file into a malloc'd string
+char *read_output(const char *name) {
+    FILE *file = fopen(name, "r");
+    if (!file) {
+        return strdup("");
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *text = malloc(size + 1);
+    size_t got = fread(text, 1, size, file);
+    text[got] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Test 20: Skew-Aware Reduce
+void test_balanced_reduce() {
+    printf("Test 20: Skew-Aware Reduce\n");
+
+    // One stopword with most of the values among 400 rarer keys
+    FILE *file = fopen("test20.txt", "w");
+    for (int i = 0; i < 30000; i++) {
+        fprintf(file, "the ");
+        if (i % 75 == 0) {
+            fprintf(file, "k%03d ", i / 75);
+        }
+    }
+    fclose(file);
+    char *files[] = {"test20.txt"};
+    unsigned int hot = MR_Partitioner("the", 4);
+
+    // Reference output without splitting
+    MR_Options options = {0};
+    options.output_dir = "test20_out";
+    options.merge_output = true;
+    options.results = MR_CreateResults();
+    MR_RunWithOptions(1, files, test_int_mapper, count_output_reducer, 4, 4, &options);
+    char *expected = read_output("test20_out/result.txt");
+    remove("test20_out/result.txt");
+    assert(MR_ReduceRanges(options.results, hot) == 1);
+
+    // Split: the hot partition is reduced in several ranges, and the merged
+    // output (fed by the joined per-range files) is unchanged
+    options.balance_reduce = true;
+    MR_RunWithOptions(1, files, test_int_mapper, count_output_reducer, 4, 4, &options);
+    char *balanced = read_output("test20_out/result.txt");
+    remove("test20_out/result.txt");
+    assert(MR_ReduceRanges(options.results, hot) > 1);
+    for (unsigned int p = 0; p < 4; p++) {
+        assert(p == hot || MR_ReduceRanges(options.results, p) == 1);
+    }
+    assert(strlen(expected) > 0 && strcmp(expected, balanced) == 0);
+    printf("Verified partition %u reduced in %u ranges\n", hot, MR_ReduceRanges(options.results, hot));
+
+    // Counts and top-K are unchanged too
+    reduce_result_count = 0;
+    MR_RunWithOptions(1, files, test_int_mapper, test_int_reducer, 4, 4, &options);
+    assert(reduce_result_count == 401);
+    verify_result("the", 30000);
+    verify_result("k399", 1);
+    options.merge_output = false;
+    options.top_k = 2;
+    MR_RunWithOptions(1, files, test_int_mapper, count_output_reducer, 4, 4, &options);
+    char *top = read_output("test20_out/top.txt");
+    assert(strcmp(top, "the: 30000\nk000: 1\n") == 0);
+
+    // The phases of the last run were timed
+    MR_PhaseTimes times;
+    MR_GetPhaseTimes(options.results, &times);
+    assert(times.map_seconds > 0 && times.reduce_seconds > 0 && times.output_seconds >= 0);
+
+    // Cleanup
+    free(expected);
+    free(balanced);
+    free(top);
+    MR_DestroyResults(options.results);
+    remove("test20_out/top.txt");
+    rmdir("test20_out");
+    remove("test20.txt");
+
+    printf("Test 20 passed: Skew-aware reduce.\n");
+}
+
+// Test 21: Run Statistics
+void test_run_stats() {
+    printf("Test 21: Run Statistics\n");
+
+    FILE *file = fopen("test21a.txt", "w");
+    for (int i = 0; i < 5000; i++) {
+        fprintf(file, "a b a c ");
+    }
+    fclose(file);
+    file = fopen("test21b.txt", "w");
+    for (int i = 0; i < 3000; i++) {
+        fprintf(file, "a ");
+    }
+    fclose(file);
+    char *files[] = {"test21a.txt", "test21b.txt"};
+
+    MR_Options options = {0};
+    options.split_mapper = test_mapped_mapper;
+    options.split_size = 4096;
+    options.stats_file = "test21_stats.json";
+    options.results = MR_CreateResults();
+    reduce_result_count = 0;
+    MR_RunWithOptions(2, files, NULL, test_int_reducer, 3, 4, &options);
+    verify_result("a", 13000);
+
+    char *json = read_output("test21_stats.json");
+    assert(strstr(json, "\"phases\"") && strstr(json, "\"partitions\""));
+
+    MR_PartitionStats stats;
+    if (MR_GetPartitionStats(options.results, 0, &stats)) {
+        // Every emit, key and input byte is accounted for
+        unsigned long emits = 0, keys = 0;
+        double hold = 0;
+        for (unsigned int p = 0; p < 4; p++) {
+            assert(MR_GetPartitionStats(options.results, p, &stats));
+            emits += stats.emits;
+            keys += stats.keys;
+            hold += stats.lock_hold_seconds;
+        }
+        assert(!MR_GetPartitionStats(options.results, 4, &stats));
+        assert(emits == 23000 && keys == 3 && hold > 0);
+        assert(MR_InputBytes(options.results, 0) == 40000 && MR_InputBytes(options.results, 1) == 6000 && MR_InputBytes(options.results, 2) == 0);
+        assert(strstr(json, "\"stats_enabled\": true") && strstr(json, "\"queue_depth\""));
+        assert(strstr(json, "\"file\": \"test21b.txt\", \"bytes_read\": 6000"));
+        printf("Verified %lu emits and %lu keys over 4 partitions\n", emits, keys);
+    } else {
+        // Compiled out: only the always-on figures are reported
+        assert(MR_InputBytes(options.results, 0) == 0);
+        assert(strstr(json, "\"stats_enabled\": false") && !strstr(json, "\"pool\""));
+    }
+
+    // Cleanup
+    free(json);
+    MR_DestroyResults(options.results);
+    remove("test21_stats.json");
+    remove("test21a.txt");
+    remove("test21b.txt");
+
+    printf("Test 21 passed: Run statistics.\n");
+}
+
+// Writes count copies of "word " to a file
+void write_words(const char *name, const char *word, int count) {
+    FILE *file = fopen(name, "w");
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%s ", word);
+    }
+    fclose(file);
+}
+
+// Runs the word count of test 22 with its result cache and checks what
+// the cache reused
+void run_cached(char **files, unsigned int count, MR_Options *options, unsigned int reused,
+                unsigned int mapped, unsigned int dropped) {
+    reduce_result_count = 0;
+    MR_RunWithOptions(count, files, NULL, test_int_reducer, 3, 4, options);
+    MR_CacheStats stats;
+    MR_GetCacheStats(options->results, &stats);
+    printf("Cache reused %u, mapped %u, dropped %u\n", stats.reused, stats.mapped, stats.dropped);
+    assert(stats.reused == reused && stats.mapped == mapped && stats.dropped == dropped);
+}
+
+// Test 22: Incremental Runs
+void test_result_cache() {
+    printf("Test 22: Incremental Runs\n");
+
+    write_words("test22a.txt", "apple", 3000);
+    write_words("test22b.txt", "banana", 2000);
+    write_words("test22c.txt", "cherry", 1000);
+    write_words("test22d.txt", "apple", 500);
+    char *files[] = {"test22a.txt", "test22b.txt", "test22c.txt", "test22d.txt"};
+
+    // Small splits and a small combine limit, so inputs are cached from
+    // several map tasks and several flushes each
+    MR_Options options = {0};
+    options.combiner = test_sum_combiner;
+    options.split_mapper = test_mapped_mapper;
+    options.split_size = 1024;
+    options.combine_limit = 1;
+    options.cache_file = "test22.cache";
+    options.results = MR_CreateResults();
+    remove("test22.cache");
+    run_cached(files, 4, &options, 0, 4, 0);
+    verify_result("apple", 3500);
+
+    // Nothing changed: every input comes from the cache
+    run_cached(files, 4, &options, 4, 0, 0);
+    verify_result("apple", 3500);
+    verify_result("banana", 2000);
+    verify_result("cherry", 1000);
+
+    // b changes, c is touched (new mtime, same bytes), d is dropped from the
+    // inputs and e is new. c was never hashed, so it is mapped and hashed
+    write_words("test22b.txt", "banana", 2500);
+    struct timespec times[2] = {{0, UTIME_NOW}, {12345, 0}};
+    utimensat(AT_FDCWD, "test22c.txt", times, 0);
+    write_words("test22e.txt", "date", 700);
+    char *changed[] = {"test22a.txt", "test22b.txt", "test22c.txt", "test22e.txt"};
+    run_cached(changed, 4, &options, 1, 3, 1);
+    verify_result("apple", 3000);
+    verify_result("banana", 2500);
+    verify_result("cherry", 1000);
+    verify_result("date", 700);
+    run_cached(changed, 4, &options, 4, 0, 0);
+    verify_result("banana", 2500);
+
+    // Touching c again is recognised by its hash
+    times[1].tv_sec = 23456;
+    utimensat(AT_FDCWD, "test22c.txt", times, 0);
+    run_cached(changed, 4, &options, 4, 0, 0);
+    verify_result("cherry", 1000);
+
+    // A damaged cache is ignored and rebuilt
+    FILE *file = fopen("test22.cache", "r+");
+    fputs("garbage", file);
+    fclose(file);
+    run_cached(changed, 4, &options, 0, 4, 0);
+    verify_result("date", 700);
+
+    // Cleanup
+    MR_DestroyResults(options.results);
+    remove("test22.cache");
+    remove("test22a.txt");
+    remove("test22b.txt");
+    remove("test22c.txt");
+    remove("test22d.txt");
+    remove("test22e.txt");
+
+    printf("Test 22 passed: Incremental runs.\n");
+}
+
+// Mapper for test 23 that takes down the worker process mapping the first
+// split of test23c.txt: once, or every time when test23.always exists.
+// Splits mapped by the test process itself never crash
+pid_t test_coordinator;
+
+void crashing_mapper(MR_Split *split) {
+    if (getpid() != test_coordinator && split->offset == 0 &&
+        strcmp(split->file_name, "test23c.txt") == 0) {
+        int fd = open("test23.crashed", O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd >= 0 || access("test23.always", F_OK) == 0) {
+            _exit(1);
+        }
+    }
+    test_mapped_mapper(split);
+}
+
+// Test 23: Worker Processes
+void test_worker_processes() {
+    printf("Test 23: Worker Processes\n");
+
+    test_coordinator = getpid();
+    write_words("test23a.txt", "apple", 3000);
+    write_words("test23b.txt", "banana", 2000);
+    write_words("test23c.txt", "cherry", 1000);
+    char *files[] = {"test23a.txt", "test23b.txt", "test23c.txt"};
+    remove("test23.crashed");
+    remove("test23.always");
+
+    // One worker dies mapping test23c.txt; its split goes to another
+    MR_Options options = {0};
+    options.combiner = test_sum_combiner;
+    options.split_mapper = crashing_mapper;
+    options.split_size = 1024;
+    options.processes = 3;
+    options.results = MR_CreateResults();
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 2, 4, &options);
+    verify_result("apple", 3000);
+    verify_result("banana", 2000);
+    verify_result("cherry", 1000);
+    MR_WorkerStats stats;
+    MR_GetWorkerStats(options.results, &stats);
+    printf("Workers %u, lost %u, retried %u, remote %u, local %u\n", stats.workers,
+           stats.lost, stats.retried, stats.remote, stats.local);
+    assert(stats.workers == 3 && stats.lost == 1 && stats.retried == 1);
+    assert(stats.local == 0 && stats.abandoned == 0 && !stats.failed && stats.remote > 3);
+
+    // Every worker that maps it dies, so it ends up mapped in this process
+    create_test_file("test23.always", "");
+    options.processes = 2;
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 2, 4, &options);
+    verify_result("apple", 3000);
+    verify_result("cherry", 1000);
+    MR_GetWorkerStats(options.results, &stats);
+    assert(stats.workers == 2 && stats.lost == 2 && stats.local >= 1 && stats.abandoned == 0);
+
+    // With a spare worker the poison split takes down three and is given
+    // up on; the run fails and only that split's words are missing
+    options.processes = 4;
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 2, 4, &options);
+    verify_result("apple", 3000);
+    verify_result("banana", 2000);
+    MR_GetWorkerStats(options.results, &stats);
+    assert(stats.lost == 3 && stats.retried == 2 && stats.abandoned == 1 && stats.failed);
+    assert(stats.local == 0);
+    for (int i = 0; i < reduce_result_count; i++) {
+        if (strcmp(reduce_results[i].word, "cherry") == 0) {
+            assert(reduce_results[i].count > 0 && reduce_results[i].count < 1000);
+            printf("Verified cherry: %d of 1000 counted\n", reduce_results[i].count);
+        }
+    }
+    remove("test23.always");
+
+    // A context's workers serve job after job, whatever their partition
+    // count, and jobs without processes set map in this process
+    options.split_mapper = test_mapped_mapper;
+    options.processes = 2;
+    MR_Context *context = MR_CreateContext(2, &options);
+    for (unsigned int num_parts = 3; num_parts <= 4; num_parts++) {
+        reduce_result_count = 0;
+        MR_RunInContext(context, 3, files, NULL, test_int_reducer, num_parts, &options);
+        verify_result("banana", 2000);
+        verify_result("cherry", 1000);
+        MR_GetWorkerStats(options.results, &stats);
+        assert(stats.workers == 2 && stats.lost == 0 && stats.local == 0 && stats.remote > 3);
+    }
+    options.processes = 0;
+    reduce_result_count = 0;
+    MR_RunInContext(context, 3, files, NULL, test_int_reducer, 4, &options);
+    verify_result("apple", 3000);
+    MR_GetWorkerStats(options.results, &stats);
+    assert(stats.workers == 0 && stats.remote == 0);
+    MR_DestroyContext(context);
+
+    // String values and whole-file tasks travel the same way
+    char *text_files[] = {"test23a.txt", "test23b.txt"};
+    options.combiner = NULL;
+    options.split_mapper = NULL;
+    options.processes = 2;
+    reduce_result_count = 0;
+    MR_RunWithOptions(2, text_files, test_mapper, test_reducer, 2, 3, &options);
+    verify_result("apple", 3000);
+    verify_result("banana", 2000);
+    MR_GetWorkerStats(options.results, &stats);
+    assert(stats.remote == 2 && stats.lost == 0);
+
+    // Cleanup
+    MR_DestroyResults(options.results);
+    remove("test23.crashed");
+    remove("test23.always");
+    remove("test23a.txt");
+    remove("test23b.txt");
+    remove("test23c.txt");
+
+    printf("Test 23 passed: Worker processes.\n");
+}
+
+// Test 24: I/O Stage
+void test_io_stage() {
+    printf("Test 24: I/O Stage\n");
+
+    write_words("test24a.txt", "apple", 3000);
+    write_words("test24b.txt", "banana", 2000);
+    write_words("test24c.txt", "cherry", 1000);
+    char *files[] = {"test24a.txt", "test24b.txt", "test24c.txt"};
+    unsigned long total = 6 * 3000 + 7 * 2000 + 7 * 1000;
+
+    // A single buffer makes the readers wait for every map task
+    MR_Options options = {0};
+    options.combiner = test_sum_combiner;
+    options.split_mapper = test_mapped_mapper;
+    options.split_size = 1024;
+    options.io_threads = 2;
+    options.io_buffers = 1;
+    options.results = MR_CreateResults();
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 3, 4, &options);
+    verify_result("apple", 3000);
+    verify_result("banana", 2000);
+    verify_result("cherry", 1000);
+    MR_IOStats stats;
+    MR_GetIOStats(options.results, &stats);
+    printf("I/O threads %u, buffers %u, bytes %lu\n", stats.threads, stats.buffers, stats.bytes_read);
+    assert(stats.threads == 2 && stats.buffers == 1 && stats.bytes_read == total);
+
+    // Mappers that read the file themselves still get the right input, and
+    // the default buffer count covers the readers and the pool
+    options.split_mapper = test_split_mapper;
+    options.io_buffers = 0;
+    options.schedule = TP_POLICY_LJF;
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 3, 4, &options);
+    verify_result("apple", 3000);
+    verify_result("cherry", 1000);
+    MR_GetIOStats(options.results, &stats);
+    assert(stats.buffers == 5 && stats.bytes_read == total);
+
+    // Without the stage nothing is read ahead
+    options.io_threads = 0;
+    reduce_result_count = 0;
+    MR_RunWithOptions(3, files, NULL, test_int_reducer, 3, 4, &options);
+    verify_result("banana", 2000);
+    MR_GetIOStats(options.results, &stats);
+    assert(stats.threads == 0 && stats.bytes_read == 0);
+
+    // Cleanup
+    MR_DestroyResults(options.results);
+    remove("test24a.txt");
+    remove("test24b.txt");
+    remove("test24c.txt");
+
+    printf("Test 24 passed: I/O stage.\n");
+}
+
+// Test 25: Interned Keys
+void test_interned_keys() {
+    printf("Test 25: Interned Keys\n");
+
+    // A repeated vocabulary plus keys that occur once, some sharing long
+    // prefixes so the sort has to look past eight bytes
+    FILE *file = fopen("test25a.txt", "w");
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 300; i++) {
+            fprintf(file, "w%d ", i);
+        }
+    }
+    for (int i = 0; i < 200; i++) {
+        fprintf(file, "prefix-shared-%d ", i);
+    }
+    fclose(file);
+    file = fopen("test25b.txt", "w");
+    for (int i = 0; i < 6000; i++) {
+        fprintf(file, i % 2 ? "the " : "the w%d ", i / 2 % 300);
+    }
+    fclose(file);
+    char *files[] = {"test25a.txt", "test25b.txt"};
+
+    // Reference output with string keys
+    MR_Options options = {0};
+    options.combiner = test_sum_combiner;
+    options.combine_limit = 16;
+    options.sort_threshold = 2;
+    options.output_dir = "test25_out";
+    options.merge_output = true;
+    options.results = MR_CreateResults();
+    MR_RunWithOptions(2, files, test_int_mapper, count_output_reducer, 3, 4, &options);
+    char *expected = read_output("test25_out/result.txt");
+    remove("test25_out/result.txt");
+    MR_InternStats stats;
+    MR_GetInternStats(options.results, &stats);
+    assert(stats.keys == 0 && stats.bytes == 0);
+
+    // Interned: the same output, with one ID per distinct key. Flushing
+    // every 16 keys and a sort threshold of 2 exercise the ID lookups and
+    // the parallel sort of all keys
+    options.intern_keys = true;
+    MR_RunWithOptions(2, files, test_int_mapper, count_output_reducer, 3, 4, &options);
+    char *interned = read_output("test25_out/result.txt");
+    remove("test25_out/result.txt");
+    assert(strlen(expected) > 0 && strcmp(expected, interned) == 0);
+    MR_GetInternStats(options.results, &stats);
+    printf("Interned keys %u, bytes %zu\n", stats.keys, stats.bytes);
+    assert(stats.keys == 501 && stats.bytes > 0);
+
+    // Skewed partitions split into key ranges keep the same output. Without
+    // a combiner the hot key's values make its partition skewed
+    options.combiner = NULL;
+    options.balance_reduce = true;
+    MR_RunWithOptions(2, files, test_int_mapper, count_output_reducer, 3, 4, &options);
+    char *balanced = read_output("test25_out/result.txt");
+    remove("test25_out/result.txt");
+    assert(strcmp(expected, balanced) == 0);
+    assert(MR_ReduceRanges(options.results, MR_Partitioner("the", 4)) > 1);
+
+    // String values are found by ID through MR_GetNext
+    options.balance_reduce = false;
+    options.merge_output = false;
+    reduce_result_count = 0;
+    MR_RunWithOptions(2, files, test_mapper, test_reducer, 3, 4, &options);
+    assert(reduce_result_count == 501);
+    verify_result("the", 6000);
+    verify_result("w7", 15);
+    verify_result("prefix-shared-199", 1);
+
+    // Each partition's keys reach the reducer in strcmp order
+    sorted_key_count = 0;
+    MR_RunWithOptions(2, files, test_int_mapper, order_reducer, 3, 1, &options);
+    assert(sorted_key_count == 501);
+    for (int i = 1; i < sorted_key_count; i++) {
+        assert(strcmp(sorted_keys[i - 1], sorted_keys[i]) < 0);
+    }
+
+    // Pipelined runs keep their own string keys
+    options.pipeline = true;
+    reduce_result_count = 0;
+    MR_RunWithOptions(2, files, test_int_mapper, test_int_reducer, 3, 4, &options);
+    verify_result("the", 6000);
+    MR_GetInternStats(options.results, &stats);
+    assert(stats.keys == 0);
+
+    // Cleanup
+    free(expected);
+    free(interned);
+    free(balanced);
+    MR_DestroyResults(options.results);
+    rmdir("test25_out");
+    remove("test25a.txt");
+    remove("test25b.txt");
+
+    printf("Test 25 passed: Interned keys.\n");
+}
+
 // Main function to run all tests
 int main() {
     test_single_file_single_partition();
@@ -193,6 +1455,26 @@ int main() {
     test_single_file_multiple_partitions();
     test_multiple_files_multiple_partitions();
     test_large_input();
+    test_many_distinct_keys();
+    test_int_values();
+    test_combiner();
+    test_input_splits();
+    test_mapped_input();
+    test_work_stealing_pool();
+    test_pipeline();
+    test_output_writer();
+    test_spill_to_disk();
+    test_context();
+    test_key_sort();
+    test_merged_output();
+    test_heavy_hitters();
+    test_staged_emits();
+    test_balanced_reduce();
+    test_run_stats();
+    test_result_cache();
+    test_worker_processes();
+    test_io_stage();
+    test_interned_keys();
 
     printf("All MapReduce tests completed.\n");
     return 0;
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
 
 // Global variables for testing
 static int job_counter = 0;
@@ -24,6 +25,173 @@ void test_job(void *arg) {
     printf("Completed job %d\n", job_num); // Additional debug log
 }
 
+// Globals for the scheduling policy test
+static int run_order[8];
+static int run_count = 0;
+static atomic_int gate_open = 0;
+
+// Blocks the only worker until every test job is queued
+void gate_job(void *arg) {
+    (void)arg;
+    while (!atomic_load(&gate_open)) {
+        usleep(1000);
+    }
+}
+
+// Records the order in which jobs are run
+void order_job(void *arg) {
+    run_order[run_count++] = *(int *)arg;
+}
+
+// Queue jobs of sizes 30, 10, 20 behind a gate and check the run order
+int check_policy(ThreadPool_policy_t policy, const int expected[3]) {
+    int sizes[] = {30, 10, 20};
+    ThreadPool_t *pool = ThreadPool_create(1);
+    ThreadPool_set_policy(pool, policy);
+    run_count = 0;
+    atomic_store(&gate_open, 0);
+
+    ThreadPool_add_job(pool, gate_job, NULL, 0);
+    usleep(10000); // Let the worker pick up the gate first
+    for (int i = 0; i < 3; i++) {
+        ThreadPool_add_job(pool, order_job, &sizes[i], sizes[i]);
+    }
+    atomic_store(&gate_open, 1);
+    ThreadPool_check(pool);
+    ThreadPool_destroy(pool);
+
+    for (int i = 0; i < 3; i++) {
+        if (run_order[i] != expected[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Globals for the work-stealing test
+static ThreadPool_t *stealing_pool;
+static atomic_int stolen_counter;
+static atomic_int bad_index;
+
+// Leaf job: counts itself and checks it runs on a worker of the pool
+void leaf_job(void *arg) {
+    (void)arg;
+    int index = ThreadPool_worker_index(stealing_pool);
+    if (index < 0 || index >= (int)stealing_pool->num_threads) {
+        atomic_fetch_add(&bad_index, 1);
+    }
+    atomic_fetch_add(&stolen_counter, 1);
+}
+
+// Fan-out job: queues leaf jobs on its own deque for others to steal
+void fanout_job(void *arg) {
+    (void)arg;
+    for (int i = 0; i < 50; i++) {
+        ThreadPool_add_job(stealing_pool, leaf_job, NULL, 0);
+    }
+    atomic_fetch_add(&stolen_counter, 1);
+}
+
+// Runs fan-out jobs in a work-stealing pool, twice, and checks every job ran
+int check_work_stealing(void) {
+    stealing_pool = ThreadPool_create_mode(4, TP_MODE_WORK_STEALING);
+    atomic_store(&stolen_counter, 0);
+    atomic_store(&bad_index, 0);
+
+    for (int round = 1; round <= 2; round++) {
+        for (int i = 0; i < 20; i++) {
+            ThreadPool_add_job(stealing_pool, fanout_job, NULL, 0);
+        }
+        ThreadPool_check(stealing_pool);
+        if (atomic_load(&stolen_counter) != round * 20 * 51) {
+            return 0;
+        }
+    }
+
+    int outside = ThreadPool_worker_index(stealing_pool);
+    ThreadPool_destroy(stealing_pool);
+    return atomic_load(&bad_index) == 0 && outside == -1;
+}
+
+// Globals for the batched submission test
+static int batch_order[1000];
+static int batch_count = 0;
+
+// Records the order in which batched jobs are run
+void batch_job(void *arg) {
+    batch_order[batch_count++] = *(int *)arg;
+}
+
+// Queues a large batch behind a gate in one call and checks that it runs in
+// SJF order with equal sizes in submission order
+int check_batch(void) {
+    static int ids[1000];
+    void *args[1000];
+    long sizes[1000];
+    ThreadPool_t *pool = ThreadPool_create(1);
+    atomic_store(&gate_open, 0);
+    batch_count = 0;
+
+    ThreadPool_add_job(pool, gate_job, NULL, 0);
+    usleep(10000); // Let the worker pick up the gate first
+    for (int i = 0; i < 1000; i++) {
+        ids[i] = i;
+        args[i] = &ids[i];
+        sizes[i] = (i * 7919) % 10;
+    }
+    if (!ThreadPool_add_jobs(pool, batch_job, args, sizes, 1000)) {
+        ThreadPool_destroy(pool);
+        return 0;
+    }
+    atomic_store(&gate_open, 1);
+    ThreadPool_check(pool);
+    ThreadPool_destroy(pool);
+
+    for (int i = 1; i < batch_count; i++) {
+        long prev = sizes[batch_order[i - 1]], cur = sizes[batch_order[i]];
+        if (prev > cur || (prev == cur && batch_order[i - 1] > batch_order[i])) {
+            return 0;
+        }
+    }
+    return batch_count == 1000;
+}
+
+// Sleeps for about 20 milliseconds
+void sleep_job(void *arg) {
+    (void)arg;
+    usleep(20000);
+}
+
+// Runs a few jobs and checks the counters of a pool built with
+// MR_ENABLE_STATS; without it the snapshot must come back empty
+int check_stats(void) {
+    ThreadPool_t *pool = ThreadPool_create(2);
+    for (int i = 0; i < 6; i++) {
+        ThreadPool_add_job(pool, sleep_job, NULL, 0);
+    }
+    ThreadPool_check(pool);
+    ThreadPool_stats_t stats;
+    bool collected = ThreadPool_get_stats(pool, &stats);
+    int ok = 1;
+    if (!collected) {
+        ok = stats.workers == NULL && stats.sample_count == 0;
+    } else {
+        unsigned long jobs = 0;
+        uint64_t run_ns = 0;
+        for (unsigned int i = 0; i < stats.num_threads; i++) {
+            jobs += stats.workers[i].jobs;
+            run_ns += stats.workers[i].run_ns;
+        }
+        ok = stats.num_threads == 2 && jobs == 6 && run_ns >= 6 * 15000000ULL &&
+             stats.sample_count > 0 && stats.max_depth >= 1;
+        printf("Stats: %lu jobs, %.3f s running, %u depth samples, max depth %u\n", jobs,
+               run_ns / 1e9, stats.sample_count, stats.max_depth);
+    }
+    ThreadPool_free_stats(&stats);
+    ThreadPool_destroy(pool);
+    return ok;
+}
+
 int main() {
     const int num_threads = 4;
     const int num_jobs = 10;
@@ -68,5 +236,35 @@ int main() {
     ThreadPool_destroy(pool);
     printf("Thread pool destroyed.\n");
 
+    // Step 6: Check the order each scheduling policy runs jobs in
+    const int sjf[] = {10, 20, 30}, ljf[] = {30, 20, 10}, fifo[] = {30, 10, 20};
+    if (!check_policy(TP_POLICY_SJF, sjf) || !check_policy(TP_POLICY_LJF, ljf) ||
+        !check_policy(TP_POLICY_FIFO, fifo)) {
+        printf("Error: Jobs ran out of policy order.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Scheduling policies ran jobs in the expected order.\n");
+
+    // Step 7: Run nested jobs through the work-stealing mode
+    if (!check_work_stealing()) {
+        printf("Error: Work-stealing pool lost or misplaced jobs.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Work-stealing pool completed all nested jobs.\n");
+
+    // Step 8: Submit a large batch at once and check its order
+    if (!check_batch()) {
+        printf("Error: Batched jobs ran out of SJF/FIFO order.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Batched jobs ran in SJF order with FIFO ties.\n");
+
+    // Step 9: Check the worker and queue counters
+    if (!check_stats()) {
+        printf("Error: Pool statistics do not match the jobs run.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Pool statistics match the jobs run.\n");
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
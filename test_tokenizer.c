@@ -0,0 +1,85 @@
+#include "tokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tokens collected by a scan, stored as "tok|tok|...|"
+typedef struct {
+    char text[1 << 16];
+    size_t used;
+    int count;
+} Collected;
+
+// Appends a token to the collected output
+void collect(const char *token, size_t len, void *arg) {
+    Collected *out = arg;
+    memcpy(out->text + out->used, token, len);
+    out->used += len;
+    out->text[out->used++] = '|';
+    out->text[out->used] = '\0';
+    out->count++;
+}
+
+// Scans buffer with every scanner and checks they agree with the scalar one
+int check_buffer(const char *buffer, size_t length) {
+    static Collected expected, actual;
+    Tokenizer_impl_t impls[] = {TOKENIZER_SSE2, TOKENIZER_AVX2};
+
+    memset(&expected, 0, sizeof(expected));
+    Tokenizer_select(TOKENIZER_SCALAR);
+    Tokenizer_scan(buffer, length, collect, &expected);
+
+    for (int i = 0; i < 2; i++) {
+        memset(&actual, 0, sizeof(actual));
+        Tokenizer_impl_t used = Tokenizer_select(impls[i]);
+        Tokenizer_scan(buffer, length, collect, &actual);
+        if (actual.count != expected.count || strcmp(actual.text, expected.text) != 0) {
+            printf("Error: %s scanner disagrees with scalar on %zu bytes.\n", Tokenizer_name(used), length);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main() {
+    // Step 1: Fixed cases, including tokens at both ends and across blocks
+    const char *cases[] = {
+        "",
+        "word",
+        "  leading and trailing  ",
+        "a\tb\nc\rd",
+        "a_token_that_is_longer_than_thirty_two_bytes_for_sure and more",
+        "                                                  x",
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (!check_buffer(cases[i], strlen(cases[i]))) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Step 2: Known token count for a simple sentence
+    static Collected out;
+    Tokenizer_select(TOKENIZER_AUTO);
+    Tokenizer_scan(" the  quick\tbrown\nfox ", 22, collect, &out);
+    if (out.count != 4 || strcmp(out.text, "the|quick|brown|fox|") != 0) {
+        printf("Error: Unexpected tokens \"%s\".\n", out.text);
+        return EXIT_FAILURE;
+    }
+
+    // Step 3: Random buffers of every length around the vector widths
+    const char alphabet[] = "ab \t\n\rxyz";
+    char buffer[300];
+    srand(7);
+    for (size_t length = 0; length < sizeof(buffer); length++) {
+        for (size_t i = 0; i < length; i++) {
+            buffer[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        if (!check_buffer(buffer, length)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("All tokenizer tests passed (%s selected by default).\n",
+           Tokenizer_name(Tokenizer_select(TOKENIZER_AUTO)));
+    return EXIT_SUCCESS;
+}
@@ -1,21 +1,148 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <string.h>
 #include "threadpool.h"
+#include "stats.h"
 
 // Helper function to create a new job node
-ThreadPool_job_t *create_job(thread_func_t func, void *arg, int size) {
+ThreadPool_job_t *create_job(thread_func_t func, void *arg, long size) {
     ThreadPool_job_t *job = (ThreadPool_job_t *)malloc(sizeof(ThreadPool_job_t));
     if (!job) return NULL;
     job->func = func;
     job->arg = arg;
     job->size = size;  // Set the size for SJF ordering
-    job->next = NULL;
+    job->seq = 0;
     return job;
 }
 
+// Identity of the calling thread when it is a pool worker
+static __thread ThreadPool_t *current_pool = NULL;
+static __thread int current_worker = -1;
+
+#ifdef MR_ENABLE_STATS
+// Samples kept in a pool's queue depth series, and the initial minimum
+// spacing between two of them
+#define DEPTH_SAMPLES 1024
+#define DEPTH_INTERVAL_NS 100000
+
+// Counters of one worker. Only the worker adds to them, but snapshots read
+// them from other threads; idle_since is when its current wait began, or 0
+typedef struct {
+    atomic_ullong idle_ns;
+    atomic_ullong run_ns;
+    atomic_ullong lock_wait_ns;
+    atomic_ulong jobs;
+    atomic_ullong idle_since;
+} WorkerCounters;
+
+// Counters of a pool: one set per worker plus the queue depth series
+struct ThreadPool_counters {
+    WorkerCounters *workers;
+    ThreadPool_depth_sample_t samples[DEPTH_SAMPLES];
+    unsigned int sample_count;
+    uint64_t interval_ns;
+    unsigned int max_depth;
+    pthread_mutex_t lock;
+};
+
+// Counters of the calling worker, or NULL for threads outside a pool
+static WorkerCounters *worker_counters(void) {
+    if (!current_pool || current_worker < 0) {
+        return NULL;
+    }
+    return &current_pool->counters->workers[current_worker];
+}
+
+static void add_counter(atomic_ullong *counter, uint64_t amount) {
+    atomic_fetch_add_explicit(counter, amount, memory_order_relaxed);
+}
+
+// Takes a queue or deque lock, charging the calling worker for the time
+// spent blocked when another thread held it
+static void lock_queue(pthread_mutex_t *mutex) {
+    if (pthread_mutex_trylock(mutex) == 0) {
+        return;
+    }
+    uint64_t start = stats_now_ns();
+    pthread_mutex_lock(mutex);
+    WorkerCounters *counters = worker_counters();
+    if (counters) {
+        add_counter(&counters->lock_wait_ns, stats_now_ns() - start);
+    }
+}
+
+// Marks the start and end of a wait for work
+static void idle_begin(void) {
+    WorkerCounters *counters = worker_counters();
+    atomic_store_explicit(&counters->idle_since, stats_now_ns(), memory_order_relaxed);
+}
+
+static void idle_end(void) {
+    WorkerCounters *counters = worker_counters();
+    uint64_t since = atomic_exchange_explicit(&counters->idle_since, 0, memory_order_relaxed);
+    add_counter(&counters->idle_ns, stats_now_ns() - since);
+}
+
+// When the job the calling worker is running began, or 0 between jobs
+static __thread uint64_t current_job_started = 0;
+
+// Charges a job that began at start to the calling worker
+static void job_ran(uint64_t start) {
+    WorkerCounters *counters = worker_counters();
+    add_counter(&counters->run_ns, stats_now_ns() - start);
+    atomic_fetch_add_explicit(&counters->jobs, 1, memory_order_relaxed);
+    current_job_started = 0;
+}
+
+// Adds a point to the queue depth series unless the last one is too recent.
+// A full series is thinned to every other sample at twice the spacing
+static void record_depth(ThreadPool_t *tp, unsigned int depth) {
+    struct ThreadPool_counters *counters = tp->counters;
+    uint64_t now = stats_now_ns();
+    pthread_mutex_lock(&counters->lock);
+    if (depth > counters->max_depth) {
+        counters->max_depth = depth;
+    }
+    unsigned int count = counters->sample_count;
+    if (count == 0 || now - counters->samples[count - 1].time_ns >= counters->interval_ns) {
+        if (count == DEPTH_SAMPLES) {
+            for (unsigned int i = 0; i < DEPTH_SAMPLES / 2; i++) {
+                counters->samples[i] = counters->samples[2 * i];
+            }
+            count = DEPTH_SAMPLES / 2;
+            counters->interval_ns *= 2;
+        }
+        counters->samples[count].time_ns = now;
+        counters->samples[count].depth = depth;
+        counters->sample_count = count + 1;
+    }
+    pthread_mutex_unlock(&counters->lock);
+}
+
+#define job_start() (current_job_started = stats_now_ns())
+#else
+#define lock_queue(mutex) pthread_mutex_lock(mutex)
+#define idle_begin() ((void)0)
+#define idle_end() ((void)0)
+#define job_ran(start) ((void)(start))
+#define record_depth(tp, depth) ((void)(depth))
+#define job_start() 0
+#endif
+
+// Initial number of slots in each work-stealing deque
+#define DEQUE_INITIAL_CAPACITY 64
+
+// Initial number of slots in the shared job heap
+#define HEAP_INITIAL_CAPACITY 64
+
 // Initialize a thread pool with a specified number of worker threads
 ThreadPool_t *ThreadPool_create(unsigned int num_threads) {
+    return ThreadPool_create_mode(num_threads, TP_MODE_SHARED_QUEUE);
+}
+
+// Initialize a thread pool whose jobs are queued according to mode
+ThreadPool_t *ThreadPool_create_mode(unsigned int num_threads, ThreadPool_mode_t mode) {
     ThreadPool_t *tp = (ThreadPool_t *)malloc(sizeof(ThreadPool_t));
     if (!tp) return NULL;
 
@@ -25,10 +152,51 @@ ThreadPool_t *ThreadPool_create(unsigned int num_threads) {
         return NULL;
     }
 
+    tp->mode = mode;
+    tp->deques = NULL;
+    if (mode == TP_MODE_WORK_STEALING) {
+        tp->deques = (ThreadPool_deque_t *)calloc(num_threads, sizeof(ThreadPool_deque_t));
+        if (!tp->deques) {
+            free(tp->threads);
+            free(tp);
+            return NULL;
+        }
+        for (unsigned int i = 0; i < num_threads; i++) {
+            ThreadPool_deque_t *deque = &tp->deques[i];
+            deque->slots = (ThreadPool_job_t **)malloc(DEQUE_INITIAL_CAPACITY * sizeof(ThreadPool_job_t *));
+            deque->capacity = DEQUE_INITIAL_CAPACITY;
+            deque->top = deque->bottom = 0;
+            pthread_mutex_init(&deque->lock, NULL);
+            pthread_mutex_init(&deque->park_mutex, NULL);
+            pthread_cond_init(&deque->park_cond, NULL);
+            atomic_init(&deque->sleeping, 0);
+            deque->woken = false;
+            deque->seed = 2654435761u * (i + 1);
+        }
+    }
+    atomic_init(&tp->next_worker, 0);
+    atomic_init(&tp->next_deque, 0);
+    atomic_init(&tp->queued, 0);
+    atomic_init(&tp->sleepers, 0);
+    atomic_init(&tp->submitted, 0);
+    atomic_init(&tp->finished, 0);
+    pthread_mutex_init(&tp->done_mutex, NULL);
+    pthread_cond_init(&tp->done_cond, NULL);
+    tp->counters = NULL;
+#ifdef MR_ENABLE_STATS
+    tp->counters = calloc(1, sizeof(struct ThreadPool_counters));
+    tp->counters->workers = calloc(num_threads, sizeof(WorkerCounters));
+    tp->counters->interval_ns = DEPTH_INTERVAL_NS;
+    pthread_mutex_init(&tp->counters->lock, NULL);
+#endif
+
     tp->jobs.size = 0;
     tp->jobs.total_jobs = 0;
     tp->jobs.completed_jobs = 0;
-    tp->jobs.head = NULL;
+    tp->jobs.heap = (ThreadPool_job_t **)malloc(HEAP_INITIAL_CAPACITY * sizeof(ThreadPool_job_t *));
+    tp->jobs.capacity = HEAP_INITIAL_CAPACITY;
+    tp->jobs.next_seq = 0;
+    tp->jobs.policy = TP_POLICY_SJF;
     pthread_mutex_init(&tp->jobs.mutex, NULL);
     pthread_cond_init(&tp->jobs.cond, NULL);
     pthread_cond_init(&tp->jobs.all_jobs_done_cond, NULL);
@@ -42,6 +210,26 @@ ThreadPool_t *ThreadPool_create(unsigned int num_threads) {
     return tp;
 }
 
+// Wakes a parked work-stealing thread, if any, to pick up new work
+static void wake_one(ThreadPool_t *tp) {
+    if (atomic_load(&tp->sleepers) == 0) {
+        return;
+    }
+    unsigned int start = atomic_load(&tp->next_deque);
+    for (unsigned int i = 0; i < tp->num_threads; i++) {
+        ThreadPool_deque_t *deque = &tp->deques[(start + i) % tp->num_threads];
+        // Whoever clears the sleeping flag owns the wake-up of that thread
+        if (atomic_exchange(&deque->sleeping, 0) == 1) {
+            atomic_fetch_sub(&tp->sleepers, 1);
+            pthread_mutex_lock(&deque->park_mutex);
+            deque->woken = true;
+            pthread_cond_signal(&deque->park_cond);
+            pthread_mutex_unlock(&deque->park_mutex);
+            return;
+        }
+    }
+}
+
 // Destroy the thread pool and clean up resources
 void ThreadPool_destroy(ThreadPool_t *tp) {
     pthread_mutex_lock(&tp->jobs.mutex);
@@ -49,17 +237,46 @@ void ThreadPool_destroy(ThreadPool_t *tp) {
     pthread_cond_broadcast(&tp->jobs.cond);
     pthread_mutex_unlock(&tp->jobs.mutex);
 
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        for (unsigned int i = 0; i < tp->num_threads; i++) {
+            ThreadPool_deque_t *deque = &tp->deques[i];
+            pthread_mutex_lock(&deque->park_mutex);
+            deque->woken = true;
+            pthread_cond_signal(&deque->park_cond);
+            pthread_mutex_unlock(&deque->park_mutex);
+        }
+    }
+
     for (unsigned int i = 0; i < tp->num_threads; i++) {
         pthread_join(tp->threads[i], NULL);
     }
     printf("All threads joined successfully.\n");
 
-    ThreadPool_job_t *job = tp->jobs.head;
-    while (job) {
-        ThreadPool_job_t *next = job->next;
-        free(job);
-        job = next;
+    for (unsigned int i = 0; i < tp->jobs.size; i++) {
+        free(tp->jobs.heap[i]);
     }
+    free(tp->jobs.heap);
+
+    if (tp->deques) {
+        for (unsigned int i = 0; i < tp->num_threads; i++) {
+            ThreadPool_deque_t *deque = &tp->deques[i];
+            for (unsigned int j = deque->top; j != deque->bottom; j++) {
+                free(deque->slots[j & (deque->capacity - 1)]);
+            }
+            free(deque->slots);
+            pthread_mutex_destroy(&deque->lock);
+            pthread_mutex_destroy(&deque->park_mutex);
+            pthread_cond_destroy(&deque->park_cond);
+        }
+        free(tp->deques);
+    }
+    pthread_mutex_destroy(&tp->done_mutex);
+    pthread_cond_destroy(&tp->done_cond);
+#ifdef MR_ENABLE_STATS
+    pthread_mutex_destroy(&tp->counters->lock);
+    free(tp->counters->workers);
+    free(tp->counters);
+#endif
 
     free(tp->threads);
     pthread_mutex_destroy(&tp->jobs.mutex);
@@ -69,43 +286,297 @@ void ThreadPool_destroy(ThreadPool_t *tp) {
     printf("Thread pool destroyed\n");
 }
 
-// Add a job to the job queue in a Shortest Job First (SJF) manner
-bool ThreadPool_add_job(ThreadPool_t *tp, thread_func_t func, void *arg, int size) {
+// Whether job a must run before job b under the pool's policy; equal jobs
+// keep their submission order
+static bool runs_before(ThreadPool_policy_t policy, ThreadPool_job_t *a, ThreadPool_job_t *b) {
+    switch (policy) {
+    case TP_POLICY_LJF:
+        if (a->size != b->size) return a->size > b->size;
+        break;
+    case TP_POLICY_FIFO:
+        break;
+    case TP_POLICY_SJF:
+    default:
+        if (a->size != b->size) return a->size < b->size;
+        break;
+    }
+    return a->seq < b->seq;
+}
+
+// Moves heap[i] towards the root until its parent runs before it
+static void heap_sift_up(ThreadPool_job_queue_t *queue, unsigned int i) {
+    ThreadPool_job_t *job = queue->heap[i];
+    while (i > 0) {
+        unsigned int parent = (i - 1) / 2;
+        if (!runs_before(queue->policy, job, queue->heap[parent])) {
+            break;
+        }
+        queue->heap[i] = queue->heap[parent];
+        i = parent;
+    }
+    queue->heap[i] = job;
+}
+
+// Moves heap[i] towards the leaves until it runs before both children
+static void heap_sift_down(ThreadPool_job_queue_t *queue, unsigned int i) {
+    ThreadPool_job_t *job = queue->heap[i];
+    while (1) {
+        unsigned int child = 2 * i + 1;
+        if (child >= queue->size) {
+            break;
+        }
+        if (child + 1 < queue->size && runs_before(queue->policy, queue->heap[child + 1], queue->heap[child])) {
+            child++;
+        }
+        if (!runs_before(queue->policy, queue->heap[child], job)) {
+            break;
+        }
+        queue->heap[i] = queue->heap[child];
+        i = child;
+    }
+    queue->heap[i] = job;
+}
+
+// Makes room for extra more jobs in the heap
+static bool heap_reserve(ThreadPool_job_queue_t *queue, unsigned int extra) {
+    if (queue->size + extra <= queue->capacity) {
+        return true;
+    }
+    unsigned int capacity = queue->capacity;
+    while (capacity < queue->size + extra) {
+        capacity *= 2;
+    }
+    ThreadPool_job_t **heap = (ThreadPool_job_t **)realloc(queue->heap, capacity * sizeof(ThreadPool_job_t *));
+    if (!heap) {
+        return false;
+    }
+    queue->heap = heap;
+    queue->capacity = capacity;
+    return true;
+}
+
+// Removes and returns the job that runs next; the queue must not be empty
+static ThreadPool_job_t *heap_pop(ThreadPool_job_queue_t *queue) {
+    ThreadPool_job_t *job = queue->heap[0];
+    queue->heap[0] = queue->heap[--queue->size];
+    if (queue->size > 0) {
+        heap_sift_down(queue, 0);
+    }
+    return job;
+}
+
+// Select the scheduling policy, reordering any queued jobs
+void ThreadPool_set_policy(ThreadPool_t *tp, ThreadPool_policy_t policy) {
     pthread_mutex_lock(&tp->jobs.mutex);
+    tp->jobs.policy = policy;
+    for (unsigned int i = tp->jobs.size / 2; i-- > 0;) {
+        heap_sift_down(&tp->jobs, i);
+    }
+    pthread_mutex_unlock(&tp->jobs.mutex);
+}
+
+// Pushes a job at the bottom of a deque, growing it when full
+static void deque_push(ThreadPool_deque_t *deque, ThreadPool_job_t *job) {
+    lock_queue(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        unsigned int new_capacity = deque->capacity * 2;
+        ThreadPool_job_t **slots = (ThreadPool_job_t **)malloc(new_capacity * sizeof(ThreadPool_job_t *));
+        unsigned int count = deque->bottom - deque->top;
+        for (unsigned int i = 0; i < count; i++) {
+            slots[i] = deque->slots[(deque->top + i) & (deque->capacity - 1)];
+        }
+        free(deque->slots);
+        deque->slots = slots;
+        deque->capacity = new_capacity;
+        deque->top = 0;
+        deque->bottom = count;
+    }
+    deque->slots[deque->bottom++ & (deque->capacity - 1)] = job;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// Pops the owner's most recent job (LIFO, still warm in its cache)
+static ThreadPool_job_t *deque_pop(ThreadPool_deque_t *deque) {
+    ThreadPool_job_t *job = NULL;
+    lock_queue(&deque->lock);
+    if (deque->bottom != deque->top) {
+        job = deque->slots[--deque->bottom & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Takes the oldest job of another thread's deque
+static ThreadPool_job_t *deque_steal(ThreadPool_deque_t *deque) {
+    ThreadPool_job_t *job = NULL;
+    lock_queue(&deque->lock);
+    if (deque->bottom != deque->top) {
+        job = deque->slots[deque->top++ & (deque->capacity - 1)];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Finds work for worker self (or for any thread when self is -1): its own
+// deque first, then the others starting from a random victim
+static ThreadPool_job_t *find_job(ThreadPool_t *tp, int self) {
+    ThreadPool_job_t *job = NULL;
+    unsigned int start = 0;
+    if (self >= 0) {
+        job = deque_pop(&tp->deques[self]);
+        ThreadPool_deque_t *deque = &tp->deques[self];
+        deque->seed ^= deque->seed << 13;
+        deque->seed ^= deque->seed >> 17;
+        deque->seed ^= deque->seed << 5;
+        start = deque->seed;
+    }
+    // Only go looking at other deques when some job is actually queued
+    for (unsigned int i = 0; !job && atomic_load(&tp->queued) > 0 && i < tp->num_threads; i++) {
+        unsigned int victim = (start + i) % tp->num_threads;
+        if ((int)victim != self) {
+            job = deque_steal(&tp->deques[victim]);
+        }
+    }
+    if (job) {
+        unsigned int depth = atomic_fetch_sub(&tp->queued, 1) - 1;
+        record_depth(tp, depth);
+    }
+    return job;
+}
+
+// Add a job to the job queue according to the scheduling policy
+bool ThreadPool_add_job(ThreadPool_t *tp, thread_func_t func, void *arg, long size) {
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        if (atomic_load(&tp->shutdown)) {
+            return false;
+        }
+        ThreadPool_job_t *job = create_job(func, arg, size);
+        if (!job) {
+            return false;
+        }
+        // Workers keep their own jobs; outside threads spread them around
+        int self = current_pool == tp ? current_worker : -1;
+        unsigned int target = self >= 0 ? (unsigned int)self
+                                        : atomic_fetch_add(&tp->next_deque, 1) % tp->num_threads;
+        atomic_fetch_add(&tp->submitted, 1);
+        deque_push(&tp->deques[target], job);
+        unsigned int depth = atomic_fetch_add(&tp->queued, 1) + 1;
+        record_depth(tp, depth);
+        wake_one(tp);
+        return true;
+    }
+
+    lock_queue(&tp->jobs.mutex);
     if (tp->shutdown) {
         pthread_mutex_unlock(&tp->jobs.mutex);
         return false;
     }
 
     ThreadPool_job_t *job = create_job(func, arg, size);
-    if (!job) {
+    if (!job || !heap_reserve(&tp->jobs, 1)) {
+        free(job);
         pthread_mutex_unlock(&tp->jobs.mutex);
         return false;
     }
 
-    // Insert the job in SJF order (ascending order of size)
-    if (tp->jobs.head == NULL || job->size < tp->jobs.head->size) {
-        job->next = tp->jobs.head;
-        tp->jobs.head = job;
-    } else {
-        ThreadPool_job_t *current = tp->jobs.head;
-        while (current->next != NULL && current->next->size <= job->size) {
-            current = current->next;
-        }
-        job->next = current->next;
-        current->next = job;
-    }
+    // Insert the job in policy order (ascending order of size for SJF)
+    job->seq = tp->jobs.next_seq++;
+    tp->jobs.heap[tp->jobs.size++] = job;
+    heap_sift_up(&tp->jobs, tp->jobs.size - 1);
+    record_depth(tp, tp->jobs.size);
 
-    tp->jobs.size++;
     tp->jobs.total_jobs++;
     pthread_cond_signal(&tp->jobs.cond);
     pthread_mutex_unlock(&tp->jobs.mutex);
     return true;
 }
 
+// Add a batch of jobs under a single acquisition of the queue lock
+bool ThreadPool_add_jobs(ThreadPool_t *tp, thread_func_t func, void **args, const long *sizes,
+                         unsigned int count) {
+    // Allocate every job up front so the lock is not held across malloc
+    ThreadPool_job_t **batch = (ThreadPool_job_t **)malloc((count ? count : 1) * sizeof(ThreadPool_job_t *));
+    if (!batch) {
+        return false;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        batch[i] = create_job(func, args[i], sizes ? sizes[i] : 0);
+        if (!batch[i]) {
+            while (i-- > 0) {
+                free(batch[i]);
+            }
+            free(batch);
+            return false;
+        }
+    }
+
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        if (atomic_load(&tp->shutdown)) {
+            for (unsigned int i = 0; i < count; i++) {
+                free(batch[i]);
+            }
+            free(batch);
+            return false;
+        }
+        int self = current_pool == tp ? current_worker : -1;
+        atomic_fetch_add(&tp->submitted, count);
+        for (unsigned int i = 0; i < count; i++) {
+            unsigned int target = self >= 0 ? (unsigned int)self
+                                            : atomic_fetch_add(&tp->next_deque, 1) % tp->num_threads;
+            deque_push(&tp->deques[target], batch[i]);
+            unsigned int depth = atomic_fetch_add(&tp->queued, 1) + 1;
+            record_depth(tp, depth);
+            wake_one(tp);
+        }
+        free(batch);
+        return true;
+    }
+
+    lock_queue(&tp->jobs.mutex);
+    if (tp->shutdown || !heap_reserve(&tp->jobs, count)) {
+        pthread_mutex_unlock(&tp->jobs.mutex);
+        for (unsigned int i = 0; i < count; i++) {
+            free(batch[i]);
+        }
+        free(batch);
+        return false;
+    }
+
+    // Small batches are sifted in one by one; large ones are appended and
+    // the whole heap rebuilt bottom-up in linear time
+    unsigned int old_size = tp->jobs.size;
+    for (unsigned int i = 0; i < count; i++) {
+        batch[i]->seq = tp->jobs.next_seq++;
+        tp->jobs.heap[tp->jobs.size++] = batch[i];
+        if (count <= old_size) {
+            heap_sift_up(&tp->jobs, tp->jobs.size - 1);
+        }
+    }
+    if (count > old_size) {
+        for (unsigned int i = tp->jobs.size / 2; i-- > 0;) {
+            heap_sift_down(&tp->jobs, i);
+        }
+    }
+
+    record_depth(tp, tp->jobs.size);
+    tp->jobs.total_jobs += count;
+    if (count > 1) {
+        pthread_cond_broadcast(&tp->jobs.cond);
+    } else {
+        pthread_cond_signal(&tp->jobs.cond);
+    }
+    pthread_mutex_unlock(&tp->jobs.mutex);
+    free(batch);
+    return true;
+}
+
 // Retrieve the next job from the job queue
 ThreadPool_job_t *ThreadPool_get_job(ThreadPool_t *tp) {
-    pthread_mutex_lock(&tp->jobs.mutex);
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        return find_job(tp, current_pool == tp ? current_worker : -1);
+    }
+
+    lock_queue(&tp->jobs.mutex);
 
     while (!tp->shutdown && tp->jobs.size == 0) {
         pthread_cond_wait(&tp->jobs.cond, &tp->jobs.mutex);
@@ -113,22 +584,90 @@ ThreadPool_job_t *ThreadPool_get_job(ThreadPool_t *tp) {
 
     ThreadPool_job_t *job = NULL;
     if (tp->jobs.size > 0) {
-        job = tp->jobs.head;
-        tp->jobs.head = job->next;
-        tp->jobs.size--;
+        job = heap_pop(&tp->jobs);
+        record_depth(tp, tp->jobs.size);
     }
 
     pthread_mutex_unlock(&tp->jobs.mutex);
     return job;
 }
 
+// Records that a work-stealing job finished, waking ThreadPool_check when
+// it was the last outstanding one
+static void finish_job(ThreadPool_t *tp) {
+    unsigned long finished = atomic_fetch_add(&tp->finished, 1) + 1;
+    if (finished == atomic_load(&tp->submitted)) {
+        pthread_mutex_lock(&tp->done_mutex);
+        pthread_cond_broadcast(&tp->done_cond);
+        pthread_mutex_unlock(&tp->done_mutex);
+    }
+}
+
+// Parks an idle work-stealing thread until a submitter or shutdown wakes it
+static void park(ThreadPool_t *tp, ThreadPool_deque_t *deque) {
+    atomic_store(&deque->sleeping, 1);
+    atomic_fetch_add(&tp->sleepers, 1);
+
+    // Re-check after announcing: a job queued before this point is seen
+    // here, and one queued after it sees this thread as a sleeper
+    if (atomic_load(&tp->queued) > 0 || atomic_load(&tp->shutdown)) {
+        if (atomic_exchange(&deque->sleeping, 0) == 1) {
+            atomic_fetch_sub(&tp->sleepers, 1);
+            return;
+        }
+        // A submitter already claimed this thread; consume its wake-up
+    }
+
+    pthread_mutex_lock(&deque->park_mutex);
+    while (!deque->woken && !atomic_load(&tp->shutdown)) {
+        pthread_cond_wait(&deque->park_cond, &deque->park_mutex);
+    }
+    deque->woken = false;
+    pthread_mutex_unlock(&deque->park_mutex);
+    if (atomic_exchange(&deque->sleeping, 0) == 1) {
+        atomic_fetch_sub(&tp->sleepers, 1);
+    }
+}
+
+// Work-stealing loop: pop local work, steal when out, park when idle
+static void run_stealing(ThreadPool_t *tp, int self) {
+    while (1) {
+        ThreadPool_job_t *job = find_job(tp, self);
+        if (job) {
+            uint64_t start = job_start();
+            job->func(job->arg);
+            free(job);
+            job_ran(start);
+            finish_job(tp);
+            continue;
+        }
+        if (atomic_load(&tp->shutdown) && atomic_load(&tp->queued) == 0) {
+            break;
+        }
+        idle_begin();
+        park(tp, &tp->deques[self]);
+        idle_end();
+    }
+}
+
 // Thread routine for workers to fetch and execute jobs
 void *Thread_run(ThreadPool_t *tp) {
+    current_pool = tp;
+    current_worker = (int)atomic_fetch_add(&tp->next_worker, 1);
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        run_stealing(tp, current_worker);
+        return NULL;
+    }
+
     while (1) {
-        pthread_mutex_lock(&tp->jobs.mutex);
+        lock_queue(&tp->jobs.mutex);
 
-        while (tp->jobs.size == 0 && !tp->shutdown) {
-            pthread_cond_wait(&tp->jobs.cond, &tp->jobs.mutex);
+        if (tp->jobs.size == 0 && !tp->shutdown) {
+            idle_begin();
+            while (tp->jobs.size == 0 && !tp->shutdown) {
+                pthread_cond_wait(&tp->jobs.cond, &tp->jobs.mutex);
+            }
+            idle_end();
         }
 
         if (tp->shutdown && tp->jobs.size == 0) {
@@ -137,18 +676,20 @@ void *Thread_run(ThreadPool_t *tp) {
             break;
         }
 
-        ThreadPool_job_t *job = tp->jobs.head;
-        if (job) {
-            tp->jobs.head = job->next;
-            tp->jobs.size--;
+        ThreadPool_job_t *job = NULL;
+        if (tp->jobs.size > 0) {
+            job = heap_pop(&tp->jobs);
+            record_depth(tp, tp->jobs.size);
         }
         pthread_mutex_unlock(&tp->jobs.mutex);
 
         if (job) {
+            uint64_t start = job_start();
             job->func(job->arg);
             free(job);
+            job_ran(start);
 
-            pthread_mutex_lock(&tp->jobs.mutex);
+            lock_queue(&tp->jobs.mutex);
             tp->jobs.completed_jobs++;
             if (tp->jobs.completed_jobs == tp->jobs.total_jobs && tp->jobs.size == 0) {
                 pthread_cond_broadcast(&tp->jobs.all_jobs_done_cond);
@@ -159,8 +700,73 @@ void *Thread_run(ThreadPool_t *tp) {
     return NULL;
 }
 
+// Get the index of the calling thread within the pool
+int ThreadPool_worker_index(ThreadPool_t *tp) {
+    return current_pool == tp ? current_worker : -1;
+}
+
+// Get when the calling worker's current job started
+uint64_t ThreadPool_job_started_ns(ThreadPool_t *tp) {
+#ifdef MR_ENABLE_STATS
+    return current_pool == tp && current_worker >= 0 ? current_job_started : 0;
+#else
+    (void)tp;
+    return 0;
+#endif
+}
+
+// Copy the pool's counters
+bool ThreadPool_get_stats(ThreadPool_t *tp, ThreadPool_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef MR_ENABLE_STATS
+    struct ThreadPool_counters *counters = tp->counters;
+    stats->num_threads = tp->num_threads;
+    stats->workers = calloc(tp->num_threads, sizeof(ThreadPool_worker_stats_t));
+    uint64_t now = stats_now_ns();
+    for (unsigned int i = 0; i < tp->num_threads; i++) {
+        WorkerCounters *worker = &counters->workers[i];
+        uint64_t since = atomic_load_explicit(&worker->idle_since, memory_order_relaxed);
+        stats->workers[i].idle_ns = atomic_load_explicit(&worker->idle_ns, memory_order_relaxed);
+        if (since != 0 && now > since) {
+            stats->workers[i].idle_ns += now - since;
+        }
+        stats->workers[i].run_ns = atomic_load_explicit(&worker->run_ns, memory_order_relaxed);
+        stats->workers[i].lock_wait_ns = atomic_load_explicit(&worker->lock_wait_ns, memory_order_relaxed);
+        stats->workers[i].jobs = atomic_load_explicit(&worker->jobs, memory_order_relaxed);
+    }
+    pthread_mutex_lock(&counters->lock);
+    stats->sample_count = counters->sample_count;
+    stats->max_depth = counters->max_depth;
+    stats->samples = malloc((counters->sample_count + 1) * sizeof(ThreadPool_depth_sample_t));
+    memcpy(stats->samples, counters->samples, counters->sample_count * sizeof(ThreadPool_depth_sample_t));
+    pthread_mutex_unlock(&counters->lock);
+    return true;
+#else
+    (void)tp;
+    return false;
+#endif
+}
+
+// Release a snapshot's arrays
+void ThreadPool_free_stats(ThreadPool_stats_t *stats) {
+    free(stats->workers);
+    free(stats->samples);
+    stats->workers = NULL;
+    stats->samples = NULL;
+}
+
 // Wait for all jobs in the pool to complete
 void ThreadPool_check(ThreadPool_t *tp) {
+    if (tp->mode == TP_MODE_WORK_STEALING) {
+        pthread_mutex_lock(&tp->done_mutex);
+        while (atomic_load(&tp->finished) < atomic_load(&tp->submitted)) {
+            pthread_cond_wait(&tp->done_cond, &tp->done_mutex);
+        }
+        pthread_mutex_unlock(&tp->done_mutex);
+        printf("All jobs completed.\n");
+        return;
+    }
+
     pthread_mutex_lock(&tp->jobs.mutex);
 
     while (tp->jobs.completed_jobs < tp->jobs.total_jobs) {
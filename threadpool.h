@@ -2,32 +2,108 @@
 #define THREADPOOL_H
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef void (*thread_func_t)(void *arg);
 
+// Order in which queued jobs are handed to the threads
+typedef enum {
+    TP_POLICY_SJF,  // Shortest job first (default)
+    TP_POLICY_LJF,  // Longest job first, i.e. LPT scheduling to reduce makespan
+    TP_POLICY_FIFO  // Submission order, ignoring job sizes
+} ThreadPool_policy_t;
+
+// How queued jobs reach the threads
+typedef enum {
+    TP_MODE_SHARED_QUEUE,  // One queue under one mutex, ordered by the policy (default)
+    TP_MODE_WORK_STEALING  // A deque per thread; idle threads steal from random victims
+} ThreadPool_mode_t;
+
 typedef struct ThreadPool_job_t {
     thread_func_t func;
     void *arg;
-    struct ThreadPool_job_t *next;
-    int size;
+    unsigned long seq;
+    long size;
 } ThreadPool_job_t;
 
+// The shared queue is a binary heap ordered by the policy, with the
+// submission sequence number breaking ties so equal jobs run FIFO
 typedef struct {
     unsigned int size;
     unsigned int total_jobs;
     unsigned int completed_jobs;
-    ThreadPool_job_t *head;
+    ThreadPool_job_t **heap;
+    unsigned int capacity;
+    unsigned long next_seq;
+    ThreadPool_policy_t policy;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     pthread_cond_t all_jobs_done_cond;
 } ThreadPool_job_queue_t;
 
+// Per-thread deque used in work-stealing mode. The owner pushes and pops
+// at the bottom (LIFO); thieves take the oldest job from the top
+typedef struct {
+    ThreadPool_job_t **slots;
+    unsigned int top;
+    unsigned int bottom;
+    unsigned int capacity;
+    pthread_mutex_t lock;
+    pthread_mutex_t park_mutex;
+    pthread_cond_t park_cond;
+    atomic_int sleeping;
+    bool woken;
+    unsigned int seed;
+} ThreadPool_deque_t;
+
+// Time one worker spent in each state, in nanoseconds, and the jobs it ran.
+// Lock waits only count acquisitions of the queue lock (a deque lock in
+// work-stealing mode) that found it held
+typedef struct {
+    uint64_t idle_ns;
+    uint64_t run_ns;
+    uint64_t lock_wait_ns;
+    unsigned long jobs;
+} ThreadPool_worker_stats_t;
+
+// Number of queued jobs at a point in time (CLOCK_MONOTONIC nanoseconds)
+typedef struct {
+    uint64_t time_ns;
+    unsigned int depth;
+} ThreadPool_depth_sample_t;
+
+// Snapshot of a pool's counters, filled in by ThreadPool_get_stats. The
+// depth series keeps at most a fixed number of samples; when it fills up
+// every other sample is dropped and the spacing between samples doubles
+typedef struct {
+    unsigned int num_threads;
+    ThreadPool_worker_stats_t *workers;
+    ThreadPool_depth_sample_t *samples;
+    unsigned int sample_count;
+    unsigned int max_depth;
+} ThreadPool_stats_t;
+
+// Counters of a pool, only allocated in builds with MR_ENABLE_STATS
+struct ThreadPool_counters;
+
 typedef struct {
     pthread_t *threads;
     ThreadPool_job_queue_t jobs;
     unsigned int num_threads;
-    bool shutdown;
+    atomic_bool shutdown;
+    ThreadPool_mode_t mode;
+    ThreadPool_deque_t *deques;
+    atomic_uint next_worker;
+    atomic_uint next_deque;
+    atomic_uint queued;
+    atomic_uint sleepers;
+    atomic_ulong submitted;
+    atomic_ulong finished;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+    struct ThreadPool_counters *counters;
 } ThreadPool_t;
 
 /**
@@ -39,6 +115,18 @@ typedef struct {
  */
 ThreadPool_t *ThreadPool_create(unsigned int num);
 
+/**
+ * C style constructor for a ThreadPool using the given queueing mode. In
+ * work-stealing mode jobs from a worker go to its own deque and jobs from
+ * other threads are spread round-robin; job sizes and the policy are ignored
+ * Parameters:
+ *     num  - Number of threads to create
+ *     mode - TP_MODE_SHARED_QUEUE or TP_MODE_WORK_STEALING
+ * Return:
+ *     ThreadPool_t* - Pointer to the newly created ThreadPool object
+ */
+ThreadPool_t *ThreadPool_create_mode(unsigned int num, ThreadPool_mode_t mode);
+
 /**
  * C style destructor to destroy a ThreadPool object
  * Parameters:
@@ -47,24 +135,51 @@ ThreadPool_t *ThreadPool_create(unsigned int num);
 void ThreadPool_destroy(ThreadPool_t *tp);
 
 /**
- * Add a job to the ThreadPool's job queue in a Shortest Job First (SJF) manner
+ * Select the order in which queued jobs are run; jobs already queued are
+ * reordered
+ * Parameters:
+ *     tp     - Pointer to the ThreadPool object
+ *     policy - Scheduling policy (SJF by default)
+ */
+void ThreadPool_set_policy(ThreadPool_t *tp, ThreadPool_policy_t policy);
+
+/**
+ * Add a job to the ThreadPool's job queue according to the scheduling
+ * policy, Shortest Job First (SJF) by default
  * Parameters:
  *     tp   - Pointer to the ThreadPool object
  *     func - Pointer to the function that will be called by the serving thread
  *     arg  - Arguments for that function
- *     size - Size of the job, used to prioritize jobs in SJF order
+ *     size - Size of the job, used to prioritize jobs in SJF/LJF order
  * Return:
  *     true  - On success
  *     false - Otherwise
  */
-bool ThreadPool_add_job(ThreadPool_t *tp, thread_func_t func, void *arg, int size);
+bool ThreadPool_add_job(ThreadPool_t *tp, thread_func_t func, void *arg, long size);
+
+/**
+ * Add a batch of jobs that share one function, taking the queue lock once
+ * Parameters:
+ *     tp    - Pointer to the ThreadPool object
+ *     func  - Pointer to the function that will be called for every job
+ *     args  - Argument of each job
+ *     sizes - Size of each job, or NULL to give every job size 0
+ *     count - Number of jobs
+ * Return:
+ *     true  - On success
+ *     false - Otherwise (no job was added)
+ */
+bool ThreadPool_add_jobs(ThreadPool_t *tp, thread_func_t func, void **args, const long *sizes,
+                         unsigned int count);
 
 /**
- * Get a job from the job queue of the ThreadPool object
+ * Get a job from the job queue of the ThreadPool object. In work-stealing
+ * mode this does not block: it pops the caller's deque (if the caller is a
+ * worker) or steals from the others, and returns NULL when all are empty
  * Parameters:
  *     tp - Pointer to the ThreadPool object
  * Return:
- *     ThreadPool_job_t* - Next job to run (shortest job first)
+ *     ThreadPool_job_t* - Next job to run according to the policy
  */
 ThreadPool_job_t *ThreadPool_get_job(ThreadPool_t *tp);
 
@@ -76,6 +191,45 @@ ThreadPool_job_t *ThreadPool_get_job(ThreadPool_t *tp);
  */
 void *Thread_run(ThreadPool_t *tp);
 
+/**
+ * Get the index of the calling thread within the pool
+ * Parameters:
+ *     tp - Pointer to the ThreadPool object
+ * Return:
+ *     int - Index in [0, num_threads) for a thread of tp, -1 otherwise
+ */
+int ThreadPool_worker_index(ThreadPool_t *tp);
+
+/**
+ * Get when the job the calling worker is running started, so a caller can
+ * charge the time to whatever submitted the job
+ * Parameters:
+ *     tp - Pointer to the ThreadPool object
+ * Return:
+ *     uint64_t - CLOCK_MONOTONIC nanoseconds, or 0 for a thread outside tp,
+ *                between jobs, or without MR_ENABLE_STATS
+ */
+uint64_t ThreadPool_job_started_ns(ThreadPool_t *tp);
+
+/**
+ * Take a snapshot of the pool's counters since it was created. Time a
+ * worker has spent idle so far is included even if it is still waiting
+ * Parameters:
+ *     tp    - Pointer to the ThreadPool object
+ *     stats - Filled in with malloc'd copies; release with ThreadPool_free_stats
+ * Return:
+ *     true  - On success
+ *     false - When the pool was built without MR_ENABLE_STATS (stats is zeroed)
+ */
+bool ThreadPool_get_stats(ThreadPool_t *tp, ThreadPool_stats_t *stats);
+
+/**
+ * Release the arrays of a snapshot taken with ThreadPool_get_stats
+ * Parameters:
+ *     stats - Snapshot to release
+ */
+void ThreadPool_free_stats(ThreadPool_stats_t *stats);
+
 /**
  * Ensure that all threads are idle and the job queue is empty before returning
  * Parameters:
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "tokenizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+// Tracks a token that may span several blocks of the buffer
+typedef struct {
+    size_t start;
+    int in_token;
+} ScanState;
+
+typedef void (*scan_func_t)(const char *data, size_t length, token_func_t func, void *arg);
+
+static scan_func_t scan_impl;
+static Tokenizer_impl_t selected_impl;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+static inline int is_delimiter(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// Byte-at-a-time scan of data[from, length), continuing the state left by
+// any vector blocks before it, and emitting the final token
+static void scan_tail(const char *data, size_t from, size_t length, ScanState *state,
+                      token_func_t func, void *arg) {
+    for (size_t i = from; i < length; i++) {
+        if (is_delimiter(data[i])) {
+            if (state->in_token) {
+                func(data + state->start, i - state->start, arg);
+                state->in_token = 0;
+            }
+        } else if (!state->in_token) {
+            state->start = i;
+            state->in_token = 1;
+        }
+    }
+    if (state->in_token) {
+        func(data + state->start, length - state->start, arg);
+        state->in_token = 0;
+    }
+}
+
+// Walks the token boundaries of one block of width bytes starting at base;
+// bit i of mask is set when byte base + i is a delimiter
+static inline void scan_mask(const char *data, size_t base, uint64_t mask, unsigned int width,
+                             ScanState *state, token_func_t func, void *arg) {
+    uint64_t all = (1ULL << width) - 1;
+
+    // Blocks entirely inside a token or entirely delimiters change nothing
+    if ((state->in_token && mask == 0) || (!state->in_token && mask == all)) {
+        return;
+    }
+
+    unsigned int pos = 0;
+    while (pos < width) {
+        uint64_t bits = (state->in_token ? mask : ~mask & all) >> pos;
+        if (bits == 0) {
+            return;
+        }
+        pos += (unsigned int)__builtin_ctzll(bits);
+        if (state->in_token) {
+            func(data + state->start, base + pos - state->start, arg);
+            state->in_token = 0;
+        } else {
+            state->start = base + pos;
+            state->in_token = 1;
+        }
+    }
+}
+
+static void scan_scalar(const char *data, size_t length, token_func_t func, void *arg) {
+    ScanState state = {0, 0};
+    scan_tail(data, 0, length, &state, func, arg);
+}
+
+#ifdef TOKENIZER_X86
+// Compares 16 bytes against the four delimiters at once
+static void scan_sse2(const char *data, size_t length, token_func_t func, void *arg) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    ScanState state = {0, 0};
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i delims = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab)),
+                                      _mm_or_si128(_mm_cmpeq_epi8(block, newline), _mm_cmpeq_epi8(block, cr)));
+        uint64_t mask = (uint32_t)_mm_movemask_epi8(delims);
+        scan_mask(data, i, mask, 16, &state, func, arg);
+    }
+    scan_tail(data, i, length, &state, func, arg);
+}
+
+// Compares 32 bytes against the four delimiters at once
+__attribute__((target("avx2")))
+static void scan_avx2(const char *data, size_t length, token_func_t func, void *arg) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    ScanState state = {0, 0};
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i delims = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, space), _mm256_cmpeq_epi8(block, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, newline), _mm256_cmpeq_epi8(block, cr)));
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(delims);
+        scan_mask(data, i, mask, 32, &state, func, arg);
+    }
+    scan_tail(data, i, length, &state, func, arg);
+}
+#endif
+
+// Installs a scanner, downgrading requests the CPU cannot run
+static Tokenizer_impl_t install(Tokenizer_impl_t impl) {
+#ifdef TOKENIZER_X86
+    __builtin_cpu_init();
+    if ((impl == TOKENIZER_AUTO || impl == TOKENIZER_AVX2) && __builtin_cpu_supports("avx2")) {
+        scan_impl = scan_avx2;
+        return TOKENIZER_AVX2;
+    }
+    if (impl != TOKENIZER_SCALAR && __builtin_cpu_supports("sse2")) {
+        scan_impl = scan_sse2;
+        return TOKENIZER_SSE2;
+    }
+#else
+    (void)impl;
+#endif
+    scan_impl = scan_scalar;
+    return TOKENIZER_SCALAR;
+}
+
+static void select_default(void) {
+    selected_impl = install(TOKENIZER_AUTO);
+}
+
+// Choose the scanner used by Tokenizer_scan
+Tokenizer_impl_t Tokenizer_select(Tokenizer_impl_t impl) {
+    pthread_once(&select_once, select_default);
+    selected_impl = install(impl);
+    return selected_impl;
+}
+
+// Split a buffer into whitespace-separated tokens
+void Tokenizer_scan(const char *data, size_t length, token_func_t func, void *arg) {
+    pthread_once(&select_once, select_default);
+    scan_impl(data, length, func, arg);
+}
+
+// Get the name of a scanner
+const char *Tokenizer_name(Tokenizer_impl_t impl) {
+    switch (impl) {
+    case TOKENIZER_SCALAR:
+        return "scalar";
+    case TOKENIZER_SSE2:
+        return "sse2";
+    case TOKENIZER_AVX2:
+        return "avx2";
+    case TOKENIZER_AUTO:
+    default:
+        return "auto";
+    }
+}
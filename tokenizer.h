@@ -0,0 +1,47 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+
+// Called once for every token found, with a view into the scanned buffer
+typedef void (*token_func_t)(const char *token, size_t len, void *arg);
+
+// Delimiter scanners; AUTO picks the widest one the CPU supports
+typedef enum {
+    TOKENIZER_AUTO,
+    TOKENIZER_SCALAR,
+    TOKENIZER_SSE2,
+    TOKENIZER_AVX2
+} Tokenizer_impl_t;
+
+/**
+ * Split a buffer into tokens separated by spaces, tabs, newlines and
+ * carriage returns, calling func for each non-empty token
+ * Parameters:
+ *     data   - Buffer to scan (need not be NUL-terminated)
+ *     length - Number of bytes in the buffer
+ *     func   - Function called with each token
+ *     arg    - Argument passed through to func
+ */
+void Tokenizer_scan(const char *data, size_t length, token_func_t func, void *arg);
+
+/**
+ * Choose the scanner used by Tokenizer_scan. Requests for an instruction set
+ * the CPU lacks fall back to the best supported one
+ * Parameters:
+ *     impl - Scanner to use, or TOKENIZER_AUTO for runtime detection
+ * Return:
+ *     Tokenizer_impl_t - Scanner actually selected
+ */
+Tokenizer_impl_t Tokenizer_select(Tokenizer_impl_t impl);
+
+/**
+ * Get the name of a scanner, e.g. for benchmark output
+ * Parameters:
+ *     impl - Scanner
+ * Return:
+ *     const char* - Its name
+ */
+const char *Tokenizer_name(Tokenizer_impl_t impl);
+
+#endif